@@ -2,10 +2,18 @@
 
 #include "../include/hashhelper.h"
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
 
 // Internal helpers
-void CountSharedCollisons(const struct PageTableEntryInfo *pte1, const unsigned char *zerohash, const char* filename, struct CollisionInfo *info);
-void CountSharingOpsCollisons(const struct PageTableEntryInfo *pte1, const unsigned char *zerohash, const char* filename, struct CollisionInfo *info);
+static void* ShardWorker(void *data);
+static void ReserveFilter(HashMap *map, size_t keys);
+static inline void AddToFilter(HashMap *map, const ContentKey &key);
 
 
 //Create HashMaps
@@ -15,6 +23,7 @@ HashMap* CreateHashMap()
 	map = new HashMap();
 	map->hm = new ContentMap();
 	map->pm = new PFNMap();
+	map->filter = NULL;
 	return map;
 }
 
@@ -25,6 +34,7 @@ void ReleaseHashMap(HashMap* map)
 	{
 		map->hm->clear();
 		map->pm->clear();
+		delete map->filter;
 		delete map->hm;
 		delete map->pm;
 		delete map;
@@ -32,20 +42,23 @@ void ReleaseHashMap(HashMap* map)
 }
 
 
-int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
+// specialized per hash size, so the key is built without a length check per page
+template<int HASH_SIZE> static int AddPagesToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
 {
 	const unsigned char *zerohash;
-	char tmp_buffer[MAX_TMP_BUFFER_SIZE];
+	const int hash_size = HASH_SIZE;
+	struct ClassCounters counters;
+	unsigned char *vma_classes;
 	int i;
 
-	if (map==NULL)
+	vma_classes = CreateVMAClasses(snap);
+	if (vma_classes==NULL)
 		return -1;
-	if (snap==NULL)
-		return -2;
-	if (info==NULL)
-		return -3;
-
+	memset(&counters, 0, sizeof(struct ClassCounters));
 	zerohash = GetZeroPageHash(snap->flags);
+	// every page might be a new content
+	map->hm->reserve(map->hm->size() + snap->available_pages);
+	ReserveFilter(map, map->hm->size() + snap->available_pages);
 
 	for(i=0;i<snap->available_pages;i++)
 	{
@@ -65,19 +78,17 @@ int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
 
 			pair<ContentMap::iterator, bool> ret;
 			ContentPair p;
-			p = ContentPair(string(ConvertMD5Hash(snap->pages[i].hash, tmp_buffer)), &snap->pages[i]);
+			p = ContentPair(MakeContentKey<HASH_SIZE>(snap->pages[i].hash), &snap->pages[i]);
 
 			ret = map->hm->insert(p);
 			if (!ret.second)
 			{
-				//increment internal count
-				ret.first->second->reserved++;
 				//if (p.second->present >0)
 				{
 					info->shareable++;
 					if (p.second->pfn == ret.first->second->pfn)
 					{
-						CountSharedCollisons(p.second, zerohash, snap->vms[p.second->present-1].file_name, info);
+						counters.shared[GetPageClass(vma_classes, p.second, zerohash, hash_size)]++;
 					}
 					else
 					{
@@ -85,11 +96,11 @@ int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
 						PFNMap::iterator it;
 						pair<PFNMap::iterator, bool> ret;
 		
-						ret = map->pm->insert(PFNPair(p.second->pfn, p.second));
+						ret = map->pm->insert(PFNPair((unsigned long)p.second->pfn, p.second));
 						if (!ret.second)
 						{
 							// found - so already in map => shared
-							CountSharedCollisons(p.second, zerohash, snap->vms[p.second->present-1].file_name, info);						
+							counters.shared[GetPageClass(vma_classes, p.second, zerohash, hash_size)]++;						
 						}
 						else
 						{
@@ -97,7 +108,7 @@ int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
 								it3 = map->hm->find(p.first);
 								if (it3!=map->hm->end())				
 								{*/
-									CountSharingOpsCollisons(p.second, zerohash, snap->vms[p.second->present-1].file_name, info);
+									counters.sharing_op[GetPageClass(vma_classes, p.second, zerohash, hash_size)]++;
 								//}
 						}
 					}
@@ -105,11 +116,15 @@ int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
 			}
 			else
 			{
+				AddToFilter(map, p.first);
 				info->unshareable++;
 			}
 		}
 	}
 
+	AddClassCounters(info, &counters);
+	free(vma_classes);
+
 	//printf("unshareable: %d\n", info->unshareable);
 	//printf("shareable: %d\n", info->shareable);
 	//printf("shared: %d\n", info->shared);
@@ -120,9 +135,32 @@ int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
 	return info->shareable;
 }
 
+int AddSnapshotToHashMap(HashMap* map, VMSNAPSHOT snap, CollisionInfo *info)
+{
+	if (map==NULL)
+		return -1;
+	if (snap==NULL)
+		return -2;
+	if (info==NULL)
+		return -3;
+
+	switch (GetHashSize(snap->flags))
+	{
+	case HASH_CRC32_SIZE:
+		return AddPagesToHashMap<HASH_CRC32_SIZE>(map, snap, info);
+	case HASH_SHA1_SIZE:
+		return AddPagesToHashMap<HASH_SHA1_SIZE>(map, snap, info);
+	default:
+		return AddPagesToHashMap<HASH_KEY_SIZE>(map, snap, info);
+	}
+}
+
 int MergeHashMaps(HashMap* map1, HashMap *map2, VMSNAPSHOT snap, CollisionInfo *info)
 {
 	const unsigned char *zerohash;
+	int hash_size;
+	struct ClassCounters counters;
+	unsigned char *vma_classes;
 	if (map1==NULL)
 		return -1;
 	if (map2==NULL)
@@ -135,6 +173,12 @@ int MergeHashMaps(HashMap* map1, HashMap *map2, VMSNAPSHOT snap, CollisionInfo *
 	iter = map2->hm->begin();
 	
 	zerohash = GetZeroPageHash(snap->flags);
+	hash_size = GetHashSize(snap->flags);
+	vma_classes = CreateVMAClasses(snap);
+	if (vma_classes==NULL)
+		return -1;
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	ReserveFilter(map1, map1->hm->size() + map2->hm->size());
 
 	while(iter!=map2->hm->end())
 	{
@@ -150,21 +194,29 @@ int MergeHashMaps(HashMap* map1, HashMap *map2, VMSNAPSHOT snap, CollisionInfo *
 			{
 				info->shareable++;
 				if (it->second->pfn == iter->second->pfn)
-					CountSharedCollisons(it->second, zerohash, snap->vms[it->second->present-1].file_name, info);
+					counters.shared[GetPageClass(vma_classes, it->second, zerohash, hash_size)]++;
 				else
-					CountSharingOpsCollisons(it->second, zerohash, snap->vms[it->second->present-1].file_name, info);				
+					counters.sharing_op[GetPageClass(vma_classes, it->second, zerohash, hash_size)]++;				
 			}
 			
 		}
+		else
+			AddToFilter(map1, iter->first);
 		iter++;
 	}
 
+	AddClassCounters(info, &counters);
+	free(vma_classes);
+
 	return info->shareable;
 }
 
 int ProbeHashMaps(HashMap* map1, HashMap *map2, VMSNAPSHOT snap, CollisionInfo *info)
 {
 	const unsigned char *zerohash;
+	int hash_size;
+	struct ClassCounters counters;
+	unsigned char *vma_classes;
 	if (map1==NULL)
 		return -1;
 	if (map2==NULL)
@@ -177,6 +229,11 @@ int ProbeHashMaps(HashMap* map1, HashMap *map2, VMSNAPSHOT snap, CollisionInfo *
 	iter = map2->hm->begin();
 	
 	zerohash = GetZeroPageHash(snap->flags);
+	hash_size = GetHashSize(snap->flags);
+	vma_classes = CreateVMAClasses(snap);
+	if (vma_classes==NULL)
+		return -1;
+	memset(&counters, 0, sizeof(struct ClassCounters));
 
 	while(iter!=map2->hm->end())
 	{
@@ -189,15 +246,18 @@ int ProbeHashMaps(HashMap* map1, HashMap *map2, VMSNAPSHOT snap, CollisionInfo *
 			{
 				info->shareable++;
 				if (it->second->pfn == iter->second->pfn)
-					CountSharedCollisons(it->second, zerohash, snap->vms[it->second->present-1].file_name, info);
+					counters.shared[GetPageClass(vma_classes, it->second, zerohash, hash_size)]++;
 				else
-					CountSharingOpsCollisons(it->second, zerohash, snap->vms[it->second->present-1].file_name, info);				
+					counters.sharing_op[GetPageClass(vma_classes, it->second, zerohash, hash_size)]++;				
 			}
 			
 		}
 		iter++;
 	}
 
+	AddClassCounters(info, &counters);
+	free(vma_classes);
+
 	return 0;
 }
 
@@ -207,113 +267,99 @@ void ClearHashMap(HashMap* map)
 	{
 		map->hm->clear();
 		map->pm->clear();
+		if (map->filter!=NULL)
+			map->filter->clear();
 	}
 }
 
-void CountSharedCollisons(const struct PageTableEntryInfo *pte1, const unsigned char *zerohash, const char* filename, struct CollisionInfo *info)
+void EnableHashMapFilter(HashMap *map, int bits_per_key)
 {
+	ContentMap::iterator it;
+	size_t keys;
 
-	info->shared++;
-	if (CompareHash(pte1->hash, zerohash, 20)==0)
-		info->shared_zero++;
+	if (map==NULL)
+		return;
 
-	//printf("SH:%s\n", filename);
-	switch(filename[0])
-	{
-	case STACK_MARK:
-		info->s_stack++;
-		if (IsWriteable(pte1->pte_flags))
-			info->s_srw++;
-		break;
-	case HEAP_MARK:
-		info->s_heap++;
-		if (IsWriteable(pte1->pte_flags))
-			info->s_hrw++;
-		break;
-	case '/':
-		if (pte1->inode_no>=1)
-		{
-			info->s_named++;
-			if (IsWriteable(pte1->pte_flags))
-				info->s_nrw++;
-		}
-		else
-		{
-			info->s_anon++;
-			if (IsWriteable(pte1->pte_flags))
-				info->s_arw++;
-		}
-		break;
-	default:
-		info->s_named++;
-		if (IsWriteable(pte1->pte_flags))
-			info->s_nrw++;
-		break;
-	}
+	// room to grow before the filter is rebuilt
+	keys = map->hm->size() * 2;
+	if (keys < 65536)
+		keys = 65536;
+
+	delete map->filter;
+	map->filter = new BloomFilter(keys, bits_per_key);
+	for (it=map->hm->begin();it!=map->hm->end();it++)
+		map->filter->insert(HashContentKey(it->first.bytes));
 }
-void CountSharingOpsCollisons(const struct PageTableEntryInfo *pte1, const unsigned char *zerohash, const char* filename, struct CollisionInfo *info)
+
+void DisableHashMapFilter(HashMap *map)
 {
-	info->sharing_op++;
-	if (CompareHash(pte1->hash, zerohash, 20)==0)
-		info->sharing_zero++;
+	if (map==NULL)
+		return;
 
-	//printf("SO:%s\n", filename);
-	switch(filename[0])
+	delete map->filter;
+	map->filter = NULL;
+}
+
+// baselines of TestSnapshotAgainstBase
+struct HashMapBase
+{
+	HashMap *map;
+
+	bool FindContent(const ContentKey &key, unsigned long &pfn)
 	{
-	case STACK_MARK:
-		info->o_stack++;
-		if (IsWriteable(pte1->pte_flags))
-			info->o_srw++;
-		break;
-	case HEAP_MARK:
-		info->o_heap++;
-		if (IsWriteable(pte1->pte_flags))
-			info->o_hrw++;
-		break;
-	case '/':
-		if (pte1->inode_no>=1)
-		{
-			info->o_named++;
-			if (IsWriteable(pte1->pte_flags))
-				info->o_nrw++;
-		}
-		else
-		{
-			info->o_anon++;
-			if (IsWriteable(pte1->pte_flags))
-				info->o_arw++;
-		}
-		break;
-	default:
-		info->o_named++;
-		if (IsWriteable(pte1->pte_flags))
-			info->o_nrw++;
-		break;
+		// most pages of a new snapshot miss the baseline
+		if (map->filter!=NULL && !map->filter->contains(HashContentKey(key.bytes)))
+			return false;
+
+		ContentMap::iterator it = map->hm->find(key);
+		if (it==map->hm->end())
+			return false;
+		pfn = it->second->pfn;
+		return true;
 	}
-}
+	bool HasPFN(unsigned long pfn) { return map->pm->find(pfn)!=map->pm->end(); }
+};
 
-int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2)
+struct IndexBase
+{
+	HashMapIndex *index;
+
+	bool FindContent(const ContentKey &key, unsigned long &pfn) { return FindIndexContent(index, key.bytes, &pfn); }
+	bool HasPFN(unsigned long pfn) { return FindIndexPFN(index, pfn); }
+};
+
+// the baseline is either a HashMap or a mapped index file
+template<int HASH_SIZE, class Base> static int TestSnapshotAgainstBase(VMSNAPSHOT snap, Base &base, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2)
 {
 	const unsigned char *zerohash;
-	char tmp_buffer[MAX_TMP_BUFFER_SIZE];
+	const int hash_size = HASH_SIZE;
+	struct ClassCounters counters, counters2;
+	unsigned char *vma_classes;
+	ContentKey key;
+	unsigned long base_pfn;
 	int i;
 
-	if (map==NULL)
-		return -1;
 	if (snap==NULL)
 		return -2;
 	if (info==NULL)
 		return -3;
 	int test=0,test2=0;
 
+	vma_classes = CreateVMAClasses(snap);
+	if (vma_classes==NULL)
+		return -1;
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	memset(&counters2, 0, sizeof(struct ClassCounters));
+
 	PFNMap *newpfnmap = new PFNMap();
 
-	PFNMap::iterator it2;
 	pair<PFNMap::iterator, bool> ret;
 	pair<PFNMap::iterator, bool> ret2;
 	PFNPair pfn;	
 
 	zerohash = GetZeroPageHash(snap->flags);
+	if (map2!=NULL)
+		ReserveFilter(map2, map2->hm->size() + snap->available_pages);
 
 	for(i=0;i<snap->available_pages;i++)
 	{
@@ -332,24 +378,23 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 			}
 		//	pair<PFNMap::iterator, bool> ret2;
 		//	PFNPair pfn;
-		//	pfn = PFNPair(snap->pages[i].pfn,  &snap->pages[i]);
+		//	pfn = PFNPair((unsigned long)snap->pages[i].pfn,  &snap->pages[i]);
 		//	ret2 = newpfnmap->insert(pfn);
 			//if (1)//ret2.second)
 			//{
 				// we have to deal with it
 				//pair<ContentMap::iterator, bool> ret;
 				//ContentPair p;
-				//p = ContentPair(string(ConvertMD5Hash(snap->pages[i].hash, tmp_buffer)), &snap->pages[i]);
+				//p = ContentPair(ContentKey(snap->pages[i].hash), &snap->pages[i]);
 
 				//TODO maybe no add is better
-				ContentMap::iterator it;
-				it = map->hm->find(string(ConvertMD5Hash(snap->pages[i].hash, tmp_buffer)));
-				if (it!=map->hm->end())
+				key = MakeContentKey<HASH_SIZE>(snap->pages[i].hash);
+				if (base.FindContent(key, base_pfn))
 				{
 					//is in hashmap
 					
 						
-						if (snap->pages[i].pfn == it->second->pfn)
+						if (snap->pages[i].pfn == base_pfn)
 						{
 							//TODO check hash integrity
 							/*if (CompareMD5Hash(ret2.first->second->hash, snap->pages[i].hash)!=0)
@@ -359,7 +404,7 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 							}*/
 							
 								
-								CountSharedCollisons(&snap->pages[i], zerohash, snap->vms[snap->pages[i].present-1].file_name, info);
+								counters.shared[GetPageClass(vma_classes, &snap->pages[i], zerohash, hash_size)]++;
 								info->shareable++;
 							
 						}
@@ -369,12 +414,11 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 							
 							//TODO maybe no add is better
 			
-							it2 = map->pm->find(snap->pages[i].pfn);
-							if (it2!=map->pm->end())
+							if (base.HasPFN(snap->pages[i].pfn))
 							{
 								//TODO check hash integretiy
 								// found - so already in map => shared
-								CountSharedCollisons(&snap->pages[i], zerohash, snap->vms[snap->pages[i].present-1].file_name, info);						
+								counters.shared[GetPageClass(vma_classes, &snap->pages[i], zerohash, hash_size)]++;						
 								info->shareable++;
 							}
 							else
@@ -383,16 +427,16 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 								it3 = map2->hm->find(string(ConvertMD5Hash(snap->pages[i].hash, tmp_buffer)));
 								if (it3==map2->hm->end())				
 								{*/
-								pfn = PFNPair(snap->pages[i].pfn,  &snap->pages[i]);
+								pfn = PFNPair((unsigned long)snap->pages[i].pfn,  &snap->pages[i]);
 								ret2 = newpfnmap->insert(pfn);
 								if (ret2.second)
 								{
-									CountSharingOpsCollisons(&snap->pages[i], zerohash, snap->vms[snap->pages[i].present-1].file_name, info);
+									counters.sharing_op[GetPageClass(vma_classes, &snap->pages[i], zerohash, hash_size)]++;
 									info->shareable++;
 								}
 								else
 								{
-									CountSharedCollisons(&snap->pages[i], zerohash, snap->vms[snap->pages[i].present-1].file_name, info);						
+									counters.shared[GetPageClass(vma_classes, &snap->pages[i], zerohash, hash_size)]++;						
 									info->shareable++;
 								}
 							}
@@ -406,19 +450,17 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 
 					pair<ContentMap::iterator, bool> ret;
 					ContentPair p;
-					p = ContentPair(string(ConvertMD5Hash(snap->pages[i].hash, tmp_buffer)), &snap->pages[i]);
+					p = ContentPair(key, &snap->pages[i]);
 
 					ret = map2->hm->insert(p);
 					if (!ret.second)
 					{
-						//increment internal count
-						ret.first->second->reserved++;
 						//if (p.second->present >0)
 				
 							info2->shareable++;
 							if (p.second->pfn == ret.first->second->pfn)
 							{
-								CountSharedCollisons(p.second, zerohash, snap->vms[p.second->present-1].file_name, info2);
+								counters2.shared[GetPageClass(vma_classes, p.second, zerohash, hash_size)]++;
 							}
 							else
 							{
@@ -426,15 +468,15 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 								PFNMap::iterator it;
 								pair<PFNMap::iterator, bool> ret;
 		
-								ret = map2->pm->insert(PFNPair(p.second->pfn, p.second));
+								ret = map2->pm->insert(PFNPair((unsigned long)p.second->pfn, p.second));
 								if (!ret.second)
 								{
 									// found - so already in map => shared
-									CountSharedCollisons(p.second, zerohash, snap->vms[p.second->present-1].file_name, info2);						
+									counters2.shared[GetPageClass(vma_classes, p.second, zerohash, hash_size)]++;						
 								}
 								else
 								{
-									CountSharingOpsCollisons(p.second, zerohash, snap->vms[p.second->present-1].file_name, info2);
+									counters2.sharing_op[GetPageClass(vma_classes, p.second, zerohash, hash_size)]++;
 								}
 							}
 				
@@ -442,6 +484,7 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 					}
 					else
 					{
+						AddToFilter(map2, p.first);
 						info->unshareable++;
 					}
 				}
@@ -465,9 +508,57 @@ int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  Co
 	newpfnmap->clear();
 	delete newpfnmap;
 
+	AddClassCounters(info, &counters);
+	if (info2!=NULL)
+		AddClassCounters(info2, &counters2);
+	free(vma_classes);
+
 	return info->shareable;
 }
 
+// the wrappers pick the specialization of the hash size
+template<class Base> static int TestSnapshotAgainstBase(VMSNAPSHOT snap, Base &base, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2)
+{
+	if (snap==NULL)
+		return -2;
+
+	switch (GetHashSize(snap->flags))
+	{
+	case HASH_CRC32_SIZE:
+		return TestSnapshotAgainstBase<HASH_CRC32_SIZE>(snap, base, map2, info, info2);
+	case HASH_SHA1_SIZE:
+		return TestSnapshotAgainstBase<HASH_SHA1_SIZE>(snap, base, map2, info, info2);
+	default:
+		return TestSnapshotAgainstBase<HASH_KEY_SIZE>(snap, base, map2, info, info2);
+	}
+}
+
+int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2)
+{
+	HashMapBase base;
+
+	if (map==NULL)
+		return -1;
+	base.map = map;
+	return TestSnapshotAgainstBase(snap, base, map2, info, info2);
+}
+
+int TestSnapshotAgainstHashMapIndex(VMSNAPSHOT snap, HashMapIndex* index, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2)
+{
+	IndexBase base;
+
+	if (index==NULL)
+		return -1;
+	// the keys of another hash never match, all pages would count as unique
+	if ((snap->flags & VMS_HASH_MASK)!=(index->header->flags & VMS_HASH_MASK))
+	{
+		printf("The snapshot uses another page hash than the index.\n");
+		return -1;
+	}
+	base.index = index;
+	return TestSnapshotAgainstBase(snap, base, map2, info, info2);
+}
+
 int HashMapAgainstHashMap(HashMap *map1, HashMap *map2)
 {
 	int ret=0;
@@ -503,4 +594,666 @@ int HashMapAgainstHashMap(HashMap *map1, HashMap *map2)
 
 	printf("%d %d %d\n", ret, ret2, ret2-ret);
 	return ret;
-}
\ No newline at end of file
+}
+
+// for internal use only
+// a filter holding more keys than its capacity reports too many false hits
+static void ReserveFilter(HashMap *map, size_t keys)
+{
+	ContentMap::iterator it;
+
+	if (map->filter==NULL || keys <= map->filter->capacity())
+		return;
+
+	BloomFilter *filter = new BloomFilter(keys * 2, map->filter->bits());
+	for (it=map->hm->begin();it!=map->hm->end();it++)
+		filter->insert(HashContentKey(it->first.bytes));
+	delete map->filter;
+	map->filter = filter;
+}
+
+static inline void AddToFilter(HashMap *map, const ContentKey &key)
+{
+	if (map->filter!=NULL)
+		map->filter->insert(HashContentKey(key.bytes));
+}
+
+// Sharded maps
+// AddSnapshotToHashMap checks the pfn of a duplicate content in the global PFNMap.
+// So every snapshot is processed in three phases: every thread scans a range of the
+// pages and queues them for the shard owning their content, the content shards
+// classify their pages and queue duplicates with a different pfn for the shard
+// owning the pfn, then the pfn shards check the queued pages in page order.
+
+typedef vector<unsigned long> PageQueue;
+
+struct ShardJob
+{
+	ShardedHashMap *map;
+	VMSNAPSHOT *snaps;
+	int count;
+	PageQueue *content_queues; // [2][from range][to shard], alternating per snapshot
+	PageQueue *queues; // [2][from shard][to shard], alternating per snapshot
+	unsigned char **vma_classes; // per snapshot, see CreateVMAClasses
+	int *scanned; // page ranges done per snapshot
+	int *classified; // content shards done per snapshot
+	CollisionInfo *infos; // per shard
+	int failed;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct ShardWorkerInfo
+{
+	struct ShardJob *job;
+	int shard;
+};
+
+static inline int ContentShard(const ContentKey &key, int shard_count)
+{
+	return HashKeyHash<CONTENT_KEY_SIZE>()(key) % shard_count;
+}
+
+static inline int PFNShard(unsigned long pfn, int shard_count)
+{
+	return pfn % shard_count;
+}
+
+ShardedHashMap* CreateShardedHashMap(int shard_count)
+{
+	ShardedHashMap *map;
+	int i;
+
+	if (shard_count <= 0)
+		shard_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (shard_count <= 0)
+		shard_count = 1;
+
+	map = new ShardedHashMap();
+	map->shard_count = shard_count;
+	map->shards = new HashMap*[shard_count];
+	for (i=0;i<shard_count;i++)
+		map->shards[i] = CreateHashMap();
+	return map;
+}
+
+void ReleaseShardedHashMap(ShardedHashMap *map)
+{
+	int i;
+
+	if (map!=NULL)
+	{
+		for (i=0;i<map->shard_count;i++)
+			ReleaseHashMap(map->shards[i]);
+		delete[] map->shards;
+		delete map;
+	}
+}
+
+int AddSnapshotsToShardedHashMap(ShardedHashMap *map, VMSNAPSHOT *snaps, int count, CollisionInfo *info)
+{
+	struct ShardJob job;
+	struct ShardWorkerInfo *workers;
+	pthread_t *threads;
+	int n, i, started;
+
+	if (map==NULL)
+		return -1;
+	if (snaps==NULL)
+		return -2;
+	if (info==NULL)
+		return -3;
+	for (i=0;i<count;i++)
+		if (snaps[i]==NULL)
+			return -2;
+
+	// the shards share the region classes of every snapshot
+	job.vma_classes = new unsigned char*[count > 0 ? count : 1]();
+	for (i=0;i<count;i++)
+	{
+		job.vma_classes[i] = CreateVMAClasses(snaps[i]);
+		if (job.vma_classes[i]==NULL)
+			break;
+	}
+	if (i < count)
+	{
+		while (i-- > 0)
+			free(job.vma_classes[i]);
+		delete[] job.vma_classes;
+		return -1;
+	}
+
+	n = map->shard_count;
+	job.map = map;
+	job.snaps = snaps;
+	job.count = count;
+	job.failed = 0;
+	job.content_queues = new PageQueue[2*n*n];
+	job.queues = new PageQueue[2*n*n];
+	job.scanned = new int[count > 0 ? count : 1]();
+	job.classified = new int[count > 0 ? count : 1]();
+	job.infos = new CollisionInfo[n]();
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	workers = new ShardWorkerInfo[n];
+	threads = new pthread_t[n];
+	for (started=0;started<n;started++)
+	{
+		workers[started].job = &job;
+		workers[started].shard = started;
+		if (pthread_create(&threads[started], NULL, ShardWorker, &workers[started])!=0)
+			break;
+	}
+	if (started < n)
+	{
+		// the shards wait for each other - stop the started ones
+		printf("Could not start shard threads.\n");
+		pthread_mutex_lock(&job.lock);
+		job.failed = 1;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.lock);
+	}
+	for (i=0;i<started;i++)
+		pthread_join(threads[i], NULL);
+
+	if (!job.failed)
+		for (i=0;i<n;i++)
+			MergeCollisionInfo(info, &job.infos[i]);
+
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.lock);
+	delete[] threads;
+	delete[] workers;
+	delete[] job.infos;
+	delete[] job.classified;
+	delete[] job.scanned;
+	delete[] job.queues;
+	delete[] job.content_queues;
+	for (i=0;i<count;i++)
+		free(job.vma_classes[i]);
+	delete[] job.vma_classes;
+
+	if (job.failed)
+		return -4;
+	return info->shareable;
+}
+
+static void* ShardWorker(void *data)
+{
+	struct ShardWorkerInfo *worker = (struct ShardWorkerInfo*) data;
+	struct ShardJob *job = worker->job;
+	int n = job->map->shard_count;
+	int t = worker->shard;
+	HashMap *map = job->map->shards[t];
+	CollisionInfo *info = &job->infos[t];
+	const unsigned char *zerohash;
+	int hash_size;
+	struct ClassCounters counters;
+	unsigned char *vma_classes;
+	PageQueue *content_queues, *queues, *from;
+	vector<size_t> pos(n);
+	VMSNAPSHOT snap;
+	struct PageTableEntryInfo *page;
+	unsigned long i, j, next, range_end;
+	int k, u, best;
+
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	for (k=0;k<job->count;k++)
+	{
+		snap = job->snaps[k];
+		vma_classes = job->vma_classes[k];
+		zerohash = GetZeroPageHash(snap->flags);
+		hash_size = GetHashSize(snap->flags);
+		content_queues = &job->content_queues[(k%2)*n*n];
+		queues = &job->queues[(k%2)*n*n];
+
+		// phase 0: pages of this range to the shards of their contents
+		for (u=0;u<n;u++)
+			content_queues[t*n+u].clear();
+		range_end = snap->available_pages * (t+1) / n;
+		for (i=snap->available_pages * t / n;i<range_end;i++)
+		{
+			page = &snap->pages[i];
+			if (page->present > 0)
+				content_queues[t*n+ContentShard(MakeContentKey(page->hash, hash_size), n)].push_back(i);
+		}
+
+		pthread_mutex_lock(&job->lock);
+		job->scanned[k]++;
+		pthread_cond_broadcast(&job->cond);
+		while (job->scanned[k] < n && !job->failed)
+			pthread_cond_wait(&job->cond, &job->lock);
+		pthread_mutex_unlock(&job->lock);
+		if (job->failed)
+			break;
+
+		// phase 1: contents of this shard, the ranges are in page order
+		for (u=0;u<n;u++)
+			queues[t*n+u].clear();
+		map->hm->reserve(map->hm->size() + snap->available_pages/n + 1);
+
+		for (u=0;u<n;u++)
+		{
+			from = &content_queues[u*n+t];
+			for (j=0;j<from->size();j++)
+			{
+				i = (*from)[j];
+				page = &snap->pages[i];
+				ContentKey key = MakeContentKey(page->hash, hash_size);
+
+				if (page->reference_count>1)
+				{
+					info->shared_counter++;
+					if (page->inode_no>2)
+						info->named_shared_counter++;
+				}
+
+				pair<ContentMap::iterator, bool> ret;
+				ret = map->hm->insert(ContentPair(key, page));
+				if (!ret.second)
+				{
+					info->shareable++;
+					if (page->pfn == ret.first->second->pfn)
+						counters.shared[GetPageClass(vma_classes, page, zerohash, hash_size)]++;
+					else
+						queues[t*n+PFNShard(page->pfn, n)].push_back(i);
+				}
+				else
+				{
+					AddToFilter(map, key);
+					info->unshareable++;
+				}
+			}
+		}
+
+		pthread_mutex_lock(&job->lock);
+		job->classified[k]++;
+		pthread_cond_broadcast(&job->cond);
+		while (job->classified[k] < n && !job->failed)
+			pthread_cond_wait(&job->cond, &job->lock);
+		pthread_mutex_unlock(&job->lock);
+		if (job->failed)
+			break;
+
+		// phase 2: pfns of this shard, the queues are merged in page order
+		for (u=0;u<n;u++)
+			pos[u] = 0;
+		while (1)
+		{
+			best = -1;
+			next = 0;
+			for (u=0;u<n;u++)
+			{
+				from = &queues[u*n+t];
+				if (pos[u] < from->size() && (best < 0 || (*from)[pos[u]] < next))
+				{
+					best = u;
+					next = (*from)[pos[u]];
+				}
+			}
+			if (best < 0)
+				break;
+			pos[best]++;
+
+			page = &snap->pages[next];
+			if (!map->pm->insert(PFNPair((unsigned long)page->pfn, page)).second)
+				counters.shared[GetPageClass(vma_classes, page, zerohash, hash_size)]++;
+			else
+				counters.sharing_op[GetPageClass(vma_classes, page, zerohash, hash_size)]++;
+		}
+	}
+
+	AddClassCounters(info, &counters);
+	return NULL;
+}
+
+// Sliding window map
+
+WindowHashMap* CreateWindowHashMap()
+{
+	WindowHashMap *map;
+	map = new WindowHashMap();
+	map->hm = new WindowContentMap();
+	map->snapshots = new WindowSnapshotMap();
+	map->next_id = 0;
+	map->flags = 0;
+	map->pages = 0;
+	map->shared_contents = 0;
+	return map;
+}
+
+void ReleaseWindowHashMap(WindowHashMap *map)
+{
+	WindowSnapshotMap::iterator it;
+
+	if (map==NULL)
+		return;
+
+	for (it=map->snapshots->begin();it!=map->snapshots->end();it++)
+		delete it->second;
+	delete map->snapshots;
+	delete map->hm;
+	delete map;
+}
+
+int AddSnapshotToWindowHashMap(WindowHashMap *map, VMSNAPSHOT snap)
+{
+	FlatMap<ContentKey, unsigned int, HashKeyHash<CONTENT_KEY_SIZE> > own;
+	pair<FlatMap<ContentKey, unsigned int, HashKeyHash<CONTENT_KEY_SIZE> >::iterator, bool> ret;
+	pair<WindowContentMap::iterator, bool> entry;
+	vector<struct WindowRef> *refs;
+	struct WindowEntry empty = {0, 0};
+	struct WindowRef ref;
+	unsigned long i;
+	int hash_size;
+
+	if (map==NULL)
+		return -1;
+	if (snap==NULL)
+		return -2;
+	hash_size = GetHashSize(snap->flags);
+
+	// collect the contents of the snapshot first, every entry is touched once per snapshot
+	refs = new vector<struct WindowRef>();
+	own.reserve(snap->available_pages);
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (snap->pages[i].present <= 0)
+			continue;
+
+		ref.key = MakeContentKey(snap->pages[i].hash, hash_size);
+		ret = own.insert(pair<ContentKey, unsigned int>(ref.key, refs->size()));
+		if (ret.second)
+		{
+			ref.pages = 1;
+			refs->push_back(ref);
+		}
+		else
+			(*refs)[ret.first->second].pages++;
+	}
+
+	map->hm->reserve(map->hm->size() + refs->size());
+	for (i=0;i<refs->size();i++)
+	{
+		entry = map->hm->insert(pair<ContentKey, struct WindowEntry>((*refs)[i].key, empty));
+		entry.first->second.pages += (*refs)[i].pages;
+		entry.first->second.snapshots++;
+		if (entry.first->second.snapshots==2)
+			map->shared_contents++;
+		map->pages += (*refs)[i].pages;
+	}
+
+	map->flags = snap->flags;
+	(*map->snapshots)[map->next_id] = refs;
+	return map->next_id++;
+}
+
+int RemoveSnapshotFromHashMap(WindowHashMap *map, int snapshot_id)
+{
+	WindowSnapshotMap::iterator snap_it;
+	WindowContentMap::iterator it;
+	vector<struct WindowRef> *refs;
+	unsigned long i;
+
+	if (map==NULL)
+		return -1;
+
+	snap_it = map->snapshots->find(snapshot_id);
+	if (snap_it==map->snapshots->end())
+		return -1;
+	refs = snap_it->second;
+
+	for (i=0;i<refs->size();i++)
+	{
+		it = map->hm->find((*refs)[i].key);
+		if (it==map->hm->end())
+			continue;
+
+		it->second.pages -= (*refs)[i].pages;
+		it->second.snapshots--;
+		if (it->second.snapshots==1)
+			map->shared_contents--;
+		else if (it->second.snapshots==0)
+			map->hm->erase(it);
+		map->pages -= (*refs)[i].pages;
+	}
+
+	delete refs;
+	map->snapshots->erase(snap_it);
+	return 0;
+}
+
+void GetWindowInfo(WindowHashMap *map, struct WindowInfo *info)
+{
+	WindowContentMap::iterator it;
+
+	info->snapshots = map->snapshots->size();
+	info->pages = map->pages;
+	info->contents = map->hm->size();
+	info->shareable = map->pages - map->hm->size();
+	info->shared_contents = map->shared_contents;
+	info->zero_pages = 0;
+
+	if (map->hm->size()!=0)
+	{
+		it = map->hm->find(MakeContentKey(GetZeroPageHash(map->flags), GetHashSize(map->flags)));
+		if (it!=map->hm->end())
+			info->zero_pages = it->second.pages;
+	}
+}
+
+// Index files
+
+static bool CompareIndexContent(const struct IndexContent &a, const struct IndexContent &b)
+{
+	return memcmp(a.key, b.key, CONTENT_KEY_SIZE) < 0;
+}
+
+static inline unsigned long IndexDirSlot(const unsigned char *key)
+{
+	return ((unsigned long)key[0] << 8) | key[1];
+}
+
+// every section must lie inside the file and the directory must point into the contents
+static int CheckIndexLayout(const struct HashMapIndexHeader *header, unsigned long size)
+{
+	const unsigned long *dir;
+	unsigned long dir_size = ((1ul << HASHMAP_INDEX_DIR_BITS) + 1) * sizeof(unsigned long);
+	unsigned long slot;
+
+	if (header->dir_offset < sizeof(struct HashMapIndexHeader) || header->dir_offset % sizeof(unsigned long)!=0
+		|| header->dir_offset > size || dir_size > size - header->dir_offset)
+		return -1;
+	if (header->content_offset < header->dir_offset + dir_size || header->content_offset % sizeof(unsigned long)!=0
+		|| header->content_offset > size || header->content_count > (size - header->content_offset) / sizeof(struct IndexContent))
+		return -1;
+	if (header->pfn_offset < header->content_offset + header->content_count * sizeof(struct IndexContent)
+		|| header->pfn_offset % sizeof(unsigned long)!=0 || header->pfn_offset > size
+		|| (size - header->pfn_offset) % sizeof(unsigned long)!=0
+		|| header->pfn_count!=(size - header->pfn_offset) / sizeof(unsigned long))
+		return -1;
+
+	dir = (const unsigned long*) ((const char*)header + header->dir_offset);
+	for (slot=0;slot < (1ul << HASHMAP_INDEX_DIR_BITS);slot++)
+		if (dir[slot] > dir[slot+1])
+			return -1;
+	return dir[slot] <= header->content_count ? 0 : -1;
+}
+
+static int WriteIndexData(int file, const void *data, unsigned long size)
+{
+	unsigned long done = 0;
+	ssize_t ret;
+
+	while (done < size)
+	{
+		ret = write(file, (const char*)data + done, size - done);
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
+
+int SaveHashMapIndex(HashMap *map, int flags, const char *path)
+{
+	struct HashMapIndexHeader header;
+	vector<struct IndexContent> contents;
+	vector<unsigned long> pfns, dir;
+	struct IndexContent content;
+	ContentMap::iterator it;
+	PFNMap::iterator pit;
+	unsigned long i, slot;
+	int file, ret;
+
+	if (map==NULL)
+		return -1;
+
+	contents.reserve(map->hm->size());
+	for (it=map->hm->begin();it!=map->hm->end();it++)
+	{
+		memcpy(content.key, it->first.bytes, CONTENT_KEY_SIZE);
+		content.pfn = it->second->pfn;
+		contents.push_back(content);
+	}
+	sort(contents.begin(), contents.end(), CompareIndexContent);
+
+	pfns.reserve(map->pm->size());
+	for (pit=map->pm->begin();pit!=map->pm->end();pit++)
+		pfns.push_back(pit->first);
+	sort(pfns.begin(), pfns.end());
+
+	// dir[slot] is the first content with a key prefix >= slot
+	dir.resize((1ul << HASHMAP_INDEX_DIR_BITS) + 1);
+	for (slot=0, i=0;slot<dir.size();slot++)
+	{
+		while (i < contents.size() && IndexDirSlot(contents[i].key) < slot)
+			i++;
+		dir[slot] = i;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = HASHMAP_INDEX_MAGIC;
+	header.version = HASHMAP_INDEX_VERSION;
+	header.flags = flags;
+	header.longsize = sizeof(unsigned long);
+	header.content_count = contents.size();
+	header.pfn_count = pfns.size();
+	header.dir_offset = sizeof(header);
+	header.content_offset = header.dir_offset + dir.size() * sizeof(unsigned long);
+	header.pfn_offset = header.content_offset + contents.size() * sizeof(struct IndexContent);
+
+	file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file<0)
+	{
+		printf("Cannot open %s. errno=%d\n", path, errno);
+		return -1;
+	}
+
+	ret = WriteIndexData(file, &header, sizeof(header));
+	if (ret==0)
+		ret = WriteIndexData(file, &dir[0], dir.size() * sizeof(unsigned long));
+	if (ret==0 && contents.size()!=0)
+		ret = WriteIndexData(file, &contents[0], contents.size() * sizeof(struct IndexContent));
+	if (ret==0 && pfns.size()!=0)
+		ret = WriteIndexData(file, &pfns[0], pfns.size() * sizeof(unsigned long));
+	close(file);
+
+	if (ret!=0)
+		printf("Could not write %s. errno=%d\n", path, errno);
+	return ret;
+}
+
+HashMapIndex* LoadHashMapIndex(const char *path)
+{
+	const struct HashMapIndexHeader *header;
+	HashMapIndex *index;
+	struct stat info;
+	void *data;
+	int file;
+
+	file = open(path, O_RDONLY);
+	if (file<0)
+	{
+		printf("Could not open %s. errno=%d\n", path, errno);
+		return NULL;
+	}
+	if (fstat(file, &info)!=0 || (size_t)info.st_size < sizeof(struct HashMapIndexHeader))
+	{
+		printf("%s is not an index file.\n", path);
+		close(file);
+		return NULL;
+	}
+
+	// pages are only read when they are probed
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	if (data==MAP_FAILED)
+	{
+		printf("Could not map %s. errno=%d\n", path, errno);
+		return NULL;
+	}
+
+	header = (const struct HashMapIndexHeader*) data;
+	if (header->magic!=HASHMAP_INDEX_MAGIC || header->version!=HASHMAP_INDEX_VERSION
+		|| header->longsize!=sizeof(unsigned long)
+		|| CheckIndexLayout(header, info.st_size)!=0)
+	{
+		printf("%s is not an index file or in an incompatible format.\n", path);
+		munmap(data, info.st_size);
+		return NULL;
+	}
+
+	index = new HashMapIndex();
+	index->data = data;
+	index->size = info.st_size;
+	index->header = header;
+	index->dir = (const unsigned long*) ((const char*)data + header->dir_offset);
+	index->contents = (const struct IndexContent*) ((const char*)data + header->content_offset);
+	index->pfns = (const unsigned long*) ((const char*)data + header->pfn_offset);
+	return index;
+}
+
+void ReleaseHashMapIndex(HashMapIndex *index)
+{
+	if (index==NULL)
+		return;
+
+	munmap(index->data, index->size);
+	delete index;
+}
+
+int FindIndexContent(HashMapIndex *index, const unsigned char *key, unsigned long *pfn)
+{
+	unsigned long slot, low, high, mid;
+	int ret;
+
+	slot = IndexDirSlot(key);
+	low = index->dir[slot];
+	high = index->dir[slot+1];
+
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		ret = memcmp(index->contents[mid].key, key, CONTENT_KEY_SIZE);
+		if (ret==0)
+		{
+			*pfn = index->contents[mid].pfn;
+			return 1;
+		}
+		if (ret < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return 0;
+}
+
+int FindIndexPFN(HashMapIndex *index, unsigned long pfn)
+{
+	const unsigned long *end = index->pfns + index->header->pfn_count;
+
+	return binary_search(index->pfns, end, pfn);
+}
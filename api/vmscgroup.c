@@ -0,0 +1,339 @@
+// cgroup snapshots - frozen batches of all member processes of a cgroup
+
+#include "../include/vmscgroup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+
+#define CGROUP_PATH_SIZE	512
+
+// helper functions for internal use
+static int WriteCgroupFile(const char *dir, const char *name, const char *value);
+static int ReadCgroupFile(const char *dir, const char *name, char *buffer, int size);
+static int FreezeCgroup(const char *dir, int v2, int was_frozen, unsigned long *freeze_ms);
+static int ThawCgroup(const char *dir, int v2);
+static void ReleaseFrameCache(void);
+static int* ReadMembers(const char *dir, int *count);
+static int AddMembers(const char *dir, int **pids, int *n, int *size);
+static int CompareInts(const void *a, const void *b);
+static unsigned long GetMilliseconds(void);
+
+
+struct CgroupSnapshot* TakeCgroupSnapshot(const char *cgroup_path, int flags, unsigned long max_pause_ms)
+{
+	struct CgroupSnapshot *cs;
+	char dir[CGROUP_PATH_SIZE];
+	char tmp_buffer[64];
+	int *pids;
+	int v2, was_frozen, members, new_batch, len, i;
+	unsigned long start_ms;
+
+	if (cgroup_path==NULL)
+		return NULL;
+	if (max_pause_ms==0)
+		max_pause_ms = CGROUP_DEFAULT_MAX_PAUSE_MS;
+
+	snprintf(dir, sizeof(dir), "%s%s", cgroup_path[0]=='/' ? "" : CGROUP_ROOT, cgroup_path);
+
+	// cgroup v2 has cgroup.freeze in every non root cgroup, v1 needs the freezer controller
+	v2 = ReadCgroupFile(dir, "cgroup.freeze", tmp_buffer, sizeof(tmp_buffer))==0;
+	if (!v2 && ReadCgroupFile(dir, "freezer.state", tmp_buffer, sizeof(tmp_buffer))!=0)
+	{
+		printf("%s is no cgroup with a freezer.\n", dir);
+		return NULL;
+	}
+	// a cgroup frozen by someone else is snapshotted as it is and left frozen
+	was_frozen = v2 ? tmp_buffer[0]=='1' : strncmp(tmp_buffer, "THAWED", 6)!=0;
+
+	// the caller must not freeze itself, also not from a child cgroup
+	pids = ReadMembers(dir, &members);
+	if (pids==NULL)
+		return NULL;
+	for (i=0;i<members;i++)
+	{
+		if (pids[i]==getpid())
+		{
+			printf("The snapshotting process %d is a member of %s.\n", pids[i], dir);
+			free(pids);
+			return NULL;
+		}
+	}
+	free(pids);
+
+	cs = (struct CgroupSnapshot*) calloc(1, sizeof(struct CgroupSnapshot));
+	if (cs==NULL)
+	{
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+
+	start_ms = GetMilliseconds();
+	cs->was_frozen = was_frozen;
+	if (FreezeCgroup(dir, v2, was_frozen, &cs->freeze_ms)!=0)
+	{
+		free(cs);
+		return NULL;
+	}
+
+	// no task can be added while the cgroup is frozen
+	pids = ReadMembers(dir, &members);
+	if (pids!=NULL)
+	{
+		cs->snaps = (VMSNAPSHOT*) calloc(members+1, sizeof(VMSNAPSHOT));
+		if (cs->snaps==NULL)
+			printf("ERROR: Out of memory. (snaps)\n");
+	}
+	if (cs->snaps==NULL)
+	{
+		if (!was_frozen)
+			ThawCgroup(dir, v2);
+		free(pids);
+		free(cs);
+		return NULL;
+	}
+
+	cs->members = members;
+	cs->complete = 1;
+	new_batch = VMS_NEW_BATCH;
+	for (i=0;i<members;i++)
+	{
+		if (GetMilliseconds() - start_ms > max_pause_ms)
+		{
+			printf("Pause of %lu ms exceeded, %d of %d members taken.\n", max_pause_ms, cs->count, members);
+			cs->complete = 0;
+			break;
+		}
+
+		// the module reads the flags as hex, the frame cache is cleared with the first snapshot
+		len = snprintf(tmp_buffer, sizeof(tmp_buffer), "%d:%x", pids[i], flags | VMS_SHARED_FRAMES | new_batch);
+		cs->snaps[cs->count] = TakeSnapshotEx(tmp_buffer, len);
+		if (cs->snaps[cs->count]==NULL)
+		{
+			// kernel threads and exited tasks have no memory map
+			printf("Could not take snapshot of member %d.\n", pids[i]);
+			continue;
+		}
+		cs->count++;
+		new_batch = 0;
+	}
+
+	if (!was_frozen)
+		ThawCgroup(dir, v2);
+	cs->pause_ms = GetMilliseconds() - start_ms;
+	ReleaseFrameCache();
+	free(pids);
+	return cs;
+}
+
+void ReleaseCgroupSnapshot(struct CgroupSnapshot *cs)
+{
+	int i;
+
+	if (cs==NULL)
+		return;
+
+	for (i=0;i<cs->count;i++)
+		ReleaseSnapshot(cs->snaps[i]);
+	free(cs->snaps);
+	free(cs);
+}
+
+// for internal use only
+static int WriteCgroupFile(const char *dir, const char *name, const char *value)
+{
+	char path[CGROUP_PATH_SIZE];
+	int fd, len, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+	{
+		printf("ERROR: Opening %s. errno=%d\n", path, errno);
+		return -1;
+	}
+	len = strlen(value);
+	ret = write(fd, value, len);
+	close(fd);
+	if (ret!=len)
+	{
+		printf("Could not write %s to %s. errno=%d\n", value, path, errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int ReadCgroupFile(const char *dir, const char *name, char *buffer, int size)
+{
+	char path[CGROUP_PATH_SIZE];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buffer, size-1);
+	close(fd);
+	if (ret < 0)
+		return -1;
+	buffer[ret] = '\0';
+	return 0;
+}
+
+// requests the freeze unless it was requested before and waits until every task of the cgroup is frozen
+static int FreezeCgroup(const char *dir, int v2, int was_frozen, unsigned long *freeze_ms)
+{
+	struct timespec ts = {0, 1000000};
+	char state[256];
+	unsigned long start_ms;
+	int frozen = 0;
+
+	start_ms = GetMilliseconds();
+	if (!was_frozen && WriteCgroupFile(dir, v2 ? "cgroup.freeze" : "freezer.state", v2 ? "1" : "FROZEN")!=0)
+		return -1;
+
+	while (GetMilliseconds() - start_ms <= CGROUP_FREEZE_TIMEOUT_MS)
+	{
+		if (v2)
+			frozen = ReadCgroupFile(dir, "cgroup.events", state, sizeof(state))==0 && strstr(state, "frozen 1")!=NULL;
+		else
+			frozen = ReadCgroupFile(dir, "freezer.state", state, sizeof(state))==0 && strncmp(state, "FROZEN", 6)==0;
+		if (frozen)
+			break;
+		nanosleep(&ts, NULL);
+	}
+
+	*freeze_ms = GetMilliseconds() - start_ms;
+	if (!frozen)
+	{
+		printf("Could not freeze %s within %d ms.\n", dir, CGROUP_FREEZE_TIMEOUT_MS);
+		if (!was_frozen)
+			ThawCgroup(dir, v2);
+		return -1;
+	}
+	return 0;
+}
+
+static int ThawCgroup(const char *dir, int v2)
+{
+	return WriteCgroupFile(dir, v2 ? "cgroup.freeze" : "freezer.state", v2 ? "0" : "THAWED");
+}
+
+// the hashes of the frame cache are only valid while the cgroup is frozen
+static void ReleaseFrameCache(void)
+{
+	char tmp_buffer[32];
+	int fd, len;
+
+	fd = open("/proc/vm_snapshot", O_WRONLY);
+	if (fd < 0)
+		return;
+	len = snprintf(tmp_buffer, sizeof(tmp_buffer), "0:%x", VMS_RELEASE_SNAPSHOT);
+	if (write(fd, tmp_buffer, len) < 0)
+		printf("Could not release the frame cache. errno=%d\n", errno);
+	close(fd);
+}
+
+// the sorted processes of cgroup.procs of the cgroup and all descendants, which must be freed
+static int* ReadMembers(const char *dir, int *count)
+{
+	int *pids;
+	int size = 64, n = 0, i;
+
+	pids = (int*) malloc(size * sizeof(int));
+	if (pids==NULL)
+	{
+		printf("ERROR: Out of memory. (pids)\n");
+		return NULL;
+	}
+	if (AddMembers(dir, &pids, &n, &size)!=0)
+	{
+		free(pids);
+		return NULL;
+	}
+
+	// v1 may list a process more than once
+	qsort(pids, n, sizeof(int), CompareInts);
+	for (i=0,*count=0;i<n;i++)
+		if (i==0 || pids[i]!=pids[i-1])
+			pids[(*count)++] = pids[i];
+	return pids;
+}
+
+// appends cgroup.procs of dir and walks its child cgroups, the freeze applies to the whole subtree
+static int AddMembers(const char *dir, int **pids, int *n, int *size)
+{
+	char path[CGROUP_PATH_SIZE];
+	struct dirent *entry;
+	FILE *file;
+	DIR *d;
+	int *tmp;
+	int pid, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+	file = fopen(path, "r");
+	if (file==NULL)
+	{
+		printf("ERROR: Opening %s. errno=%d\n", path, errno);
+		return -1;
+	}
+	while (fscanf(file, "%d", &pid)==1)
+	{
+		if (*n==*size)
+		{
+			tmp = (int*) realloc(*pids, *size * 2 * sizeof(int));
+			if (tmp==NULL)
+			{
+				printf("ERROR: Out of memory. (pids)\n");
+				fclose(file);
+				return -1;
+			}
+			*pids = tmp;
+			*size *= 2;
+		}
+		(*pids)[(*n)++] = pid;
+	}
+	fclose(file);
+
+	d = opendir(dir);
+	if (d==NULL)
+	{
+		printf("ERROR: Opening %s. errno=%d\n", dir, errno);
+		return -1;
+	}
+	while (ret==0 && (entry = readdir(d))!=NULL)
+	{
+		// the cgroup files are regular files, every directory is a child cgroup
+		if (entry->d_type!=DT_DIR || strcmp(entry->d_name, ".")==0 || strcmp(entry->d_name, "..")==0)
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path))
+		{
+			printf("The cgroup path %s/%s is too long.\n", dir, entry->d_name);
+			ret = -1;
+			break;
+		}
+		ret = AddMembers(path, pids, n, size);
+	}
+	closedir(d);
+	return ret;
+}
+
+static int CompareInts(const void *a, const void *b)
+{
+	int ka = *(const int*) a;
+	int kb = *(const int*) b;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static unsigned long GetMilliseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
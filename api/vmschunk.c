@@ -0,0 +1,153 @@
+// sub-page chunk dedup - sorted page and chunk keys of chunk hashed snapshots
+
+#include "../include/vmschunk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct PageKey
+{
+	uint64_t key;
+	const unsigned char *hash;
+};
+
+// helper functions for internal use
+static int ComparePageKeys(const void *a, const void *b);
+static int CompareChunkKeys(const void *a, const void *b);
+
+
+int ComputeChunkInfo(VMSNAPSHOT *snaps, int count, struct ChunkInfo *info)
+{
+	const unsigned char *zerohash;
+	unsigned char key[HASH_KEY_SIZE];
+	struct PageKey *pages;
+	uint64_t *chunks;
+	unsigned long total = 0, used = 0, c = 0, i;
+	int flags, hash_size, chunk_size, chunk_count;
+	int s, k;
+
+	if (snaps==NULL || count <= 0 || info==NULL)
+		return -1;
+
+	flags = snaps[0]->flags;
+	chunk_size = GetChunkSize(flags);
+	if (chunk_size==0)
+	{
+		printf("The snapshots were not taken with chunk hashes.\n");
+		return -1;
+	}
+	for (s=0;s<count;s++)
+	{
+		if (GetChunkSize(snaps[s]->flags)!=chunk_size || GetChunkBits(snaps[s]->flags)!=GetChunkBits(flags))
+		{
+			printf("The snapshots use different chunk hashes.\n");
+			return -1;
+		}
+		total += snaps[s]->available_pages;
+	}
+
+	hash_size = GetHashSize(flags);
+	zerohash = GetZeroPageHash(flags);
+	chunk_count = VMS_PAGE_SIZE / chunk_size;
+	memset(info, 0, sizeof(struct ChunkInfo));
+	info->chunk_size = chunk_size;
+
+	pages = (struct PageKey*) malloc((total+1) * sizeof(struct PageKey));
+	if (pages==NULL)
+	{
+		printf("ERROR: Out of memory. (pages)\n");
+		return -1;
+	}
+
+	// page granularity: every non zero content once
+	for (s=0;s<count;s++)
+	{
+		for (i=0;i<snaps[s]->available_pages;i++)
+		{
+			if (snaps[s]->pages[i].present <= 0)
+				continue;
+			info->pages++;
+			if (memcmp(snaps[s]->pages[i].hash, zerohash, hash_size)==0)
+			{
+				info->zero_pages++;
+				continue;
+			}
+			BuildContentKey(snaps[s]->pages[i].hash, hash_size, key);
+			pages[used].key = HashContentKey(key);
+			pages[used].hash = snaps[s]->pages[i].hash;
+			used++;
+		}
+	}
+	qsort(pages, used, sizeof(struct PageKey), ComparePageKeys);
+	for (i=0;i<used;i++)
+		if (i==0 || pages[i].key!=pages[i-1].key)
+			info->unique_pages++;
+	info->duplicate_pages = used - info->unique_pages;
+
+	chunks = (uint64_t*) malloc((info->unique_pages * chunk_count + 1) * sizeof(uint64_t));
+	if (chunks==NULL)
+	{
+		printf("ERROR: Out of memory. (chunks)\n");
+		free(pages);
+		return -1;
+	}
+
+	// chunk granularity: the chunks of the unique pages
+	for (i=0;i<used;i++)
+	{
+		if (i > 0 && pages[i].key==pages[i-1].key)
+			continue;
+		for (k=0;k<chunk_count;k++)
+		{
+			chunks[c] = GetChunkHash(pages[i].hash, flags, k);
+			if (chunks[c]==0)
+				info->zero_chunks++;
+			else
+				c++;
+		}
+	}
+	free(pages);
+
+	info->chunks = info->unique_pages * chunk_count;
+	qsort(chunks, c, sizeof(uint64_t), CompareChunkKeys);
+	for (i=0;i<c;i++)
+		if (i==0 || chunks[i]!=chunks[i-1])
+			info->distinct_chunks++;
+	info->duplicate_chunks = c - info->distinct_chunks;
+
+	free(chunks);
+	return 0;
+}
+
+void PrintChunkInfoHeader()
+{
+	printf("chunk size;pages;zero pages;duplicate pages;unique pages;chunks;zero chunks;duplicate chunks;distinct chunks;page dedup MB;chunk dedup MB;additional MB;");
+}
+
+void PrintChunkInfo(const struct ChunkInfo *info)
+{
+	double page_mb = (info->zero_pages + info->duplicate_pages) * (double)VMS_PAGE_SIZE / (1024 * 1024);
+	double extra_mb = (info->zero_chunks + info->duplicate_chunks) * (double)info->chunk_size / (1024 * 1024);
+
+	printf("%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%.2f;%.2f;%.2f;", info->chunk_size, info->pages, info->zero_pages,
+		info->duplicate_pages, info->unique_pages, info->chunks, info->zero_chunks, info->duplicate_chunks,
+		info->distinct_chunks, page_mb, page_mb + extra_mb, extra_mb);
+}
+
+// for internal use only
+static int ComparePageKeys(const void *a, const void *b)
+{
+	uint64_t ka = ((const struct PageKey*) a)->key;
+	uint64_t kb = ((const struct PageKey*) b)->key;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static int CompareChunkKeys(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t*) a;
+	uint64_t kb = *(const uint64_t*) b;
+
+	return ka < kb ? -1 : ka > kb;
+}
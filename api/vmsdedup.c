@@ -0,0 +1,1240 @@
+// sort-merge dedup - classifies pages by sorting tuples instead of hashing them
+
+#include "../include/vmsdedup.h"
+#include "../include/vmsindex.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define RADIX_BUFFER_TUPLES 8
+#define RUN_FILE_BUFFER (64*1024)
+#define RUN_NAME_SIZE 4096
+#define VERIFY_KEY_OFFSET (DEDUP_KEY_SIZE - sizeof(unsigned int)) // behind the sorted prefix
+#define INITIAL_JIFFIES_MS 300000 // the kernel starts jiffies 300 s before 0
+
+struct RadixJob
+{
+	struct DedupTuple *src;
+	struct DedupTuple *dst;
+	unsigned long count;
+	int thread_count;
+	int offset; // byte of the tuple used in this pass
+	unsigned long (*counts)[256]; // per thread histogram, then scatter positions
+};
+
+struct RadixWorker
+{
+	struct RadixJob *job;
+	int thread;
+};
+
+// k-way merge of the sorted sub-runs of one run file
+struct RunMerge
+{
+	FILE **files; // one per sub-run
+	struct DedupTuple *heads; // next tuple of every sub-run
+	int *heap; // sub-runs with tuples left, the smallest head first
+	int count; // sub-runs in the heap
+	int key; // DEDUP_SORT_HASH or DEDUP_SORT_PFN
+};
+
+// pages of one snapshot for VerifyHashRuns
+struct VerifySource
+{
+	int fd; // /proc/pid/mem, -1 if the pages can not be re-read
+	unsigned long *addresses; // address of every page record, 0 if unknown
+	const struct PageTableEntryInfo *pages; // records of CRC32 snapshots, NULL for other hashes
+};
+
+// helper functions for internal use
+static int CompareHashAndSeq(const void *a, const void *b);
+static void RunRadixPhase(struct RadixJob *job, void* (*run)(void*));
+static void* RadixCount(void *data);
+static void* RadixScatter(void *data);
+static FILE** CreateRunFiles(const char *tmp_dir, const char *kind, int count);
+static int CloseRunFiles(FILE **files, int count);
+static void RemoveRunFiles(const char *tmp_dir, const char *kind, int count);
+static struct DedupTuple* LoadRunFile(const char *tmp_dir, const char *kind, int partition, unsigned long *count, struct DedupTuple **tmp);
+static int SpillSnapshot(const char *path, unsigned int snap_no, FILE **runs, int partition_count, struct CollisionInfo *info);
+static int SortRunFile(const char *tmp_dir, const char *kind, int partition, unsigned long chunk, int key, int thread_count);
+static int OpenRunMerge(const char *tmp_dir, const char *kind, int partition, int sub_runs, int key, struct RunMerge *merge);
+static int NextMergedTuple(struct RunMerge *merge, struct DedupTuple *tuple);
+static void CloseRunMerge(const char *tmp_dir, const char *kind, int partition, int sub_runs, struct RunMerge *merge);
+static int CompareMergeHeads(const struct RunMerge *merge, int a, int b);
+static void SiftMergeHeap(struct RunMerge *merge, int i);
+static int ClassifyMergedHashRuns(struct RunMerge *merge, FILE **pfn_runs, int partition_count, struct CollisionInfo *info);
+static int ClassifyMergedPFNRuns(struct RunMerge *merge, struct CollisionInfo *info);
+static int MergeRunFile(const char *tmp_dir, const char *kind, int partition, unsigned long chunk, int thread_count,
+	FILE **pfn_runs, int partition_count, struct CollisionInfo *info);
+static struct VerifySource* OpenVerifySources(VMSNAPSHOT *snaps, int count);
+static void CloseVerifySources(struct VerifySource *sources, int count);
+static int ReadTuplePage(struct VerifySource *sources, const struct DedupTuple *tuple, unsigned char *page);
+static int IsSameProcess(VMSNAPSHOT snap);
+static uint32_t PageCRC32(const unsigned char *page);
+static int GrowBuffer(void **buffer, unsigned long *capacity, unsigned long needed, unsigned long size);
+
+
+unsigned long FillDedupTuples(VMSNAPSHOT snap, unsigned int snap_no, struct DedupTuple *tuples, struct CollisionInfo *info)
+{
+	const unsigned char *zerohash;
+	struct PageTableEntryInfo *page;
+	unsigned char *vma_classes;
+	unsigned long i, count = 0;
+	int hash_size;
+
+	vma_classes = CreateVMAClasses(snap);
+	if (vma_classes==NULL)
+		return 0;
+	zerohash = GetZeroPageHash(snap->flags);
+	hash_size = GetHashSize(snap->flags);
+
+	for (i=0;i<snap->available_pages;i++)
+	{
+		page = &snap->pages[i];
+		if (page->present <= 0)
+			continue;
+
+		if (page->reference_count>1)
+		{
+			info->shared_counter++;
+			if (page->inode_no>2)
+				info->named_shared_counter++;
+		}
+
+		BuildContentKey(page->hash, hash_size, tuples[count].hash);
+		tuples[count].pfn = page->pfn;
+		tuples[count].seq = ((unsigned long)snap_no << 32) | i;
+		tuples[count].page_class = GetPageClass(vma_classes, page, zerohash, hash_size);
+		tuples[count].file = page->present-1;
+		count++;
+	}
+
+	free(vma_classes);
+	return count;
+}
+
+struct DedupTuple* RadixSortDedupTuples(struct DedupTuple *tuples, struct DedupTuple *tmp, unsigned long count, int key, int thread_count)
+{
+	struct RadixJob job;
+	struct DedupTuple *swap;
+	int offsets[DEDUP_KEY_SIZE];
+	int passes = 0;
+	int p, t, b;
+	unsigned long sum;
+
+	if (key==DEDUP_SORT_HASH)
+	{
+		// the order of equal hashes matters, the order of the hashes does not
+		for (p=0;p<DEDUP_PREFIX_SIZE;p++)
+			offsets[passes++] = offsetof(struct DedupTuple, hash) + p;
+	}
+	else
+	{
+		// least significant first: seq is the minor key, pfn the major key
+		for (p=0;p<8;p++)
+			offsets[passes++] = offsetof(struct DedupTuple, seq) + p;
+		for (p=0;p<8;p++)
+			offsets[passes++] = offsetof(struct DedupTuple, pfn) + p;
+	}
+
+	if (thread_count <= 0)
+		thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_count <= 0)
+		thread_count = 1;
+	if (thread_count > DEDUP_MAX_THREADS)
+		thread_count = DEDUP_MAX_THREADS;
+	if ((unsigned long)thread_count > count/65536 + 1)
+		thread_count = count/65536 + 1;
+
+	job.count = count;
+	job.thread_count = thread_count;
+	job.counts = (unsigned long (*)[256]) malloc(thread_count * sizeof(*job.counts));
+	if (job.counts==NULL)
+		return NULL;
+
+	for (p=0;p<passes;p++)
+	{
+		job.src = tuples;
+		job.dst = tmp;
+		job.offset = offsets[p];
+		RunRadixPhase(&job, RadixCount);
+
+		// skip bytes which are the same in all tuples
+		for (b=0;b<256;b++)
+		{
+			sum = 0;
+			for (t=0;t<thread_count;t++)
+				sum += job.counts[t][b];
+			if (sum!=0)
+				break;
+		}
+		if (b==256 || sum==count)
+			continue;
+
+		// exclusive prefix sums in bucket then thread order keep the sort stable
+		sum = 0;
+		for (b=0;b<256;b++)
+		{
+			for (t=0;t<thread_count;t++)
+			{
+				unsigned long c = job.counts[t][b];
+				job.counts[t][b] = sum;
+				sum += c;
+			}
+		}
+		RunRadixPhase(&job, RadixScatter);
+
+		swap = tuples;
+		tuples = tmp;
+		tmp = swap;
+	}
+
+	free(job.counts);
+	return tuples;
+}
+
+unsigned long NextHashRun(struct DedupTuple *tuples, unsigned long count, unsigned long start)
+{
+	unsigned long i;
+	int mixed = 0;
+
+	if (start==0 || memcmp(tuples[start-1].hash, tuples[start].hash, DEDUP_PREFIX_SIZE)!=0)
+	{
+		// different hashes with the same prefix are rare - sort them by hash and seq
+		for (i=start+1;i<count && memcmp(tuples[start].hash, tuples[i].hash, DEDUP_PREFIX_SIZE)==0;i++)
+			mixed |= memcmp(tuples[start].hash, tuples[i].hash, DEDUP_KEY_SIZE);
+		if (mixed)
+			qsort(&tuples[start], i-start, sizeof(struct DedupTuple), CompareHashAndSeq);
+	}
+
+	for (i=start+1;i<count && memcmp(tuples[start].hash, tuples[i].hash, DEDUP_KEY_SIZE)==0;i++);
+	return i;
+}
+
+long VerifyHashRuns(VMSNAPSHOT *snaps, int count, struct DedupTuple *tuples, unsigned long tuple_count, struct VerifyInfo *verify)
+{
+	struct VerifySource *sources;
+	struct DedupTuple *run = NULL;
+	unsigned char *contents = NULL, *page;
+	unsigned int *groups = NULL;
+	unsigned long *offsets = NULL;
+	unsigned long run_capacity = 0, group_capacity = 0, content_capacity = 0, offset_capacity = 0;
+	unsigned long start, end, i, g, content_count;
+	unsigned int tag, b;
+	int ret = 0;
+
+	if (snaps==NULL || tuples==NULL)
+		return -2;
+	if (verify==NULL)
+		return -3;
+
+	sources = OpenVerifySources(snaps, count);
+	if (sources==NULL)
+		return -1;
+
+	for (start=0;start<tuple_count && ret==0;start=end)
+	{
+		end = NextHashRun(tuples, tuple_count, start);
+		if (end - start < 2)
+			continue;
+		verify->runs++;
+
+		if (GrowBuffer((void**)&groups, &group_capacity, end - start, sizeof(unsigned int))!=0)
+		{
+			ret = -1;
+			break;
+		}
+
+		// the first readable page of every content is kept, the others are compared with them
+		content_count = 0;
+		for (i=start;i<end;i++)
+		{
+			groups[i-start] = 0;
+			if (GrowBuffer((void**)&contents, &content_capacity, content_count+1, VMS_PAGE_SIZE)!=0)
+			{
+				ret = -1;
+				break;
+			}
+			page = contents + content_count * VMS_PAGE_SIZE;
+			if (ReadTuplePage(sources, &tuples[i], page)!=0)
+			{
+				verify->unreadable++;
+				continue;
+			}
+			verify->pages++;
+
+			for (g=0;g<content_count;g++)
+				if (memcmp(contents + g * VMS_PAGE_SIZE, page, VMS_PAGE_SIZE)==0)
+					break;
+			if (g==content_count)
+				content_count++;
+			groups[i-start] = g;
+			if (g > 0)
+				verify->false_collisions++;
+		}
+		if (ret!=0 || content_count < 2)
+			continue;
+
+		// stable partition by content, every further content gets another key behind the prefix
+		if (GrowBuffer((void**)&run, &run_capacity, end - start, sizeof(struct DedupTuple))!=0 ||
+			GrowBuffer((void**)&offsets, &offset_capacity, content_count, sizeof(unsigned long))!=0)
+		{
+			ret = -1;
+			break;
+		}
+		memcpy(run, &tuples[start], (end - start) * sizeof(struct DedupTuple));
+		memset(offsets, 0, content_count * sizeof(unsigned long));
+		for (i=0;i<end-start;i++)
+			if (groups[i]+1 < content_count)
+				offsets[groups[i]+1]++;
+		for (g=1;g<content_count;g++)
+			offsets[g] += offsets[g-1];
+
+		for (i=0;i<end-start;i++)
+		{
+			g = groups[i];
+			tuples[start + offsets[g]] = run[i];
+			tag = g;
+			for (b=0;b<sizeof(tag);b++)
+				tuples[start + offsets[g]].hash[VERIFY_KEY_OFFSET + b] ^= (tag >> (b*8)) & 0xff;
+			offsets[g]++;
+		}
+	}
+
+	CloseVerifySources(sources, count);
+	free(run);
+	free(contents);
+	free(groups);
+	free(offsets);
+
+	if (ret!=0)
+	{
+		printf("ERROR: Out of memory. (verify)\n");
+		return ret;
+	}
+	return verify->false_collisions;
+}
+
+unsigned long ClassifyHashRuns(struct DedupTuple *tuples, unsigned long count, struct DedupTuple *candidates, struct CollisionInfo *info, struct FileReport *report)
+{
+	struct ClassCounters counters;
+	unsigned long i, start, end, candidate_count = 0;
+
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	for (start=0;start<count;start=end)
+	{
+		end = NextHashRun(tuples, count, start);
+
+		// the first page of a content is the one kept in the ContentMap
+		info->unshareable++;
+		for (i=start+1;i<end;i++)
+		{
+			info->shareable++;
+			if (tuples[i].pfn == tuples[start].pfn)
+				counters.shared[tuples[i].page_class]++;
+			else
+				candidates[candidate_count++] = tuples[i];
+		}
+
+		if (report!=NULL)
+		{
+			for (i=start+1;i<end;i++)
+			{
+				report->files[tuples[i].file].shareable++;
+				if (tuples[i].pfn == tuples[start].pfn)
+					report->files[tuples[i].file].shared++;
+				AddFilePair(report, tuples[i].file, tuples[start].file);
+			}
+		}
+	}
+
+	AddClassCounters(info, &counters);
+	return candidate_count;
+}
+
+void ClassifyPFNRuns(const struct DedupTuple *candidates, unsigned long count, struct CollisionInfo *info, struct FileReport *report)
+{
+	struct ClassCounters counters;
+	unsigned long i;
+
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	for (i=0;i<count;i++)
+	{
+		// the first page of a pfn is the one inserted into the PFNMap
+		if (i==0 || candidates[i].pfn != candidates[i-1].pfn)
+		{
+			counters.sharing_op[candidates[i].page_class]++;
+			if (report!=NULL)
+				report->files[candidates[i].file].sharing_op++;
+		}
+		else
+		{
+			counters.shared[candidates[i].page_class]++;
+			if (report!=NULL)
+				report->files[candidates[i].file].shared++;
+		}
+	}
+
+	AddClassCounters(info, &counters);
+}
+
+int SortMergeDedup(VMSNAPSHOT *snaps, int count, int thread_count, struct CollisionInfo *info)
+{
+	return SortMergeDedupEx(snaps, count, thread_count, info, NULL, NULL);
+}
+
+int SortMergeDedupEx(VMSNAPSHOT *snaps, int count, int thread_count, struct CollisionInfo *info, struct VerifyInfo *verify, struct FileReport *report)
+{
+	struct DedupTuple *tuples, *tmp, *sorted, *candidates;
+	unsigned long total = 0, used = 0, filled, candidate_count, j;
+	unsigned int *vma_files = NULL;
+	int i, max_regions = 0;
+
+	if (snaps==NULL)
+		return -2;
+	if (info==NULL)
+		return -3;
+
+	for (i=0;i<count;i++)
+	{
+		if (snaps[i]==NULL)
+			return -2;
+		total += snaps[i]->available_pages;
+		if (snaps[i]->vm_region_count > max_regions)
+			max_regions = snaps[i]->vm_region_count;
+	}
+
+	tuples = (struct DedupTuple*) malloc((total+1) * sizeof(struct DedupTuple));
+	tmp = (struct DedupTuple*) malloc((total+1) * sizeof(struct DedupTuple));
+	if (report!=NULL)
+		vma_files = (unsigned int*) malloc((max_regions+1) * sizeof(unsigned int));
+	if (tuples==NULL || tmp==NULL || (report!=NULL && vma_files==NULL))
+	{
+		printf("Could not allocate %lu page tuples.\n", total);
+		free(tuples);
+		free(tmp);
+		free(vma_files);
+		return -1;
+	}
+
+	for (i=0;i<count;i++)
+	{
+		filled = FillDedupTuples(snaps[i], i, &tuples[used], info);
+		if (report!=NULL)
+		{
+			// the region indexes become file ids
+			if (AddSnapshotFiles(report, snaps[i], vma_files)!=0)
+				break;
+			for (j=used;j<used+filled;j++)
+			{
+				tuples[j].file = vma_files[tuples[j].file];
+				report->files[tuples[j].file].pages++;
+			}
+		}
+		used += filled;
+	}
+	free(vma_files);
+	if (i < count)
+	{
+		free(tuples);
+		free(tmp);
+		return -1;
+	}
+
+	sorted = RadixSortDedupTuples(tuples, tmp, used, DEDUP_SORT_HASH, thread_count);
+	if (sorted==NULL)
+	{
+		free(tuples);
+		free(tmp);
+		return -1;
+	}
+
+	if (verify!=NULL && VerifyHashRuns(snaps, count, sorted, used, verify) < 0)
+	{
+		free(tuples);
+		free(tmp);
+		return -1;
+	}
+
+	// the unsorted buffer receives the candidates
+	candidates = sorted==tuples ? tmp : tuples;
+	candidate_count = ClassifyHashRuns(sorted, used, candidates, info, report);
+
+	sorted = RadixSortDedupTuples(candidates, sorted, candidate_count, DEDUP_SORT_PFN, thread_count);
+	if (sorted!=NULL)
+		ClassifyPFNRuns(sorted, candidate_count, info, report);
+
+	free(tuples);
+	free(tmp);
+
+	if (sorted!=NULL && report!=NULL && FinishFileReport(report)!=0)
+	{
+		printf("ERROR: Out of memory. (report)\n");
+		return -1;
+	}
+
+	return sorted!=NULL ? info->shareable : -1;
+}
+
+int ExternalSortMergeDedup(const char **paths, int count, const char *tmp_dir, unsigned long memory_limit, int thread_count, struct CollisionInfo *info)
+{
+	struct DedupTuple *tuples, *tmp, *sorted, *candidates;
+	unsigned long estimate = 0, used, candidate_count, chunk, i;
+	FILE **hash_runs = NULL, **pfn_runs = NULL;
+	char path[RUN_NAME_SIZE];
+	struct stat st;
+	int partition_count, p, ret = 0;
+
+	if (paths==NULL || tmp_dir==NULL)
+		return -2;
+	if (info==NULL)
+		return -3;
+
+	// the file sizes bound the amount of tuples, a partition needs two tuple buffers
+	for (p=0;p<count;p++)
+	{
+		if (stat(paths[p], &st)!=0)
+		{
+			printf("Could not open %s\n", paths[p]);
+			return -2;
+		}
+		estimate += st.st_size / sizeof(struct PageTableEntryInfo);
+	}
+	partition_count = estimate * 2 * sizeof(struct DedupTuple) / (memory_limit + 1) + 1;
+	if (partition_count > DEDUP_MAX_PARTITIONS)
+		partition_count = DEDUP_MAX_PARTITIONS;
+	// larger partitions, e.g. of many equal pages or of the partition cap, are merged from sorted chunks
+	chunk = memory_limit / (2 * sizeof(struct DedupTuple));
+	if (chunk < RADIX_BUFFER_TUPLES)
+		chunk = RADIX_BUFFER_TUPLES;
+
+	hash_runs = CreateRunFiles(tmp_dir, "hash", partition_count);
+	pfn_runs = CreateRunFiles(tmp_dir, "pfn", partition_count);
+	if (hash_runs==NULL || pfn_runs==NULL)
+		ret = -1;
+
+	// snapshots are streamed in input order, so every run file is sorted by seq
+	for (p=0;p<count && ret==0;p++)
+		ret = SpillSnapshot(paths[p], p, hash_runs, partition_count, info);
+	if (hash_runs!=NULL && CloseRunFiles(hash_runs, partition_count)!=0)
+		ret = -1;
+
+	for (p=0;p<partition_count && ret==0;p++)
+	{
+		snprintf(path, RUN_NAME_SIZE, "%s/hash-%d.run", tmp_dir, p);
+		if (stat(path, &st)==0 && st.st_size / sizeof(struct DedupTuple) > chunk)
+		{
+			ret = MergeRunFile(tmp_dir, "hash", p, chunk, thread_count, pfn_runs, partition_count, info);
+			continue;
+		}
+
+		tuples = LoadRunFile(tmp_dir, "hash", p, &used, &tmp);
+		if (tuples==NULL)
+		{
+			ret = -1;
+			break;
+		}
+
+		sorted = RadixSortDedupTuples(tuples, tmp, used, DEDUP_SORT_HASH, thread_count);
+		if (sorted!=NULL)
+		{
+			candidates = sorted==tuples ? tmp : tuples;
+			candidate_count = ClassifyHashRuns(sorted, used, candidates, info, NULL);
+			for (i=0;i<candidate_count;i++)
+				if (fwrite(&candidates[i], sizeof(struct DedupTuple), 1, pfn_runs[candidates[i].pfn % partition_count])!=1)
+					break;
+			if (i < candidate_count)
+				ret = -1;
+		}
+		else
+			ret = -1;
+
+		free(tuples);
+		free(tmp);
+	}
+	if (pfn_runs!=NULL && CloseRunFiles(pfn_runs, partition_count)!=0)
+		ret = -1;
+
+	for (p=0;p<partition_count && ret==0;p++)
+	{
+		snprintf(path, RUN_NAME_SIZE, "%s/pfn-%d.run", tmp_dir, p);
+		if (stat(path, &st)==0 && st.st_size / sizeof(struct DedupTuple) > chunk)
+		{
+			ret = MergeRunFile(tmp_dir, "pfn", p, chunk, thread_count, NULL, partition_count, info);
+			continue;
+		}
+
+		candidates = LoadRunFile(tmp_dir, "pfn", p, &candidate_count, &tmp);
+		if (candidates==NULL)
+		{
+			ret = -1;
+			break;
+		}
+
+		sorted = RadixSortDedupTuples(candidates, tmp, candidate_count, DEDUP_SORT_PFN, thread_count);
+		if (sorted!=NULL)
+			ClassifyPFNRuns(sorted, candidate_count, info, NULL);
+		else
+			ret = -1;
+
+		free(candidates);
+		free(tmp);
+	}
+
+	RemoveRunFiles(tmp_dir, "hash", partition_count);
+	RemoveRunFiles(tmp_dir, "pfn", partition_count);
+
+	if (ret!=0)
+	{
+		printf("Could not process the run files in %s\n", tmp_dir);
+		return ret;
+	}
+	return info->shareable;
+}
+
+// for internal use only
+static int CompareHashAndSeq(const void *a, const void *b)
+{
+	const struct DedupTuple *ta = (const struct DedupTuple*) a;
+	const struct DedupTuple *tb = (const struct DedupTuple*) b;
+	int ret;
+
+	ret = memcmp(ta->hash, tb->hash, DEDUP_KEY_SIZE);
+	if (ret!=0)
+		return ret;
+	return ta->seq < tb->seq ? -1 : ta->seq > tb->seq;
+}
+
+// runs one phase of a radix pass on all threads, the calling thread takes the first chunk
+static void RunRadixPhase(struct RadixJob *job, void* (*run)(void*))
+{
+	struct RadixWorker workers[DEDUP_MAX_THREADS];
+	pthread_t threads[DEDUP_MAX_THREADS];
+	int started[DEDUP_MAX_THREADS];
+	int t;
+
+	for (t=0;t<job->thread_count;t++)
+	{
+		workers[t].job = job;
+		workers[t].thread = t;
+		started[t] = t > 0 && pthread_create(&threads[t], NULL, run, &workers[t])==0;
+	}
+	for (t=0;t<job->thread_count;t++)
+		if (!started[t])
+			run(&workers[t]);
+	for (t=1;t<job->thread_count;t++)
+		if (started[t])
+			pthread_join(threads[t], NULL);
+}
+
+static void* RadixCount(void *data)
+{
+	struct RadixWorker *worker = (struct RadixWorker*) data;
+	struct RadixJob *job = worker->job;
+	unsigned long *counts = job->counts[worker->thread];
+	unsigned long i, begin, end;
+
+	begin = job->count * worker->thread / job->thread_count;
+	end = job->count * (worker->thread+1) / job->thread_count;
+
+	memset(counts, 0, 256 * sizeof(unsigned long));
+	for (i=begin;i<end;i++)
+		counts[((const unsigned char*)&job->src[i])[job->offset]]++;
+
+	return NULL;
+}
+
+static void* RadixScatter(void *data)
+{
+	struct RadixWorker *worker = (struct RadixWorker*) data;
+	struct RadixJob *job = worker->job;
+	unsigned long *pos = job->counts[worker->thread];
+	struct DedupTuple (*buffers)[RADIX_BUFFER_TUPLES];
+	unsigned char fill[256];
+	unsigned long i, begin, end;
+	int b;
+
+	begin = job->count * worker->thread / job->thread_count;
+	end = job->count * (worker->thread+1) / job->thread_count;
+
+	// tuples are collected per bucket and copied in blocks, so that the
+	// scatter does not touch a different cache line for every tuple
+	buffers = (struct DedupTuple (*)[RADIX_BUFFER_TUPLES]) malloc(256 * sizeof(*buffers));
+	if (buffers==NULL)
+	{
+		for (i=begin;i<end;i++)
+			job->dst[pos[((const unsigned char*)&job->src[i])[job->offset]]++] = job->src[i];
+		return NULL;
+	}
+
+	memset(fill, 0, sizeof(fill));
+	for (i=begin;i<end;i++)
+	{
+		b = ((const unsigned char*)&job->src[i])[job->offset];
+		buffers[b][fill[b]++] = job->src[i];
+		if (fill[b]==RADIX_BUFFER_TUPLES)
+		{
+			memcpy(&job->dst[pos[b]], buffers[b], RADIX_BUFFER_TUPLES * sizeof(struct DedupTuple));
+			pos[b] += RADIX_BUFFER_TUPLES;
+			fill[b] = 0;
+		}
+	}
+	for (b=0;b<256;b++)
+	{
+		memcpy(&job->dst[pos[b]], buffers[b], fill[b] * sizeof(struct DedupTuple));
+		pos[b] += fill[b];
+	}
+
+	free(buffers);
+	return NULL;
+}
+
+static FILE** CreateRunFiles(const char *tmp_dir, const char *kind, int count)
+{
+	char path[RUN_NAME_SIZE];
+	FILE **files;
+	int i;
+
+	files = (FILE**) calloc(count, sizeof(FILE*));
+	if (files==NULL)
+		return NULL;
+
+	for (i=0;i<count;i++)
+	{
+		snprintf(path, RUN_NAME_SIZE, "%s/%s-%d.run", tmp_dir, kind, i);
+		files[i] = fopen(path, "wb");
+		if (files[i]==NULL)
+		{
+			printf("Could not create %s\n", path);
+			CloseRunFiles(files, i);
+			RemoveRunFiles(tmp_dir, kind, i);
+			return NULL;
+		}
+		setvbuf(files[i], NULL, _IOFBF, RUN_FILE_BUFFER);
+	}
+
+	return files;
+}
+
+static int CloseRunFiles(FILE **files, int count)
+{
+	int i, ret = 0;
+
+	for (i=0;i<count;i++)
+		if (files[i]!=NULL && fclose(files[i])!=0)
+			ret = -1;
+	free(files);
+
+	return ret;
+}
+
+static void RemoveRunFiles(const char *tmp_dir, const char *kind, int count)
+{
+	char path[RUN_NAME_SIZE];
+	int i;
+
+	for (i=0;i<count;i++)
+	{
+		snprintf(path, RUN_NAME_SIZE, "%s/%s-%d.run", tmp_dir, kind, i);
+		remove(path);
+	}
+}
+
+// loads a run file and allocates a second buffer of the same size for sorting
+static struct DedupTuple* LoadRunFile(const char *tmp_dir, const char *kind, int partition, unsigned long *count, struct DedupTuple **tmp)
+{
+	char path[RUN_NAME_SIZE];
+	struct DedupTuple *tuples;
+	struct stat st;
+	FILE *file;
+
+	snprintf(path, RUN_NAME_SIZE, "%s/%s-%d.run", tmp_dir, kind, partition);
+	if (stat(path, &st)!=0)
+		return NULL;
+	*count = st.st_size / sizeof(struct DedupTuple);
+
+	tuples = (struct DedupTuple*) malloc((*count+1) * sizeof(struct DedupTuple));
+	*tmp = (struct DedupTuple*) malloc((*count+1) * sizeof(struct DedupTuple));
+	file = fopen(path, "rb");
+	if (tuples==NULL || *tmp==NULL || file==NULL || fread(tuples, sizeof(struct DedupTuple), *count, file)!=*count)
+	{
+		printf("Could not load %s\n", path);
+		if (file!=NULL)
+			fclose(file);
+		free(tuples);
+		free(*tmp);
+		return NULL;
+	}
+	fclose(file);
+
+	return tuples;
+}
+
+// sorts a run file which exceeds the memory limit in chunks and classifies the merged chunks
+// the candidates of hash run files are appended to pfn_runs
+static int MergeRunFile(const char *tmp_dir, const char *kind, int partition, unsigned long chunk, int thread_count,
+	FILE **pfn_runs, int partition_count, struct CollisionInfo *info)
+{
+	struct RunMerge merge;
+	int key = pfn_runs!=NULL ? DEDUP_SORT_HASH : DEDUP_SORT_PFN;
+	int sub_runs, ret;
+
+	sub_runs = SortRunFile(tmp_dir, kind, partition, chunk, key, thread_count);
+	if (sub_runs < 0)
+		return -1;
+
+	ret = OpenRunMerge(tmp_dir, kind, partition, sub_runs, key, &merge);
+	if (ret==0)
+	{
+		if (key==DEDUP_SORT_HASH)
+			ret = ClassifyMergedHashRuns(&merge, pfn_runs, partition_count, info);
+		else
+			ret = ClassifyMergedPFNRuns(&merge, info);
+	}
+	CloseRunMerge(tmp_dir, kind, partition, sub_runs, &merge);
+
+	return ret;
+}
+
+// writes every chunk of a run file sorted to its own sub-run file
+// return: amount of sub-runs, on failure a negative value
+static int SortRunFile(const char *tmp_dir, const char *kind, int partition, unsigned long chunk, int key, int thread_count)
+{
+	char path[RUN_NAME_SIZE];
+	struct DedupTuple *tuples, *tmp, *sorted;
+	unsigned long count, start;
+	FILE *file, *sub;
+	int sub_runs = 0, ret = 0;
+
+	snprintf(path, RUN_NAME_SIZE, "%s/%s-%d.run", tmp_dir, kind, partition);
+	file = fopen(path, "rb");
+	tuples = (struct DedupTuple*) malloc(chunk * sizeof(struct DedupTuple));
+	tmp = (struct DedupTuple*) malloc(chunk * sizeof(struct DedupTuple));
+	if (file==NULL || tuples==NULL || tmp==NULL)
+	{
+		printf("Could not load %s\n", path);
+		ret = -1;
+	}
+
+	while (ret==0 && (count = fread(tuples, sizeof(struct DedupTuple), chunk, file)) > 0)
+	{
+		sorted = RadixSortDedupTuples(tuples, tmp, count, key, thread_count);
+		if (sorted==NULL)
+		{
+			ret = -1;
+			break;
+		}
+		// the merge compares the whole hash, so runs of equal prefixes are sorted by hash here
+		if (key==DEDUP_SORT_HASH)
+			for (start=0;start<count;start=NextHashRun(sorted, count, start));
+
+		snprintf(path, RUN_NAME_SIZE, "%s/%s-%d-%d.run", tmp_dir, kind, partition, sub_runs);
+		sub = fopen(path, "wb");
+		sub_runs++;
+		if (sub==NULL || fwrite(sorted, sizeof(struct DedupTuple), count, sub)!=count)
+			ret = -1;
+		if (sub!=NULL && fclose(sub)!=0)
+			ret = -1;
+		if (ret!=0)
+			printf("Could not write %s\n", path);
+	}
+	if (file!=NULL && ferror(file))
+		ret = -1;
+
+	if (file!=NULL)
+		fclose(file);
+	free(tuples);
+	free(tmp);
+
+	if (ret!=0)
+	{
+		while (sub_runs > 0)
+		{
+			snprintf(path, RUN_NAME_SIZE, "%s/%s-%d-%d.run", tmp_dir, kind, partition, --sub_runs);
+			remove(path);
+		}
+		return -1;
+	}
+	return sub_runs;
+}
+
+static int OpenRunMerge(const char *tmp_dir, const char *kind, int partition, int sub_runs, int key, struct RunMerge *merge)
+{
+	char path[RUN_NAME_SIZE];
+	int i;
+
+	memset(merge, 0, sizeof(struct RunMerge));
+	merge->key = key;
+	merge->files = (FILE**) calloc(sub_runs+1, sizeof(FILE*));
+	merge->heads = (struct DedupTuple*) malloc((sub_runs+1) * sizeof(struct DedupTuple));
+	merge->heap = (int*) malloc((sub_runs+1) * sizeof(int));
+	if (merge->files==NULL || merge->heads==NULL || merge->heap==NULL)
+	{
+		printf("ERROR: Out of memory. (merge)\n");
+		return -1;
+	}
+
+	for (i=0;i<sub_runs;i++)
+	{
+		snprintf(path, RUN_NAME_SIZE, "%s/%s-%d-%d.run", tmp_dir, kind, partition, i);
+		merge->files[i] = fopen(path, "rb");
+		if (merge->files[i]==NULL)
+		{
+			printf("Could not open %s\n", path);
+			return -1;
+		}
+		// every sub-run has at least one tuple
+		if (fread(&merge->heads[i], sizeof(struct DedupTuple), 1, merge->files[i])!=1)
+			return -1;
+		merge->heap[merge->count++] = i;
+	}
+
+	for (i=merge->count/2-1;i>=0;i--)
+		SiftMergeHeap(merge, i);
+	return 0;
+}
+
+// return: 1 if tuple was set, 0 after the last tuple, on failure a negative value
+static int NextMergedTuple(struct RunMerge *merge, struct DedupTuple *tuple)
+{
+	int run;
+
+	if (merge->count==0)
+		return 0;
+
+	run = merge->heap[0];
+	*tuple = merge->heads[run];
+	if (fread(&merge->heads[run], sizeof(struct DedupTuple), 1, merge->files[run])!=1)
+	{
+		if (ferror(merge->files[run]))
+			return -1;
+		merge->heap[0] = merge->heap[--merge->count];
+	}
+	SiftMergeHeap(merge, 0);
+
+	return 1;
+}
+
+static void CloseRunMerge(const char *tmp_dir, const char *kind, int partition, int sub_runs, struct RunMerge *merge)
+{
+	char path[RUN_NAME_SIZE];
+	int i;
+
+	for (i=0;i<sub_runs;i++)
+	{
+		if (merge->files!=NULL && merge->files[i]!=NULL)
+			fclose(merge->files[i]);
+		snprintf(path, RUN_NAME_SIZE, "%s/%s-%d-%d.run", tmp_dir, kind, partition, i);
+		remove(path);
+	}
+	free(merge->files);
+	free(merge->heads);
+	free(merge->heap);
+}
+
+// the order of RadixSortDedupTuples: the last prefix byte is the most significant,
+// equal prefixes are sorted by hash and seq like NextHashRun, pfns by seq
+static int CompareMergeHeads(const struct RunMerge *merge, int a, int b)
+{
+	const struct DedupTuple *ta = &merge->heads[a];
+	const struct DedupTuple *tb = &merge->heads[b];
+	int p;
+
+	if (merge->key==DEDUP_SORT_HASH)
+	{
+		for (p=DEDUP_PREFIX_SIZE-1;p>=0;p--)
+			if (ta->hash[p]!=tb->hash[p])
+				return ta->hash[p] < tb->hash[p] ? -1 : 1;
+		return CompareHashAndSeq(ta, tb);
+	}
+	if (ta->pfn!=tb->pfn)
+		return ta->pfn < tb->pfn ? -1 : 1;
+	return ta->seq < tb->seq ? -1 : ta->seq > tb->seq;
+}
+
+static void SiftMergeHeap(struct RunMerge *merge, int i)
+{
+	int child, tmp;
+
+	while ((child = 2*i+1) < merge->count)
+	{
+		if (child+1 < merge->count && CompareMergeHeads(merge, merge->heap[child+1], merge->heap[child]) < 0)
+			child++;
+		if (CompareMergeHeads(merge, merge->heap[i], merge->heap[child]) <= 0)
+			break;
+		tmp = merge->heap[i];
+		merge->heap[i] = merge->heap[child];
+		merge->heap[child] = tmp;
+		i = child;
+	}
+}
+
+// like ClassifyHashRuns, only the first tuple of the current run is kept in memory
+static int ClassifyMergedHashRuns(struct RunMerge *merge, FILE **pfn_runs, int partition_count, struct CollisionInfo *info)
+{
+	struct ClassCounters counters;
+	struct DedupTuple first, tuple;
+	int ret;
+
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	memset(&first, 0, sizeof(struct DedupTuple));
+	for (ret=NextMergedTuple(merge, &first);ret > 0;)
+	{
+		// the first page of a content is the one kept in the ContentMap
+		info->unshareable++;
+		while ((ret = NextMergedTuple(merge, &tuple)) > 0 && memcmp(tuple.hash, first.hash, DEDUP_KEY_SIZE)==0)
+		{
+			info->shareable++;
+			if (tuple.pfn == first.pfn)
+				counters.shared[tuple.page_class]++;
+			else if (fwrite(&tuple, sizeof(struct DedupTuple), 1, pfn_runs[tuple.pfn % partition_count])!=1)
+			{
+				ret = -1;
+				break;
+			}
+		}
+		first = tuple;
+	}
+
+	AddClassCounters(info, &counters);
+	return ret;
+}
+
+// like ClassifyPFNRuns, only the pfn of the last tuple is kept in memory
+static int ClassifyMergedPFNRuns(struct RunMerge *merge, struct CollisionInfo *info)
+{
+	struct ClassCounters counters;
+	struct DedupTuple tuple;
+	unsigned long pfn = 0;
+	int first = 1, ret;
+
+	memset(&counters, 0, sizeof(struct ClassCounters));
+	while ((ret = NextMergedTuple(merge, &tuple)) > 0)
+	{
+		// the first page of a pfn is the one inserted into the PFNMap
+		if (first || tuple.pfn != pfn)
+			counters.sharing_op[tuple.page_class]++;
+		else
+			counters.shared[tuple.page_class]++;
+		pfn = tuple.pfn;
+		first = 0;
+	}
+
+	AddClassCounters(info, &counters);
+	return ret;
+}
+
+// appends the tuples of a snapshot to the run files of their hash prefix
+static int SpillSnapshot(const char *path, unsigned int snap_no, FILE **runs, int partition_count, struct CollisionInfo *info)
+{
+	VMSNAPSHOT snap;
+	struct DedupTuple *tuples;
+	unsigned long count, i, prefix;
+
+	snap = LoadSnapshot(path);
+	if (snap==NULL)
+	{
+		printf("Could not load Snapshot %s\n", path);
+		return -1;
+	}
+
+	tuples = (struct DedupTuple*) malloc((snap->available_pages+1) * sizeof(struct DedupTuple));
+	if (tuples==NULL)
+	{
+		ReleaseSnapshot(snap);
+		return -1;
+	}
+
+	count = FillDedupTuples(snap, snap_no, tuples, info);
+	ReleaseSnapshot(snap);
+
+	for (i=0;i<count;i++)
+	{
+		memcpy(&prefix, tuples[i].hash, sizeof(prefix));
+		if (fwrite(&tuples[i], sizeof(struct DedupTuple), 1, runs[prefix % partition_count])!=1)
+			break;
+	}
+	free(tuples);
+
+	return i==count ? 0 : -1;
+}
+
+// the page records of every snapshot are mapped to their addresses with the snapshot index
+static struct VerifySource* OpenVerifySources(VMSNAPSHOT *snaps, int count)
+{
+	struct VerifySource *sources;
+	struct SnapshotIndex *index;
+	struct PageIterator iter;
+	struct PageTableEntryInfo *page;
+	unsigned long address;
+	char path[64];
+	int i;
+
+	sources = (struct VerifySource*) malloc(count * sizeof(struct VerifySource));
+	if (sources==NULL)
+		return NULL;
+
+	for (i=0;i<count;i++)
+	{
+		sources[i].fd = -1;
+		sources[i].addresses = NULL;
+		sources[i].pages = (snaps[i]->flags & VMS_HASH_CRC32) ? snaps[i]->pages : NULL;
+
+		// physical snapshots have no process to read from
+		if (snaps[i]->pid==0)
+			continue;
+		if (!IsSameProcess(snaps[i]))
+		{
+			printf("Process %d was started after its snapshot, its pages are not re-read.\n", snaps[i]->pid);
+			continue;
+		}
+
+		index = CreateSnapshotIndex(snaps[i]);
+		if (index==NULL)
+			continue;
+		sources[i].addresses = (unsigned long*) calloc(snaps[i]->available_pages+1, sizeof(unsigned long));
+		if (sources[i].addresses==NULL)
+		{
+			ReleaseSnapshotIndex(index);
+			continue;
+		}
+
+		InitPageIterator(index, 0, ~0ul, &iter);
+		while ((page = NextPage(&iter, &address, NULL))!=NULL)
+			sources[i].addresses[page - snaps[i]->pages] = address;
+		ReleaseSnapshotIndex(index);
+
+		snprintf(path, sizeof(path), "/proc/%d/mem", snaps[i]->pid);
+		sources[i].fd = open(path, O_RDONLY);
+		if (sources[i].fd < 0)
+			printf("Could not open %s\n", path);
+	}
+
+	return sources;
+}
+
+static void CloseVerifySources(struct VerifySource *sources, int count)
+{
+	int i;
+
+	for (i=0;i<count;i++)
+	{
+		if (sources[i].fd >= 0)
+			close(sources[i].fd);
+		free(sources[i].addresses);
+	}
+	free(sources);
+}
+
+static int ReadTuplePage(struct VerifySource *sources, const struct DedupTuple *tuple, unsigned char *page)
+{
+	struct VerifySource *source = &sources[tuple->seq >> 32];
+	unsigned long address;
+	uint32_t crc;
+
+	if (source->fd < 0)
+		return -1;
+	address = source->addresses[tuple->seq & 0xffffffff];
+	if (address==0)
+		return -1;
+
+	if (pread(source->fd, page, VMS_PAGE_SIZE, address)!=VMS_PAGE_SIZE)
+		return -1;
+	// a page changed since the snapshot is no other content of its run
+	if (source->pages!=NULL)
+	{
+		memcpy(&crc, source->pages[tuple->seq & 0xffffffff].hash, sizeof(crc));
+		if (PageCRC32(page)!=crc)
+			return -1;
+	}
+	return 0;
+}
+
+// the pid may belong to another process than the one of the snapshot
+// return: 0 if the process was started after the snapshot or is gone, otherwise 1
+static int IsSameProcess(VMSNAPSHOT snap)
+{
+	char path[64], buffer[1024];
+	unsigned long long start_ticks;
+	unsigned long start_ms, now_ms, snap_ms;
+	struct timespec ts;
+	unsigned int age;
+	char *p;
+	int fd, len, i;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", snap->pid);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buffer, sizeof(buffer)-1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buffer[len] = '\0';
+
+	// starttime is the 22nd field, the command name in field 2 may contain spaces
+	p = strrchr(buffer, ')');
+	for (i=2;p!=NULL && i<22;i++)
+		p = strchr(p+1, ' ');
+	if (p==NULL || sscanf(p+1, "%llu", &start_ticks)!=1)
+		return 0;
+	start_ms = start_ticks * 1000 / sysconf(_SC_CLK_TCK);
+
+	// timestamp_begin holds jiffies_to_msecs(jiffies) in 32 bits, it is unwrapped with the current uptime
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	now_ms = ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+	age = (unsigned int)now_ms - (snap->timestamp_begin + INITIAL_JIFFIES_MS);
+	snap_ms = now_ms - age;
+
+	return start_ms <= snap_ms;
+}
+
+// crc32(0, page, 4096) of the module, the kernel crc32 has no pre- and post-inversion
+static uint32_t PageCRC32(const unsigned char *page)
+{
+	static uint32_t table[256];
+	uint32_t crc;
+	int i, b;
+
+	if (table[1]==0)
+	{
+		for (i=0;i<256;i++)
+		{
+			crc = i;
+			for (b=0;b<8;b++)
+				crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+			table[i] = crc;
+		}
+	}
+
+	crc = 0;
+	for (i=0;i<VMS_PAGE_SIZE;i++)
+		crc = (crc >> 8) ^ table[(crc ^ page[i]) & 0xff];
+	return crc;
+}
+
+// grows a buffer of size byte elements to at least needed elements
+static int GrowBuffer(void **buffer, unsigned long *capacity, unsigned long needed, unsigned long size)
+{
+	unsigned long new_capacity = *capacity;
+	void *data;
+
+	if (needed <= *capacity)
+		return 0;
+	while (new_capacity < needed)
+		new_capacity = new_capacity==0 ? 16 : new_capacity * 2;
+
+	data = realloc(*buffer, new_capacity * size);
+	if (data==NULL)
+		return -1;
+	*buffer = data;
+	*capacity = new_capacity;
+	return 0;
+}
@@ -0,0 +1,258 @@
+// snapshot diff - merge joins two snapshots by region and address
+
+#include "../include/vmsdiff.h"
+#include "../include/vmsindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_FLAGS (VMS_HASH_CRC32 | VMS_HASH_CRC32_EX | VMS_HASH_PATTERN | VMS_HASH_SHA1 | VMS_HASH_SUPERFAST | VMS_HASH_CHUNKS | VMS_CHUNK_2K)
+
+static const char *DIFFCLASSTOSTRING[] =
+{
+	"unchanged",
+	"changed",
+	"remapped",
+	"faulted",
+	"swapped",
+	"unmapped"
+};
+
+// helper functions for internal use
+static int BuildDiffRegions(struct SnapshotIndex *old_index, struct SnapshotIndex *new_index, struct SnapshotDiff *diff);
+static int ClassifyPage(const struct PageTableEntryInfo *old_page, const struct PageTableEntryInfo *new_page);
+
+
+struct SnapshotDiff* DiffSnapshots(VMSNAPSHOT old_snap, VMSNAPSHOT new_snap, DiffCallback callback, void *data)
+{
+	struct SnapshotIndex *old_index, *new_index;
+	struct PageIterator old_iter, new_iter;
+	struct PageTableEntryInfo *old_page, *new_page, *o, *n;
+	struct RegionDiffInfo *region;
+	struct SnapshotDiff *diff;
+	unsigned long old_addr=0, new_addr=0, address;
+	int cls, r;
+
+	if (old_snap==NULL || new_snap==NULL)
+		return NULL;
+
+	if ((old_snap->flags & HASH_FLAGS) != (new_snap->flags & HASH_FLAGS))
+	{
+		printf("Snapshots use different hash functions (%x, %x).\n", old_snap->flags, new_snap->flags);
+		return NULL;
+	}
+	if ((old_snap->pid==0) != (new_snap->pid==0))
+	{
+		printf("Physical snapshots can only be compared to physical snapshots.\n");
+		return NULL;
+	}
+
+	old_index = CreateSnapshotIndex(old_snap);
+	new_index = CreateSnapshotIndex(new_snap);
+	diff = (struct SnapshotDiff*) calloc(1, sizeof(struct SnapshotDiff));
+	if (old_index==NULL || new_index==NULL || diff==NULL || BuildDiffRegions(old_index, new_index, diff)!=0)
+	{
+		printf("Could not compare snapshots.\n");
+		ReleaseSnapshotIndex(old_index);
+		ReleaseSnapshotIndex(new_index);
+		ReleaseSnapshotDiff(diff);
+		return NULL;
+	}
+	diff->old_snap = old_snap;
+	diff->new_snap = new_snap;
+
+	// both page streams are sorted by address - merge them region by region
+	InitPageIterator(old_index, 0, ~0ul, &old_iter);
+	InitPageIterator(new_index, 0, ~0ul, &new_iter);
+	old_page = NextPage(&old_iter, &old_addr, NULL);
+	new_page = NextPage(&new_iter, &new_addr, NULL);
+
+	for (r=0;r<diff->region_count;r++)
+	{
+		region = &diff->regions[r];
+		while ((old_page!=NULL && old_addr < region->end_address) || (new_page!=NULL && new_addr < region->end_address))
+		{
+			o = NULL;
+			n = NULL;
+			if (new_page==NULL || new_addr >= region->end_address || (old_page!=NULL && old_addr < new_addr))
+			{
+				address = old_addr;
+				o = old_page;
+			}
+			else if (old_page==NULL || old_addr >= region->end_address || new_addr < old_addr)
+			{
+				address = new_addr;
+				n = new_page;
+			}
+			else
+			{
+				address = old_addr;
+				o = old_page;
+				n = new_page;
+			}
+
+			if (o!=NULL)
+				old_page = NextPage(&old_iter, &old_addr, NULL);
+			if (n!=NULL)
+				new_page = NextPage(&new_iter, &new_addr, NULL);
+
+			cls = ClassifyPage(o, n);
+			if (cls < 0)
+				continue;
+
+			region->count[cls]++;
+			diff->total[cls]++;
+			if (callback!=NULL)
+				callback(address, cls, o, n, data);
+		}
+	}
+
+	ReleaseSnapshotIndex(old_index);
+	ReleaseSnapshotIndex(new_index);
+
+	return diff;
+}
+
+void ReleaseSnapshotDiff(struct SnapshotDiff *diff)
+{
+	if (diff!=NULL)
+	{
+		free(diff->regions);
+		free(diff);
+	}
+}
+
+void PrintSnapshotDiff(struct SnapshotDiff *diff)
+{
+	struct RegionDiffInfo *region;
+	const char *name;
+	int i, j;
+
+	if (diff==NULL)
+		return;
+
+	printf("start;end;old vma;new vma;name;");
+	for (j=0;j<DIFF_CLASS_COUNT;j++)
+		printf("%s;", DIFFCLASSTOSTRING[j]);
+	printf("\n");
+
+	for (i=0;i<diff->region_count;i++)
+	{
+		region = &diff->regions[i];
+		if (region->new_vma >= 0)
+			name = diff->new_snap->vms[region->new_vma].file_name;
+		else
+			name = diff->old_snap->vms[region->old_vma].file_name;
+
+		printf("%lx;%lx;%d;%d;%s;", region->start_address, region->end_address, region->old_vma, region->new_vma, name);
+		for (j=0;j<DIFF_CLASS_COUNT;j++)
+			printf("%lu;", region->count[j]);
+		printf("\n");
+	}
+
+	printf("total;;;;;");
+	for (j=0;j<DIFF_CLASS_COUNT;j++)
+		printf("%lu;", diff->total[j]);
+	printf("\n");
+}
+
+const char* GetDiffClassName(int diff_class)
+{
+	if (diff_class < 0 || diff_class >= DIFF_CLASS_COUNT)
+		return "?";
+	return DIFFCLASSTOSTRING[diff_class];
+}
+
+// for internal use only
+// splits the address space into ranges in which both snapshots use the same regions
+static int BuildDiffRegions(struct SnapshotIndex *old_index, struct SnapshotIndex *new_index, struct SnapshotDiff *diff)
+{
+	struct VMAIndexEntry *a, *b;
+	struct RegionDiffInfo *region;
+	unsigned long pos = 0, end;
+	int ia = 0, ib = 0;
+	int in_a, in_b;
+
+	// every region boundary creates at most one additional range
+	diff->regions = (struct RegionDiffInfo*) calloc(2*(old_index->count + new_index->count) + 1, sizeof(struct RegionDiffInfo));
+	if (diff->regions==NULL)
+		return -1;
+	diff->region_count = 0;
+
+	while (ia < old_index->count || ib < new_index->count)
+	{
+		a = ia < old_index->count ? &old_index->entries[ia] : NULL;
+		b = ib < new_index->count ? &new_index->entries[ib] : NULL;
+
+		if (a!=NULL && a->end_address <= pos)
+		{
+			ia++;
+			continue;
+		}
+		if (b!=NULL && b->end_address <= pos)
+		{
+			ib++;
+			continue;
+		}
+
+		in_a = a!=NULL && a->start_address <= pos;
+		in_b = b!=NULL && b->start_address <= pos;
+		if (!in_a && !in_b)
+		{
+			// jump to the next region
+			pos = ~0ul;
+			if (a!=NULL)
+				pos = a->start_address;
+			if (b!=NULL && b->start_address < pos)
+				pos = b->start_address;
+			continue;
+		}
+
+		end = ~0ul;
+		if (a!=NULL)
+			end = in_a ? a->end_address : a->start_address;
+		if (b!=NULL)
+		{
+			if (in_b && b->end_address < end)
+				end = b->end_address;
+			else if (!in_b && b->start_address < end)
+				end = b->start_address;
+		}
+
+		region = &diff->regions[diff->region_count++];
+		region->start_address	= pos;
+		region->end_address		= end;
+		region->old_vma			= in_a ? a->vma_index : -1;
+		region->new_vma			= in_b ? b->vma_index : -1;
+
+		pos = end;
+	}
+
+	return 0;
+}
+
+static int ClassifyPage(const struct PageTableEntryInfo *old_page, const struct PageTableEntryInfo *new_page)
+{
+	int old_present = old_page!=NULL && old_page->present > 0;
+	int new_present = new_page!=NULL && new_page->present > 0;
+
+	if (old_present && new_present)
+	{
+		if (CompareHash(old_page->hash, new_page->hash, 20)!=0)
+			return DIFF_CHANGED;
+		if (old_page->pfn != new_page->pfn)
+			return DIFF_REMAPPED;
+		return DIFF_UNCHANGED;
+	}
+	if (new_present)
+		return DIFF_FAULTED;
+	if (old_present)
+	{
+		// swap entries keep their pte flags, empty ptes are stored as zero
+		if (new_page!=NULL && new_page->pte_flags!=0)
+			return DIFF_SWAPPED;
+		return DIFF_UNMAPPED;
+	}
+	return -1;
+}
@@ -0,0 +1,178 @@
+// parallel export - formats chunks of pages on a thread pool, writes them in order
+
+#include "../include/vmsexport.h"
+#include "../include/vmsformat.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// upper bound of a formatted page record, the buffers grow if it is exceeded
+#define EXPORT_LINE_SIZE 192
+
+struct ExportSlot
+{
+	int chunk; // chunk which is formatted into the slot, -1 if free
+	int ready;
+	struct OutputBuffer *out;
+};
+
+struct ExportJob
+{
+	VMSNAPSHOT snap;
+	int start;
+	int count;
+	int chunk_count;
+	int next_chunk; // next chunk to be formatted
+	int next_write; // next chunk to be written
+	int slot_count;
+	struct ExportSlot *slots; // chunk c uses slot c % slot_count
+	pthread_mutex_t lock;
+	pthread_cond_t formatted;
+	pthread_cond_t written;
+};
+
+// helper functions for internal use
+static void* ExportWorker(void *data);
+
+
+int ExportPages(VMSNAPSHOT snap, int start, int count, int fd, int thread_count)
+{
+	struct ExportJob job;
+	struct ExportSlot *slot;
+	pthread_t threads[EXPORT_MAX_THREADS];
+	int started = 0;
+	int ret = 0;
+	int i;
+
+	if (snap==NULL)
+		return -1;
+
+	if (start >= snap->available_pages || start+count > snap->available_pages)
+	{
+		if (write(fd, "error\n", 6)!=6)
+			return -1;
+		return 0;
+	}
+
+	if (thread_count <= 0)
+		thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_count <= 0)
+		thread_count = 1;
+	if (thread_count > EXPORT_MAX_THREADS)
+		thread_count = EXPORT_MAX_THREADS;
+
+	memset(&job, 0, sizeof(struct ExportJob));
+	job.snap = snap;
+	job.start = start;
+	job.count = count;
+	job.chunk_count = (count + EXPORT_CHUNK_PAGES - 1) / EXPORT_CHUNK_PAGES;
+	if (thread_count > job.chunk_count)
+		thread_count = job.chunk_count > 0 ? job.chunk_count : 1;
+
+	// two slots per thread keep the threads busy while a chunk is written
+	job.slot_count = 2*thread_count;
+	job.slots = (struct ExportSlot*) calloc(job.slot_count, sizeof(struct ExportSlot));
+	if (job.slots==NULL)
+		return -1;
+	for (i=0;i<job.slot_count;i++)
+	{
+		job.slots[i].chunk = -1;
+		job.slots[i].out = CreateMemoryBuffer((unsigned long)EXPORT_CHUNK_PAGES * EXPORT_LINE_SIZE);
+		if (job.slots[i].out==NULL)
+			ret = -1;
+	}
+
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.formatted, NULL);
+	pthread_cond_init(&job.written, NULL);
+
+	if (ret==0)
+	{
+		for (started=0;started<thread_count;started++)
+			if (pthread_create(&threads[started], NULL, ExportWorker, &job)!=0)
+				break;
+		if (started==0)
+			ret = -1;
+	}
+
+	// the calling thread is the writer
+	while (ret==0 && job.next_write < job.chunk_count)
+	{
+		slot = &job.slots[job.next_write % job.slot_count];
+
+		pthread_mutex_lock(&job.lock);
+		while (slot->chunk!=job.next_write || !slot->ready)
+			pthread_cond_wait(&job.formatted, &job.lock);
+		pthread_mutex_unlock(&job.lock);
+
+		if (slot->out->failed || WriteOutputBuffer(slot->out, fd)!=0)
+			ret = -1;
+
+		pthread_mutex_lock(&job.lock);
+		slot->chunk = -1;
+		slot->ready = 0;
+		job.next_write++;
+		pthread_cond_broadcast(&job.written);
+		pthread_mutex_unlock(&job.lock);
+	}
+
+	// stop the workers if the export failed
+	pthread_mutex_lock(&job.lock);
+	job.next_chunk = job.chunk_count;
+	pthread_cond_broadcast(&job.written);
+	pthread_mutex_unlock(&job.lock);
+
+	for (i=0;i<started;i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&job.written);
+	pthread_cond_destroy(&job.formatted);
+	pthread_mutex_destroy(&job.lock);
+
+	for (i=0;i<job.slot_count;i++)
+	{
+		ReleaseOutputBuffer(job.slots[i].out);
+	}
+	free(job.slots);
+
+	return ret;
+}
+
+// for internal use only
+static void* ExportWorker(void *data)
+{
+	struct ExportJob *job = (struct ExportJob*) data;
+	struct ExportSlot *slot;
+	int chunk, first, count;
+
+	pthread_mutex_lock(&job->lock);
+	while (1)
+	{
+		// a slot is free once its previous chunk is written
+		while (job->next_chunk < job->chunk_count && job->next_chunk - job->next_write >= job->slot_count)
+			pthread_cond_wait(&job->written, &job->lock);
+		if (job->next_chunk >= job->chunk_count)
+			break;
+
+		chunk = job->next_chunk++;
+		slot = &job->slots[chunk % job->slot_count];
+		slot->chunk = chunk;
+		pthread_mutex_unlock(&job->lock);
+
+		first = job->start + chunk * EXPORT_CHUNK_PAGES;
+		count = job->start + job->count - first;
+		if (count > EXPORT_CHUNK_PAGES)
+			count = EXPORT_CHUNK_PAGES;
+		FormatPages(slot->out, job->snap, first, count);
+
+		pthread_mutex_lock(&job->lock);
+		slot->ready = 1;
+		pthread_cond_broadcast(&job->formatted);
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+}
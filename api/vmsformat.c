@@ -0,0 +1,401 @@
+// output formatter - buffered writes and table driven flag strings
+
+#include "../include/vmsformat.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAG_TEXT_SIZE 23
+
+struct FlagText
+{
+	unsigned char len;
+	char text[FLAG_TEXT_SIZE];
+};
+
+typedef char* (*ConvertFlags)(unsigned long flags, char *result, int size);
+
+// every table covers 8 flag bits
+static struct FlagText VM_TABLE[4][256];
+static struct FlagText PTE_TABLE[2][256];
+static struct FlagText PAGE_TABLE[4][256];
+static char HEX_TABLE[256][2];
+static int tables_ready = 0;
+
+// helper functions for internal use
+static void InitFormatTables();
+static void BuildFlagTable(struct FlagText *table, int shift, int bits, int width, ConvertFlags convert);
+static inline void AppendFlagText(struct OutputBuffer *out, const struct FlagText *text);
+static void MakeRoom(struct OutputBuffer *out, unsigned long len);
+
+
+struct OutputBuffer* CreateOutputBuffer(int fd)
+{
+	struct OutputBuffer *out;
+
+	InitFormatTables();
+
+	out = (struct OutputBuffer*) malloc(sizeof(struct OutputBuffer));
+	if (out==NULL)
+		return NULL;
+	out->data = (char*) malloc(OUTPUT_BUFFER_SIZE);
+	if (out->data==NULL)
+	{
+		free(out);
+		return NULL;
+	}
+	out->fd = fd;
+	out->failed = 0;
+	out->used = 0;
+	out->size = OUTPUT_BUFFER_SIZE;
+
+	fflush(stdout);
+	return out;
+}
+
+void ReleaseOutputBuffer(struct OutputBuffer *out)
+{
+	if (out==NULL)
+		return;
+
+	FlushOutputBuffer(out);
+	free(out->data);
+	free(out);
+}
+
+struct OutputBuffer* CreateMemoryBuffer(unsigned long size)
+{
+	struct OutputBuffer *out;
+
+	InitFormatTables();
+
+	out = (struct OutputBuffer*) malloc(sizeof(struct OutputBuffer));
+	if (out==NULL)
+		return NULL;
+	out->data = (char*) malloc(size);
+	if (out->data==NULL)
+	{
+		free(out);
+		return NULL;
+	}
+	out->fd = -1;
+	out->failed = 0;
+	out->used = 0;
+	out->size = size;
+
+	return out;
+}
+
+int FlushOutputBuffer(struct OutputBuffer *out)
+{
+	if (out->fd < 0)
+		return 0;
+	return WriteOutputBuffer(out, out->fd);
+}
+
+int WriteOutputBuffer(struct OutputBuffer *out, int fd)
+{
+	unsigned long done = 0;
+	ssize_t ret;
+
+	while (done < out->used)
+	{
+		ret = write(fd, out->data + done, out->used - done);
+		if (ret <= 0)
+		{
+			out->used = 0;
+			out->failed = 1;
+			return -1;
+		}
+		done += ret;
+	}
+	out->used = 0;
+	return 0;
+}
+
+void AppendChars(struct OutputBuffer *out, const char *str, unsigned long len)
+{
+	unsigned long part;
+
+	while (len > 0)
+	{
+		if (out->used == out->size)
+			MakeRoom(out, len);
+		part = out->size - out->used;
+		if (part > len)
+			part = len;
+		memcpy(out->data + out->used, str, part);
+		out->used += part;
+		str += part;
+		len -= part;
+	}
+}
+
+void AppendString(struct OutputBuffer *out, const char *str)
+{
+	AppendChars(out, str, strlen(str));
+}
+
+void AppendChar(struct OutputBuffer *out, char c)
+{
+	if (out->used == out->size)
+		MakeRoom(out, 1);
+	out->data[out->used++] = c;
+}
+
+void AppendHex(struct OutputBuffer *out, unsigned long value, int width)
+{
+	char tmp[32];
+	int pos = sizeof(tmp);
+
+	do
+	{
+		tmp[--pos] = HEX_TABLE[value & 0xf][1];
+		value >>= 4;
+	} while (value!=0);
+
+	while (pos > (int)sizeof(tmp) - width)
+		tmp[--pos] = ' ';
+
+	AppendChars(out, tmp + pos, sizeof(tmp) - pos);
+}
+
+void AppendDecimal(struct OutputBuffer *out, long value, int width)
+{
+	char tmp[32];
+	int pos = sizeof(tmp);
+	unsigned long magnitude;
+
+	magnitude = value < 0 ? 0ul - (unsigned long)value : (unsigned long)value;
+	do
+	{
+		tmp[--pos] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude!=0);
+	if (value < 0)
+		tmp[--pos] = '-';
+
+	while (pos > (int)sizeof(tmp) - width)
+		tmp[--pos] = ' ';
+
+	AppendChars(out, tmp + pos, sizeof(tmp) - pos);
+}
+
+void AppendUnsigned(struct OutputBuffer *out, unsigned long value)
+{
+	char tmp[32];
+	int pos = sizeof(tmp);
+
+	do
+	{
+		tmp[--pos] = '0' + value % 10;
+		value /= 10;
+	} while (value!=0);
+
+	AppendChars(out, tmp + pos, sizeof(tmp) - pos);
+}
+
+void AppendHash(struct OutputBuffer *out, const unsigned char *hash, int size)
+{
+	char tmp[64];
+	int i, pos = 0;
+
+	for (i=0;i<size;i++)
+	{
+		tmp[pos++] = HEX_TABLE[hash[i]][0];
+		tmp[pos++] = HEX_TABLE[hash[i]][1];
+		if (pos == sizeof(tmp))
+		{
+			AppendChars(out, tmp, pos);
+			pos = 0;
+		}
+	}
+	AppendChars(out, tmp, pos);
+}
+
+void AppendVMFlags(struct OutputBuffer *out, unsigned long flags)
+{
+	AppendFlagText(out, &VM_TABLE[0][flags & 0xff]);
+	AppendFlagText(out, &VM_TABLE[1][(flags >> 8) & 0xff]);
+	AppendFlagText(out, &VM_TABLE[2][(flags >> 16) & 0xff]);
+	// ConvertVMFlags tests bit 31 with a sign extended int, so every bit above 30 sets it
+	AppendFlagText(out, &VM_TABLE[3][((flags >> 24) & 0x7f) | ((flags >> 31) ? 0x80 : 0)]);
+}
+
+void AppendPTEFlags(struct OutputBuffer *out, unsigned long flags)
+{
+	AppendFlagText(out, &PTE_TABLE[0][flags & 0xff]);
+	AppendFlagText(out, &PTE_TABLE[1][(flags >> 8) & 0x1f]);
+	if (flags & (1llu<<63))
+		AppendChars(out, "NX", 2);
+	else
+		AppendChars(out, "--", 2);
+}
+
+void AppendPageFlags(struct OutputBuffer *out, unsigned long flags)
+{
+	AppendFlagText(out, &PAGE_TABLE[0][flags & 0xff]);
+	AppendFlagText(out, &PAGE_TABLE[1][(flags >> 8) & 0xff]);
+	AppendFlagText(out, &PAGE_TABLE[2][(flags >> 16) & 0xff]);
+	AppendFlagText(out, &PAGE_TABLE[3][(flags >> 24) & 0x3]);
+}
+
+void FormatPages(struct OutputBuffer *out, VMSNAPSHOT snap, int start, int count)
+{
+	struct PageTableEntryInfo *cur_page;
+	int hash_size;
+
+	//Checks if pages are in snapshot range
+	if (start >= snap->available_pages || start+count > snap->available_pages)
+	{
+		AppendString(out, "error\n");
+		return;
+	}
+	cur_page = &snap->pages[start-1];
+	hash_size = snap->flags & VMS_HASH_SHA1 ? HASH_SHA1_SIZE : 16;
+
+	int i=0;
+	for (i=0;i<count;i++)
+	{
+		cur_page++;
+		if (snap->flags & VMS_ONLY_PRESENT_PAGES && cur_page->present < 0)
+			continue;
+
+		AppendHex(out, cur_page->pfn, 6);
+		AppendChar(out, ';');
+		AppendDecimal(out, cur_page->reference_count, 3);
+		AppendChar(out, ';');
+		AppendDecimal(out, cur_page->mapping_count, 3);
+		AppendChar(out, ';');
+		AppendPTEFlags(out, cur_page->pte_flags);
+		AppendChar(out, ';');
+		AppendPageFlags(out, cur_page->page_flags);
+		AppendChar(out, ';');
+		AppendUnsigned(out, cur_page->inode_no);
+		AppendChar(out, ';');
+		AppendHash(out, cur_page->hash, hash_size);
+		AppendChar(out, '\n');
+	}
+}
+
+void FormatVMA(struct OutputBuffer *out, VMSNAPSHOT snap, int start, int count)
+{
+	struct VirtualMemoryInfo *cur_vma;
+
+	//Checks if pages are in snapshot range
+	if (start >= snap->vm_region_count || start+count > snap->vm_region_count)
+		return;
+	
+	cur_vma = &snap->vms[start-1];
+
+	int i=0;
+	for (i=0;i<count;i++)
+	{
+		cur_vma++;
+
+		AppendHex(out, cur_vma->start_address, 0);
+		AppendChar(out, ';');
+		AppendHex(out, cur_vma->end_address, 0);
+		AppendChar(out, ';');
+		AppendPTEFlags(out, cur_vma->flags);
+		AppendChar(out, ';');
+		AppendVMFlags(out, cur_vma->pf_access);
+		AppendChar(out, ';');
+		AppendUnsigned(out, cur_vma->page_count);
+		AppendChar(out, ';');
+		AppendUnsigned(out, cur_vma->present_page_count);
+		AppendChar(out, ';');
+		AppendUnsigned(out, cur_vma->swapped_page_count);
+		AppendChar(out, ';');
+		AppendString(out, cur_vma->file_name);
+		AppendString(out, ";\n");
+	}
+}
+
+// for internal use only
+static inline void AppendFlagText(struct OutputBuffer *out, const struct FlagText *text)
+{
+	if (out->used + FLAG_TEXT_SIZE > out->size)
+		MakeRoom(out, FLAG_TEXT_SIZE);
+	memcpy(out->data + out->used, text->text, FLAG_TEXT_SIZE);
+	out->used += text->len;
+}
+
+// file buffers are written out, memory buffers grow
+static void MakeRoom(struct OutputBuffer *out, unsigned long len)
+{
+	unsigned long size;
+	char *data;
+
+	if (out->fd >= 0)
+	{
+		FlushOutputBuffer(out);
+		return;
+	}
+
+	size = out->size * 2;
+	if (size < out->used + len)
+		size = out->used + len;
+	data = (char*) realloc(out->data, size);
+	if (data==NULL)
+	{
+		// keep the buffer usable, but the text is lost
+		out->used = 0;
+		out->failed = 1;
+		return;
+	}
+	out->data = data;
+	out->size = size;
+}
+
+static void InitFormatTables()
+{
+	static const char *digits = "0123456789abcdef";
+	int i;
+
+	if (tables_ready)
+		return;
+
+	for (i=0;i<256;i++)
+	{
+		HEX_TABLE[i][0] = digits[i >> 4];
+		HEX_TABLE[i][1] = digits[i & 0xf];
+	}
+
+	for (i=0;i<4;i++)
+		BuildFlagTable(VM_TABLE[i], i*8, 8, 1, ConvertVMFlags);
+	BuildFlagTable(PTE_TABLE[0], 0, 8, 2, ConvertPTEFlags);
+	BuildFlagTable(PTE_TABLE[1], 8, 5, 2, ConvertPTEFlags);
+	for (i=0;i<3;i++)
+		BuildFlagTable(PAGE_TABLE[i], i*8, 8, 1, ConvertPageFlags);
+	BuildFlagTable(PAGE_TABLE[3], 24, 2, 1, ConvertPageFlags);
+
+	tables_ready = 1;
+}
+
+// a cleared flag is printed as width dashes, so the text of the bits
+// [shift, shift+bits) starts behind shift*width chars of the converted string
+static void BuildFlagTable(struct FlagText *table, int shift, int bits, int width, ConvertFlags convert)
+{
+	char tmp_buffer[MAX_TMP_BUFFER_SIZE];
+	int low_len, high_len, len;
+	unsigned long i;
+
+	memset(tmp_buffer, 0, MAX_TMP_BUFFER_SIZE);
+	convert(0, tmp_buffer, MAX_TMP_BUFFER_SIZE);
+	low_len = shift * width;
+	high_len = strlen(tmp_buffer) - low_len - bits * width;
+
+	for (i=0;i < (1ul<<bits);i++)
+	{
+		memset(tmp_buffer, 0, MAX_TMP_BUFFER_SIZE);
+		convert(i << shift, tmp_buffer, MAX_TMP_BUFFER_SIZE);
+		len = strlen(tmp_buffer) - low_len - high_len;
+		if (len > FLAG_TEXT_SIZE)
+			len = FLAG_TEXT_SIZE;
+		memcpy(table[i].text, tmp_buffer + low_len, len);
+		table[i].len = len;
+	}
+}
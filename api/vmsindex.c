@@ -0,0 +1,323 @@
+// snapshot index - maps addresses to page records
+
+#include "../include/vmsindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// helper functions for internal use
+static int CompareIndexEntries(const void *a, const void *b);
+static int BuildPresentBitmap(VMSNAPSHOT snap, struct VMAIndexEntry *entry);
+static unsigned int RankOf(const struct VMAIndexEntry *entry, unsigned int offset);
+static int FindFirstEntry(struct SnapshotIndex *index, unsigned long address);
+
+
+struct SnapshotIndex* CreateSnapshotIndex(VMSNAPSHOT snap)
+{
+	struct SnapshotIndex *index;
+	struct VMAIndexEntry *entry;
+	struct VirtualMemoryInfo *vma;
+	unsigned int next_start;
+	unsigned int record = 0;
+	int i;
+
+	if (snap==NULL)
+		return NULL;
+
+	if (snap->pid!=0 && snap->flags & VMS_ONLY_PRESENT_PAGES && snap->version < VMS_VERSION_PAGE_OFFSET)
+	{
+		printf("Snapshot version %x does not contain page addresses.\n", snap->version);
+		return NULL;
+	}
+
+	index = (struct SnapshotIndex*) malloc(sizeof(struct SnapshotIndex));
+	if (index==NULL)
+	{
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+
+	index->snap = snap;
+	index->count = snap->vm_region_count;
+	index->entries = (struct VMAIndexEntry*) calloc(snap->vm_region_count+1, sizeof(struct VMAIndexEntry));
+	if (index->entries==NULL)
+	{
+		printf("ERROR: Out of memory. (index)\n");
+		free(index);
+		return NULL;
+	}
+
+	for (i=0;i<snap->vm_region_count;i++)
+	{
+		vma = &snap->vms[i];
+		entry = &index->entries[i];
+		entry->vma_index = i;
+
+		if (snap->pid==0)
+		{
+			// physical snapshot: regions are inclusive ranges of System RAM, records are sorted by pfn
+			entry->start_address	= vma->start_address >> VMS_PAGE_SHIFT << VMS_PAGE_SHIFT;
+			entry->end_address		= ((vma->end_address >> VMS_PAGE_SHIFT) + 1) << VMS_PAGE_SHIFT;
+			entry->record_start		= record;
+			entry->record_count		= vma->present_page_count;
+			record += vma->present_page_count;
+		}
+		else
+		{
+			entry->start_address	= vma->start_address;
+			entry->end_address		= vma->end_address;
+			// VM_IO regions and aborted page walks own less records than pages
+			next_start = (i+1 < snap->vm_region_count) ? snap->vms[i+1].page_start_index : snap->available_pages;
+			entry->record_start		= vma->page_start_index;
+			entry->record_count		= next_start - vma->page_start_index;
+		}
+		entry->page_count = (entry->end_address - entry->start_address) >> VMS_PAGE_SHIFT;
+
+		if (entry->record_start + entry->record_count > snap->available_pages || entry->record_count > entry->page_count)
+		{
+			printf("Snapshot contains inconsistent region %d.\n", i);
+			ReleaseSnapshotIndex(index);
+			return NULL;
+		}
+
+		if ((snap->pid==0 || snap->flags & VMS_ONLY_PRESENT_PAGES) && entry->record_count > 0)
+		{
+			if (BuildPresentBitmap(snap, entry)!=0)
+			{
+				printf("Snapshot contains unordered pages in region %d.\n", i);
+				ReleaseSnapshotIndex(index);
+				return NULL;
+			}
+		}
+	}
+
+	qsort(index->entries, index->count, sizeof(struct VMAIndexEntry), CompareIndexEntries);
+
+	return index;
+}
+
+void ReleaseSnapshotIndex(struct SnapshotIndex *index)
+{
+	int i;
+	if (index!=NULL)
+	{
+		for (i=0;i<index->count;i++)
+		{
+			free(index->entries[i].present);
+			free(index->entries[i].rank);
+		}
+		free(index->entries);
+		free(index);
+	}
+}
+
+int LookupVMA(struct SnapshotIndex *index, unsigned long address)
+{
+	int i;
+
+	if (index==NULL)
+		return -1;
+
+	i = FindFirstEntry(index, address);
+	if (i < index->count && index->entries[i].start_address <= address)
+		return i;
+	return -1;
+}
+
+struct PageTableEntryInfo* LookupPage(struct SnapshotIndex *index, unsigned long address, int *vma_index)
+{
+	struct VMAIndexEntry *entry;
+	unsigned int offset, record;
+	int i;
+
+	i = LookupVMA(index, address);
+	if (i<0)
+		return NULL;
+
+	entry = &index->entries[i];
+	offset = (address - entry->start_address) >> VMS_PAGE_SHIFT;
+
+	if (entry->present==NULL)
+	{
+		if (offset >= entry->record_count)
+			return NULL;
+		record = offset;
+	}
+	else
+	{
+		if (!(entry->present[offset>>6] & (1ull << (offset&63))))
+			return NULL;
+		record = RankOf(entry, offset);
+	}
+
+	if (vma_index!=NULL)
+		*vma_index = entry->vma_index;
+	return &index->snap->pages[entry->record_start + record];
+}
+
+void InitPageIterator(struct SnapshotIndex *index, unsigned long start, unsigned long end, struct PageIterator *iter)
+{
+	struct VMAIndexEntry *entry;
+
+	iter->index = index;
+	iter->end_address = end;
+	iter->entry = FindFirstEntry(index, start);
+	iter->offset = 0;
+	iter->record = 0;
+
+	if (iter->entry < index->count)
+	{
+		entry = &index->entries[iter->entry];
+		if (entry->start_address < start)
+		{
+			iter->offset = (start - entry->start_address) >> VMS_PAGE_SHIFT;
+			if (entry->present==NULL)
+				iter->record = iter->offset;
+			else
+				iter->record = RankOf(entry, iter->offset);
+		}
+	}
+}
+
+struct PageTableEntryInfo* NextPage(struct PageIterator *iter, unsigned long *address, int *vma_index)
+{
+	struct VMAIndexEntry *entry;
+	unsigned int words, w, offset;
+	uint64_t bits;
+	int found;
+
+	while (iter->entry < iter->index->count)
+	{
+		entry = &iter->index->entries[iter->entry];
+		if (entry->start_address >= iter->end_address)
+			break;
+
+		found = 0;
+		if (entry->present==NULL)
+		{
+			if (iter->offset < entry->record_count)
+			{
+				offset = iter->offset;
+				found = 1;
+			}
+		}
+		else
+		{
+			// find the next present page
+			words = (entry->page_count + 63) >> 6;
+			w = iter->offset >> 6;
+			if (w < words)
+			{
+				bits = entry->present[w] & (~0ull << (iter->offset & 63));
+				while (bits==0 && ++w < words)
+					bits = entry->present[w];
+				if (bits!=0)
+				{
+					offset = (w << 6) + __builtin_ctzll(bits);
+					found = 1;
+				}
+			}
+		}
+
+		if (found)
+		{
+			*address = entry->start_address + ((unsigned long)offset << VMS_PAGE_SHIFT);
+			if (*address >= iter->end_address)
+				break;
+			if (vma_index!=NULL)
+				*vma_index = entry->vma_index;
+			iter->offset = offset + 1;
+			return &iter->index->snap->pages[entry->record_start + iter->record++];
+		}
+
+		// continue with the next region
+		iter->entry++;
+		iter->offset = 0;
+		iter->record = 0;
+	}
+
+	iter->entry = iter->index->count;
+	return NULL;
+}
+
+// for internal use only
+static int CompareIndexEntries(const void *a, const void *b)
+{
+	const struct VMAIndexEntry *e1 = (const struct VMAIndexEntry*) a;
+	const struct VMAIndexEntry *e2 = (const struct VMAIndexEntry*) b;
+
+	if (e1->start_address > e2->start_address)
+		return 1;
+	else if (e1->start_address < e2->start_address)
+		return -1;
+	return 0;
+}
+
+// sets a bit for every record of the region and computes the rank of every word
+static int BuildPresentBitmap(VMSNAPSHOT snap, struct VMAIndexEntry *entry)
+{
+	struct PageTableEntryInfo *page;
+	unsigned int words, offset, w;
+	unsigned int rank = 0;
+	long last = -1;
+	unsigned int i;
+
+	words = (entry->page_count + 63) >> 6;
+	entry->present = (uint64_t*) calloc(words, sizeof(uint64_t));
+	entry->rank = (unsigned int*) malloc(words * sizeof(unsigned int));
+	if (entry->present==NULL || entry->rank==NULL)
+		return -1;
+
+	page = &snap->pages[entry->record_start];
+	for (i=0;i<entry->record_count;i++, page++)
+	{
+		if (snap->pid==0)
+			offset = page->pfn - (entry->start_address >> VMS_PAGE_SHIFT);
+		else
+			offset = page->reserved;
+
+		// records are stored in ascending address order
+		if ((long)offset <= last || offset >= entry->page_count)
+			return -1;
+		last = offset;
+
+		entry->present[offset>>6] |= 1ull << (offset&63);
+	}
+
+	for (w=0;w<words;w++)
+	{
+		entry->rank[w] = rank;
+		rank += __builtin_popcountll(entry->present[w]);
+	}
+
+	return 0;
+}
+
+// amount of records in front of offset
+static unsigned int RankOf(const struct VMAIndexEntry *entry, unsigned int offset)
+{
+	unsigned int w = offset >> 6;
+
+	if (offset >= entry->page_count)
+		return entry->record_count;
+	return entry->rank[w] + __builtin_popcountll(entry->present[w] & ((1ull << (offset&63)) - 1));
+}
+
+// first entry which ends behind address
+static int FindFirstEntry(struct SnapshotIndex *index, unsigned long address)
+{
+	int low = 0;
+	int high = index->count;
+	int mid;
+
+	while (low < high)
+	{
+		mid = (low + high) / 2;
+		if (index->entries[mid].end_address <= address)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
@@ -0,0 +1,375 @@
+// KSM merge simulator - replays snapshots through a model of ksmd
+// needs to be compiled as c++
+
+#include "../include/vmsksm.h"
+#include "../include/vmsindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// helper functions for internal use
+static unsigned long ScanPages(KSMSimulator *sim, unsigned long count);
+static void ScanItem(KSMSimulator *sim, size_t process, size_t item);
+static void ReleaseNode(KSMSimulator *sim, unsigned int node);
+static unsigned int CreateNode(KSMSimulator *sim, const ContentKey &key);
+static int FindProcess(KSMSimulator *sim, int pid);
+static int FillItems(VMSNAPSHOT snap, int all_anonymous, vector<struct KSMItem> &items);
+static unsigned long TreeCompares(size_t size);
+
+
+void InitKSMParams(struct KSMParams *params)
+{
+	params->pages_to_scan = KSM_DEFAULT_PAGES_TO_SCAN;
+	params->sleep_ms = KSM_DEFAULT_SLEEP_MS;
+	params->all_anonymous = 0;
+	params->scan_cost_ns = KSM_SCAN_COST_NS;
+	params->compare_cost_ns = KSM_COMPARE_COST_NS;
+}
+
+KSMSimulator* CreateKSMSimulator(const struct KSMParams *params)
+{
+	KSMSimulator *sim;
+
+	sim = new KSMSimulator();
+	if (params!=NULL)
+		sim->params = *params;
+	else
+		InitKSMParams(&sim->params);
+	if (sim->params.sleep_ms==0)
+		sim->params.sleep_ms = 1;
+
+	sim->stable = new KSMStableMap();
+	sim->unstable = new KSMUnstableMap();
+	sim->cursor_process = 0;
+	sim->cursor_item = 0;
+	sim->merged = 0;
+	sim->pending_ms = 0;
+	sim->started = 0;
+	memset(&sim->stats, 0, sizeof(struct KSMStats));
+	return sim;
+}
+
+void ReleaseKSMSimulator(KSMSimulator *sim)
+{
+	size_t i;
+
+	if (sim==NULL)
+		return;
+
+	for (i=0;i<sim->processes.size();i++)
+		delete sim->processes[i];
+	delete sim->stable;
+	delete sim->unstable;
+	delete sim;
+}
+
+int AddSnapshotToKSMSimulator(KSMSimulator *sim, VMSNAPSHOT snap, unsigned long time_ms)
+{
+	vector<struct KSMItem> items;
+	struct KSMProcess *process;
+	struct KSMItem *old_item;
+	unsigned long cursor;
+	size_t i, j;
+	int p;
+
+	if (sim==NULL || snap==NULL)
+		return -1;
+	if (FillItems(snap, sim->params.all_anonymous, items)!=0)
+		return -1;
+
+	RunKSMSimulator(sim, time_ms);
+
+	p = FindProcess(sim, snap->pid);
+	if (p < 0)
+	{
+		process = new KSMProcess();
+		process->pid = snap->pid;
+		sim->processes.push_back(process);
+	}
+	else
+		process = sim->processes[p];
+
+	// both lists are sorted by address, the state of unchanged pages is kept
+	j = 0;
+	for (i=0;i<process->items.size();i++)
+	{
+		old_item = &process->items[i];
+		while (j < items.size() && items[j].address < old_item->address)
+			j++;
+
+		if (j < items.size() && items[j].address == old_item->address)
+		{
+			items[j].checksum = old_item->checksum;
+			items[j].scanned = old_item->scanned;
+			if (old_item->node == KSM_NO_NODE)
+				continue;
+			if (items[j].key == old_item->key)
+			{
+				items[j].node = old_item->node;
+				continue;
+			}
+			// the process wrote to the KSM page
+			sim->stats.cow_breaks++;
+		}
+
+		if (old_item->node != KSM_NO_NODE)
+		{
+			ReleaseNode(sim, old_item->node);
+			sim->merged--;
+		}
+	}
+
+	// the scan goes on with the next address of the current process
+	cursor = ~0ul;
+	if (p >= 0 && (size_t)p == sim->cursor_process && sim->cursor_item < process->items.size())
+		cursor = process->items[sim->cursor_item].address;
+
+	sim->stats.pages -= process->items.size();
+	sim->stats.pages += items.size();
+	process->items.swap(items);
+
+	if (p >= 0 && (size_t)p == sim->cursor_process)
+	{
+		for (i=0;i<process->items.size() && process->items[i].address < cursor;i++)
+			;
+		sim->cursor_item = i;
+	}
+	return 0;
+}
+
+void RunKSMSimulator(KSMSimulator *sim, unsigned long time_ms)
+{
+	unsigned long wakeups;
+
+	if (sim==NULL)
+		return;
+
+	if (!sim->started)
+	{
+		sim->started = 1;
+		sim->stats.time_ms = time_ms;
+		return;
+	}
+	if (time_ms <= sim->stats.time_ms)
+		return;
+
+	sim->pending_ms += time_ms - sim->stats.time_ms;
+	sim->stats.time_ms = time_ms;
+	wakeups = sim->pending_ms / sim->params.sleep_ms;
+	sim->pending_ms %= sim->params.sleep_ms;
+
+	ScanPages(sim, wakeups * sim->params.pages_to_scan);
+}
+
+void GetKSMStats(KSMSimulator *sim, struct KSMStats *stats)
+{
+	KSMUnstableMap::iterator it;
+	struct KSMItem *item;
+	unsigned long unshared = 0;
+
+	*stats = sim->stats;
+
+	// entries of the unstable tree might be outdated by newer snapshots
+	for (it=sim->unstable->begin();it!=sim->unstable->end();++it)
+	{
+		if (it->second.process >= sim->processes.size() || it->second.item >= sim->processes[it->second.process]->items.size())
+			continue;
+		item = &sim->processes[it->second.process]->items[it->second.item];
+		if (item->node == KSM_NO_NODE && item->key == it->first)
+			unshared++;
+	}
+
+	stats->pages_shared = sim->stable->size();
+	stats->pages_sharing = sim->merged - stats->pages_shared;
+	stats->pages_unshared = unshared;
+	stats->pages_volatile = sim->stats.pages - sim->merged - unshared;
+	stats->cpu_ms = (stats->pages_scanned * (double)sim->params.scan_cost_ns + stats->compares * (double)sim->params.compare_cost_ns) / 1000000.0;
+}
+
+// for internal use only
+// scans count items from the cursor on, return: items scanned
+static unsigned long ScanPages(KSMSimulator *sim, unsigned long count)
+{
+	unsigned long scanned = 0;
+
+	if (sim->stats.pages == 0)
+		return 0;
+
+	while (scanned < count)
+	{
+		while (sim->cursor_process < sim->processes.size() && sim->cursor_item >= sim->processes[sim->cursor_process]->items.size())
+		{
+			sim->cursor_process++;
+			sim->cursor_item = 0;
+		}
+		if (sim->cursor_process >= sim->processes.size())
+		{
+			// a full scan forgets the unstable tree
+			sim->stats.full_scans++;
+			sim->unstable->clear();
+			sim->cursor_process = 0;
+			sim->cursor_item = 0;
+			continue;
+		}
+
+		ScanItem(sim, sim->cursor_process, sim->cursor_item);
+		sim->cursor_item++;
+		scanned++;
+	}
+	sim->stats.pages_scanned += scanned;
+	return scanned;
+}
+
+// like cmp_and_merge_page: stable tree, checksum, unstable tree
+static void ScanItem(KSMSimulator *sim, size_t process, size_t item)
+{
+	struct KSMItem *it = &sim->processes[process]->items[item];
+	struct KSMItem *other;
+	KSMStableMap::iterator sit;
+	KSMUnstableMap::iterator uit;
+	struct KSMRef ref;
+	unsigned int node;
+
+	if (it->node != KSM_NO_NODE)
+		return;
+
+	sim->stats.compares += TreeCompares(sim->stable->size());
+	sit = sim->stable->find(it->key);
+	if (sit != sim->stable->end())
+	{
+		it->node = sit->second;
+		sim->nodes[it->node].mappers++;
+		sim->merged++;
+		return;
+	}
+
+	// pages changed since the last scan are volatile
+	if (!it->scanned || !(it->checksum == it->key))
+	{
+		it->checksum = it->key;
+		it->scanned = 1;
+		return;
+	}
+
+	sim->stats.compares += TreeCompares(sim->unstable->size());
+	ref.process = process;
+	ref.item = item;
+	uit = sim->unstable->find(it->key);
+	if (uit == sim->unstable->end())
+	{
+		sim->unstable->insert(KSMUnstableMap::value_type(it->key, ref));
+		return;
+	}
+
+	other = NULL;
+	if (uit->second.process < sim->processes.size() && uit->second.item < sim->processes[uit->second.process]->items.size())
+		other = &sim->processes[uit->second.process]->items[uit->second.item];
+	if (other == NULL || other == it || other->node != KSM_NO_NODE || !(other->key == it->key))
+	{
+		uit->second = ref;
+		return;
+	}
+
+	// both pages become one KSM page of the stable tree
+	sim->unstable->erase(uit);
+	node = CreateNode(sim, it->key);
+	sim->nodes[node].mappers = 2;
+	it->node = node;
+	other->node = node;
+	sim->merged += 2;
+}
+
+static void ReleaseNode(KSMSimulator *sim, unsigned int node)
+{
+	if (--sim->nodes[node].mappers > 0)
+		return;
+
+	sim->stable->erase(sim->nodes[node].key);
+	sim->free_nodes.push_back(node);
+}
+
+static unsigned int CreateNode(KSMSimulator *sim, const ContentKey &key)
+{
+	struct KSMNode n;
+	unsigned int node;
+
+	n.key = key;
+	n.mappers = 0;
+	if (!sim->free_nodes.empty())
+	{
+		node = sim->free_nodes.back();
+		sim->free_nodes.pop_back();
+		sim->nodes[node] = n;
+	}
+	else
+	{
+		node = sim->nodes.size();
+		sim->nodes.push_back(n);
+	}
+	sim->stable->insert(KSMStableMap::value_type(key, node));
+	return node;
+}
+
+static int FindProcess(KSMSimulator *sim, int pid)
+{
+	size_t i;
+
+	for (i=0;i<sim->processes.size();i++)
+		if (sim->processes[i]->pid == pid)
+			return i;
+	return -1;
+}
+
+// collects the anonymous pages of mergeable regions in address order
+static int FillItems(VMSNAPSHOT snap, int all_anonymous, vector<struct KSMItem> &items)
+{
+	struct SnapshotIndex *index;
+	struct PageIterator iter;
+	struct PageTableEntryInfo *page;
+	struct VirtualMemoryInfo *vma;
+	struct KSMItem item;
+	unsigned long address;
+	int hash_size, vma_index;
+
+	index = CreateSnapshotIndex(snap);
+	if (index==NULL)
+		return -1;
+
+	hash_size = GetHashSize(snap->flags);
+	item.node = KSM_NO_NODE;
+	item.scanned = 0;
+	items.reserve(snap->available_pages);
+
+	InitPageIterator(index, 0, ~0ul, &iter);
+	while ((page = NextPage(&iter, &address, &vma_index))!=NULL)
+	{
+		if (page->present <= 0 || page->inode_no != 0)
+			continue;
+		vma = &snap->vms[vma_index];
+		if (vma->flags & KSM_VM_UNMERGEABLE)
+			continue;
+		if (!all_anonymous && !(vma->flags & VMS_VM_MERGEABLE))
+			continue;
+
+		item.address = address;
+		item.key = MakeContentKey(page->hash, hash_size);
+		item.checksum = item.key;
+		items.push_back(item);
+	}
+
+	ReleaseSnapshotIndex(index);
+	return 0;
+}
+
+// a lookup walks down a balanced tree, one page compare per level
+static unsigned long TreeCompares(size_t size)
+{
+	unsigned long compares = 0;
+
+	while (size > 0)
+	{
+		compares++;
+		size >>= 1;
+	}
+	return compares;
+}
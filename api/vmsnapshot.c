@@ -1,6 +1,7 @@
 
 #include "../include/vmsnapshot.h"
 #include "../include/vmsnapstr.h"
+#include "../include/vmsformat.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -8,6 +9,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -26,6 +28,9 @@
 
 // helper functions for internal use
 void process(const char* string, struct InputParams *result);
+static void FormatAllPages(struct OutputBuffer *out, VMSNAPSHOT snap, int vma_index);
+static int WidenPageRecords(VMSNAPSHOT snap);
+static void PrintCompressionInfo(VMSNAPSHOT snap);
 
 
 VMSNAPSHOT TakeSnapshot(int pid, int flags)
@@ -48,10 +53,20 @@ VMSNAPSHOT* TakeSnapshots(int flags, int *count)
 	
 	ret = 0;
 	proc = opendir("/proc");
+	if (proc==NULL)
+	{
+		printf("ERROR: Opening /proc. errno=%d\n", errno);
+		return NULL;
+	}
 	while ( entry = readdir(proc) )
 	{
 		if (!isdigit(entry->d_name[0]))
 			continue;
+		if (ret==MAX_PIDS)
+		{
+			printf("More than %d processes, the others are left out.\n", MAX_PIDS);
+			break;
+		}
 		pids[ret] = atoi(entry->d_name);
 
 		ret++;
@@ -200,6 +215,13 @@ VMSNAPSHOT TakeSnapshotEx(const char* pidflagsstr, int len)
 	// close file
 	close(file);
 
+	// an older module writes shorter page records
+	if (tmp_snapshot->pid == pid && WidenPageRecords(tmp_snapshot)!=0)
+	{
+		ReleaseSnapshot(tmp_snapshot);
+		return NULL;
+	}
+
 	return tmp_snapshot;
 
 #else
@@ -242,6 +264,7 @@ int ProcessInputParams(int argc, const char* argv[], struct InputParams *result)
 	result->autosave	=0;
 	result->csv		=0;
 	result->extra	=0;
+	result->max_pause	=0;
 	for (i=1;i<argc;i++)
 	{
 		if (argv[i][0]=='-')
@@ -293,6 +316,10 @@ void process(const char* string, struct InputParams *result)
 	{
 		result->extra = 1;
 	}
+	else if (string[0]=='p')
+	{
+		result->max_pause = atol(&string[2]);
+	}
 	else
 	{
 		printf("Unsupported.\n");
@@ -342,6 +369,21 @@ int MarkHeapAndStack(VMSNAPSHOT snap)
 	return ret;
 }
 
+const char* GetRegionName(const struct VirtualMemoryInfo *vma)
+{
+	switch (vma->file_name[0])
+	{
+	case STACK_MARK:
+		return "[stack]";
+	case HEAP_MARK:
+		return "[heap]";
+	case '\0':
+		return "[anon]";
+	default:
+		return vma->file_name;
+	}
+}
+
 void PrintOptionsHelp()
 {
 	printf("Options:\n");
@@ -349,6 +391,7 @@ void PrintOptionsHelp()
 	printf("-n=\tAmount of snapshots that should be taken - -n=5\n");
 	printf("-s \tAutosaves snapshots into current working directory\n");
 	printf("-c \tOutput is in csv format\n");
+	printf("-p=\tMaximum pause of a frozen cgroup in milliseconds - -p=500\n");
 }
 
 
@@ -563,6 +606,12 @@ VMSNAPSHOT LoadSnapshot(const char *path)
 	} while (res < snap->size_pages);
 
 	close(file);
+
+	if (WidenPageRecords(snap)!=0)
+	{
+		ReleaseSnapshot(snap);
+		return NULL;
+	}
 	
 	return snap;
 }
@@ -639,80 +688,52 @@ int SaveSnapshot(VMSNAPSHOT snap)
 ///
 void PrintPages(VMSNAPSHOT snap, int start, int count)
 {
-	struct PageTableEntryInfo *cur_page;
-	char tmp_buffer[MAX_TMP_BUFFER_SIZE];
+	struct OutputBuffer *out;
 
 	if (snap==NULL)
 		return;
 
-	//Checks if pages are in snapshot range
-	if (start >= snap->available_pages || start+count > snap->available_pages)
-	{
-		printf("error\n");
+	out = CreateOutputBuffer(STDOUT_FILENO);
+	if (out==NULL)
 		return;
-	}
-	cur_page = &snap->pages[start-1];
-
-	int i=0;
-	for (i=0;i<count;i++)
-	{
-		cur_page++;
-		if (snap->flags & VMS_ONLY_PRESENT_PAGES && cur_page->present < 0)
-			continue;
-	
-		printf("%6lx;%3d;%3d;%s;", cur_page->pfn, cur_page->reference_count, cur_page->mapping_count, ConvertPTEFlags(cur_page->pte_flags, tmp_buffer, MAX_TMP_BUFFER_SIZE));
-		printf("%s;%lu;", ConvertPageFlags(cur_page->page_flags, tmp_buffer, MAX_TMP_BUFFER_SIZE),cur_page->inode_no);
-		if (snap->flags & VMS_HASH_SHA1)
-			PrintHash(cur_page->hash, HASH_SHA1_SIZE);
-		else
-			PrintMD5Hash(cur_page->hash);
-	}
+	FormatPages(out, snap, start, count);
+	ReleaseOutputBuffer(out);
 }
 
 void PrintAllPages(VMSNAPSHOT snap, int vma_index)
 {
+	struct OutputBuffer *out;
+
 	if (snap==NULL)
 		return;
-	
-	if (vma_index >= snap->vm_region_count)
+
+	out = CreateOutputBuffer(STDOUT_FILENO);
+	if (out==NULL)
 		return;
-	if (snap->flags & VMS_ONLY_PRESENT_PAGES)
-		PrintPages(snap, snap->vms[vma_index].page_start_index, snap->vms[vma_index].present_page_count);
-	else
-		PrintPages(snap, snap->vms[vma_index].page_start_index, snap->vms[vma_index].page_count);
+	FormatAllPages(out, snap, vma_index);
+	ReleaseOutputBuffer(out);
 }
 
 
 ///
 void PrintVMA(VMSNAPSHOT snap, int start, int count)
 {
-	struct VirtualMemoryInfo *cur_vma;
-	char tmp_buffer[MAX_TMP_BUFFER_SIZE];
+	struct OutputBuffer *out;
 
 	if (snap==NULL)
 		return;
 
-	//Checks if pages are in snapshot range
-	if (start >= snap->vm_region_count || start+count > snap->vm_region_count)
+	out = CreateOutputBuffer(STDOUT_FILENO);
+	if (out==NULL)
 		return;
-	
-	cur_vma = &snap->vms[start-1];
-
-	int i=0;
-	for (i=0;i<count;i++)
-	{
-		cur_vma++;
-		
-		printf("%lx;%lx;%s;", cur_vma->start_address, cur_vma->end_address, ConvertPTEFlags(cur_vma->flags, tmp_buffer, MAX_TMP_BUFFER_SIZE));
-		printf("%s;", ConvertVMFlags(cur_vma->pf_access, tmp_buffer, MAX_TMP_BUFFER_SIZE));
-		printf("%u;%u;%u;%s;\n", cur_vma->page_count, cur_vma->present_page_count, cur_vma->swapped_page_count, cur_vma->file_name);
-		
-	}
+	FormatVMA(out, snap, start, count);
+	ReleaseOutputBuffer(out);
 }
 
 ///
 void PrintVMAandPages(VMSNAPSHOT snap, int start, int count)
 {
+	struct OutputBuffer *out;
 	int i=0;
 	
 	if (snap==NULL)
@@ -721,12 +742,29 @@ void PrintVMAandPages(VMSNAPSHOT snap, int start, int count)
 	if (start >= snap->vm_region_count || start+count > snap->vm_region_count)
 		return;
 	
+	out = CreateOutputBuffer(STDOUT_FILENO);
+	if (out==NULL)
+		return;
+
 	for (i=start;i<start+count;i++)
 	{
-		PrintVMA(snap, i, 1);
+		FormatVMA(out, snap, i, 1);
 		if (snap->vms[i].flags & ~VM_IO)
-			PrintAllPages(snap, i);
+			FormatAllPages(out, snap, i);
 	}
+
+	ReleaseOutputBuffer(out);
+}
+
+// for internal use only
+static void FormatAllPages(struct OutputBuffer *out, VMSNAPSHOT snap, int vma_index)
+{
+	if (vma_index >= snap->vm_region_count)
+		return;
+	if (snap->flags & VMS_ONLY_PRESENT_PAGES)
+		FormatPages(out, snap, snap->vms[vma_index].page_start_index, snap->vms[vma_index].present_page_count);
+	else
+		FormatPages(out, snap, snap->vms[vma_index].page_start_index, snap->vms[vma_index].page_count);
 }
 
 ///
@@ -782,6 +820,9 @@ void PrintSnapshotInfoEx(VMSNAPSHOT snap)
 		printf("AvailablePages: %ld pages => %ld bytes\n", snap->available_pages, snap->available_pages * 4096);
 		printf("InvalidPFNs:    %ld PhysicalFrameNumbers\n", snap->locked_pages);
 	}
+
+	if (snap->flags & (VMS_COMPRESS_LZO | VMS_COMPRESS_ENTROPY))
+		PrintCompressionInfo(snap);
 }
 ///
 void PrintSnapshot(VMSNAPSHOT snap)
@@ -1024,10 +1065,76 @@ const unsigned char* GetZeroPageHash(int flags)
 		return (const unsigned char *) ZEROPAGEHASHES[4];
 	else if (flags & VMS_HASH_SHA1)
 		return (const unsigned char *) ZEROPAGEHASHES[5];
+	else if (flags & VMS_HASH_CHUNKS)
+		return (const unsigned char *) ZEROPAGEHASHES[1]; // every chunk checksum is 0
 	else
 		return (const unsigned char *) ZEROPAGEHASHES[0];
 }
 
+int GetHashSize(int flags)
+{
+	if (flags & VMS_HASH_CRC32)
+		return HASH_CRC32_SIZE;
+	else if (flags & VMS_HASH_CRC32_EX)
+		return HASH_CRC32EX_SIZE;
+	else if (flags & VMS_HASH_SUPERFAST)
+		return HASH_SUPER_SIZE;
+	else if (flags & VMS_HASH_PATTERN)
+		return HASH_SP_SIZE;
+	else if (flags & VMS_HASH_SHA1)
+		return HASH_SHA1_SIZE;
+	else if (flags & VMS_HASH_CHUNKS)
+		return HASH_CHUNKS_SIZE;
+	else
+		return HASH_MD5_SIZE;
+}
+
+int GetChunkSize(int flags)
+{
+	if (flags & VMS_HASH_CRC32)
+		return 0;
+	else if (flags & VMS_HASH_CRC32_EX)
+		return 1024;
+	else if (flags & (VMS_HASH_SUPERFAST | VMS_HASH_PATTERN | VMS_HASH_SHA1))
+		return 0;
+	else if (flags & VMS_HASH_CHUNKS)
+	{
+		if (flags & VMS_CHUNK_2K)
+			return 2048;
+		return 1024;
+	}
+	else
+		return 0;
+}
+
+int GetChunkBits(int flags)
+{
+	int chunk_size = GetChunkSize(flags);
+	int bits;
+
+	if (chunk_size==0)
+		return 0;
+	if (!(flags & VMS_HASH_CHUNKS))
+		return 32; // one crc32 per chunk
+
+	// the same packing as hash_page_chunks of the module
+	bits = HASH_CHUNKS_SIZE * 8 / (VMS_PAGE_SIZE / chunk_size);
+	return bits > 64 ? 64 : bits;
+}
+
+uint64_t GetChunkHash(const unsigned char *hash, int flags, int chunk)
+{
+	int bits = GetChunkBits(flags);
+	int pos = chunk * bits;
+	uint64_t value = 0;
+	int b;
+
+	for (b=0;b<bits;b++,pos++)
+		if (hash[pos/8] & (1 << (pos%8)))
+			value |= 1ull << b;
+	return value;
+}
+
 int IsWriteable(unsigned long pte_flags)
 {
 	return pte_flags & 2;
@@ -1043,6 +1150,93 @@ void PrintCollisionInfo(struct CollisionInfo *info)
 	printf("%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;%d;",info->unshareable, info->shareable, info->shared, info->shared_zero, info->s_stack, info->s_srw, info->s_heap, info->s_hrw, info->s_anon, info->s_arw, info->s_named, info->s_nrw, info->sharing_op, info->sharing_zero, info->o_stack, info->o_srw, info->o_heap, info->o_hrw, info->o_anon, info->o_arw, info->o_named, info->o_nrw, info->o_diff_name, info->o_anon_named, info->o_named_anon, info->shared_counter, info->named_shared_counter);
 }
 
+void MergeCollisionInfo(struct CollisionInfo *dest, const struct CollisionInfo *src)
+{
+	// all fields are int counters
+	int *d = (int*) dest;
+	const int *s = (const int*) src;
+	unsigned int i;
+
+	for (i=0;i<sizeof(struct CollisionInfo)/sizeof(int);i++)
+		d[i] += s[i];
+}
+
+unsigned char* CreateVMAClasses(VMSNAPSHOT snap)
+{
+	unsigned char *classes;
+	int i;
+
+	classes = (unsigned char*) malloc(2*snap->vm_region_count + 1);
+	if (classes==NULL)
+	{
+		printf("ERROR: Out of memory. (classes)\n");
+		return NULL;
+	}
+
+	// same cases as the former switch of CountSharedCollisons
+	for (i=0;i<snap->vm_region_count;i++)
+	{
+		switch (snap->vms[i].file_name[0])
+		{
+		case STACK_MARK:
+			classes[2*i] = classes[2*i+1] = PAGE_CLASS_STACK;
+			break;
+		case HEAP_MARK:
+			classes[2*i] = classes[2*i+1] = PAGE_CLASS_HEAP;
+			break;
+		case '/':
+			classes[2*i] = PAGE_CLASS_ANON;
+			classes[2*i+1] = PAGE_CLASS_NAMED;
+			break;
+		default:
+			classes[2*i] = classes[2*i+1] = PAGE_CLASS_NAMED;
+			break;
+		}
+	}
+
+	return classes;
+}
+
+void AddClassCounters(struct CollisionInfo *info, const struct ClassCounters *counters)
+{
+	// class and rw counter of every page class without the flags
+	static const size_t SHARED_FIELDS[4][2] = {
+		{ offsetof(struct CollisionInfo, s_named), offsetof(struct CollisionInfo, s_nrw) },
+		{ offsetof(struct CollisionInfo, s_anon), offsetof(struct CollisionInfo, s_arw) },
+		{ offsetof(struct CollisionInfo, s_heap), offsetof(struct CollisionInfo, s_hrw) },
+		{ offsetof(struct CollisionInfo, s_stack), offsetof(struct CollisionInfo, s_srw) }};
+	static const size_t SHARING_FIELDS[4][2] = {
+		{ offsetof(struct CollisionInfo, o_named), offsetof(struct CollisionInfo, o_nrw) },
+		{ offsetof(struct CollisionInfo, o_anon), offsetof(struct CollisionInfo, o_arw) },
+		{ offsetof(struct CollisionInfo, o_heap), offsetof(struct CollisionInfo, o_hrw) },
+		{ offsetof(struct CollisionInfo, o_stack), offsetof(struct CollisionInfo, o_srw) }};
+	char *fields = (char*) info;
+	unsigned int c, base;
+	int shared, sharing_op;
+
+	for (c=0;c<PAGE_CLASS_COUNT;c++)
+	{
+		shared = counters->shared[c];
+		sharing_op = counters->sharing_op[c];
+		base = c & PAGE_CLASS_MASK;
+
+		info->shared += shared;
+		info->sharing_op += sharing_op;
+		*(int*)(fields + SHARED_FIELDS[base][0]) += shared;
+		*(int*)(fields + SHARING_FIELDS[base][0]) += sharing_op;
+		if (c & PAGE_CLASS_WRITEABLE)
+		{
+			*(int*)(fields + SHARED_FIELDS[base][1]) += shared;
+			*(int*)(fields + SHARING_FIELDS[base][1]) += sharing_op;
+		}
+		if (c & PAGE_CLASS_ZERO)
+		{
+			info->shared_zero += shared;
+			info->sharing_zero += sharing_op;
+		}
+	}
+}
+
 int CountSharedPages(VMSNAPSHOT snap)
 {
 	int ret=0;
@@ -1071,4 +1265,77 @@ int CountAnonymousVMA(VMSNAPSHOT snap)
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
+
+// records of older snapshots lack the fields behind VMS_PAGE_RECORD_SIZE_V43 or _V44
+static int WidenPageRecords(VMSNAPSHOT snap)
+{
+	struct PageTableEntryInfo *pages;
+	unsigned long record_size;
+	unsigned long i;
+
+	if (snap->available_pages==0)
+		return 0;
+	if (snap->size_pages == snap->available_pages * VMS_PAGE_RECORD_SIZE_V43)
+		record_size = VMS_PAGE_RECORD_SIZE_V43;
+	else if (snap->size_pages == snap->available_pages * VMS_PAGE_RECORD_SIZE_V44)
+		record_size = VMS_PAGE_RECORD_SIZE_V44;
+	else
+		return 0;
+
+	pages = (struct PageTableEntryInfo*) realloc(snap->pages, snap->available_pages * sizeof(struct PageTableEntryInfo));
+	if (pages==NULL)
+	{
+		printf("ERROR: Out of memory. (pages)\n");
+		return -1;
+	}
+
+	// records only move up, so the last one first
+	for (i=snap->available_pages;i-- > 0;)
+	{
+		memmove((char*)pages + i * sizeof(struct PageTableEntryInfo), (char*)pages + i * record_size, record_size);
+		memset((char*)&pages[i] + record_size, 0, sizeof(struct PageTableEntryInfo) - record_size);
+	}
+
+	snap->pages = pages;
+	snap->size_pages = snap->available_pages * sizeof(struct PageTableEntryInfo);
+	return 0;
+}
+
+// compression ratio of the measured pages per region and of the snapshot
+static void PrintCompressionInfo(VMSNAPSHOT snap)
+{
+	unsigned long *pages, *bytes;
+	unsigned long total_pages = 0, total_bytes = 0;
+	unsigned long i;
+	int v;
+
+	pages = (unsigned long*) calloc(2 * (snap->vm_region_count + 1), sizeof(unsigned long));
+	if (pages==NULL)
+		return;
+	bytes = pages + snap->vm_region_count + 1;
+
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (snap->pages[i].present <= 0 || snap->pages[i].compressed_size==0)
+			continue;
+		// present is the region number of process snapshots
+		v = snap->pid!=0 && snap->pages[i].present <= snap->vm_region_count ? snap->pages[i].present - 1 : snap->vm_region_count;
+		pages[v]++;
+		bytes[v] += snap->pages[i].compressed_size;
+		total_pages++;
+		total_bytes += snap->pages[i].compressed_size;
+	}
+
+	printf("Compressed:     %ld pages => %ld bytes ratio %.2f (%s)\n", total_pages, total_bytes,
+		total_bytes ? (double)total_pages * VMS_PAGE_SIZE / total_bytes : 0.0, snap->flags & VMS_COMPRESS_LZO ? "lzo" : "entropy");
+	for (v=0;v<snap->vm_region_count;v++)
+	{
+		if (pages[v]==0)
+			continue;
+		printf("  0x%lx - 0x%lx %-40.40s %ld pages => %ld bytes ratio %.2f\n", snap->vms[v].start_address, snap->vms[v].end_address,
+			GetRegionName(&snap->vms[v]), pages[v], bytes[v], (double)pages[v] * VMS_PAGE_SIZE / bytes[v]);
+	}
+
+	free(pages);
+}
@@ -0,0 +1,857 @@
+// page query engine - filters and aggregates the pages of a snapshot
+
+#include "../include/vmsquery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// pages evaluated at once - every atom produces a mask for a whole block
+#define QUERY_BLOCK_SIZE 1024
+
+#define TOKEN_END		0
+#define TOKEN_WORD		1
+#define TOKEN_STRING	2
+#define TOKEN_OP		3
+
+#define MAX_TOKEN_SIZE	64
+
+struct QueryParser
+{
+	const char *start;
+	const char *pos;
+	int type;
+	char token[MAX_TOKEN_SIZE];
+	struct PageQuery *query;
+	int capacity;
+	int depth;
+	int error;
+};
+
+struct QueryFlag
+{
+	const char *name;
+	int type;
+	int field;
+	int cmp;
+	unsigned long value;
+};
+
+static const struct QueryFlag QUERYFLAGS[] =
+{
+	{ "present",	QUERY_OP_FIELD, QUERY_FIELD_PRESENT,	QUERY_GT,	0 },
+	{ "writable",	QUERY_OP_FIELD, QUERY_FIELD_PTE,		QUERY_BITS,	2 },
+	{ "user",		QUERY_OP_FIELD, QUERY_FIELD_PTE,		QUERY_BITS,	4 },
+	{ "accessed",	QUERY_OP_FIELD, QUERY_FIELD_PTE,		QUERY_BITS,	0x20 },
+	{ "dirty",		QUERY_OP_FIELD, QUERY_FIELD_PTE,		QUERY_BITS,	0x40 },
+	{ "nx",			QUERY_OP_FIELD, QUERY_FIELD_PTE,		QUERY_BITS,	1ul<<63 },
+	{ "anon",		QUERY_OP_FIELD, QUERY_FIELD_INODE,		QUERY_EQ,	0 },
+	{ "named",		QUERY_OP_FIELD, QUERY_FIELD_INODE,		QUERY_NE,	0 },
+	{ "shared",		QUERY_OP_FIELD, QUERY_FIELD_REFCOUNT,	QUERY_GT,	1 },
+	{ "zero",		QUERY_OP_ZERO,	0,						0,			0 },
+	{ "heap",		QUERY_OP_HEAP,	0,						0,			0 },
+	{ "stack",		QUERY_OP_STACK,	0,						0,			0 },
+	{ NULL, 0, 0, 0, 0 }
+};
+
+static const char *QUERYFIELDS[] =
+{
+	"pfn",
+	"pte",
+	"flags",
+	"inode",
+	"refcount",
+	"mapcount",
+	"present",
+	NULL
+};
+
+static const char *QUERYCOMPARISONS[] =
+{
+	"==",
+	"!=",
+	"<",
+	"<=",
+	">",
+	">=",
+	"&",
+	"~",
+	NULL
+};
+
+// helper functions for internal use
+static void NextToken(struct QueryParser *parser);
+static int IsToken(struct QueryParser *parser, const char *token);
+static void QueryError(struct QueryParser *parser, const char *message);
+static void EmitOp(struct QueryParser *parser, struct QueryOp *op);
+static void ParseExpression(struct QueryParser *parser);
+static void ParseTerm(struct QueryParser *parser);
+static void ParseFactor(struct QueryParser *parser);
+static void ParseAtom(struct QueryParser *parser);
+static int ParseComparison(struct QueryParser *parser);
+static int IsComparisonNext(struct QueryParser *parser);
+static int ParseHexString(const char *str, unsigned char *result, int size);
+
+static void LoadColumn(int field, const struct PageTableEntryInfo *pages, int n, unsigned long *col);
+static void CompareColumn(int field, int cmp, const unsigned long *col, int n, unsigned long value, unsigned char *mask);
+static unsigned char* CreateVMATable(struct QueryOp *op, VMSNAPSHOT snap);
+static int CompareInodes(const void *a, const void *b);
+
+
+struct PageQuery* CompilePageQuery(const char *query)
+{
+	struct QueryParser parser;
+
+	if (query==NULL)
+		return NULL;
+
+	memset(&parser, 0, sizeof(struct QueryParser));
+	parser.start = query;
+	parser.pos = query;
+	parser.query = (struct PageQuery*) calloc(1, sizeof(struct PageQuery));
+	if (parser.query==NULL)
+	{
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+
+	NextToken(&parser);
+	ParseExpression(&parser);
+
+	if (!parser.error && IsToken(&parser, "group"))
+	{
+		NextToken(&parser);
+		if (!IsToken(&parser, "by"))
+			QueryError(&parser, "by expected");
+		NextToken(&parser);
+		if (IsToken(&parser, "vma"))
+			parser.query->group_by = QUERY_GROUP_VMA;
+		else if (IsToken(&parser, "inode"))
+			parser.query->group_by = QUERY_GROUP_INODE;
+		else
+			QueryError(&parser, "vma or inode expected");
+		NextToken(&parser);
+	}
+
+	if (!parser.error && parser.type!=TOKEN_END)
+		QueryError(&parser, "end of query expected");
+
+	if (parser.error)
+	{
+		ReleasePageQuery(parser.query);
+		return NULL;
+	}
+
+	return parser.query;
+}
+
+void ReleasePageQuery(struct PageQuery *query)
+{
+	if (query!=NULL)
+	{
+		free(query->ops);
+		free(query);
+	}
+}
+
+struct QueryResult* RunPageQuery(struct PageQuery *query, VMSNAPSHOT snap)
+{
+	struct QueryResult *result;
+	struct PageTableEntryInfo *pages;
+	struct QueryOp *op;
+	unsigned char **tables;
+	unsigned char *masks, *mask, *other;
+	unsigned long *col;
+	unsigned int *vma_col, *vma_start;
+	unsigned long *vma_counts = NULL;
+	unsigned long *inodes = NULL, *tmp;
+	unsigned long inode_count = 0, inode_capacity = 0;
+	const unsigned char *zerohash;
+	int hash_size;
+	unsigned long base, record;
+	int needs_vma, n, i, j, sp, v;
+
+	if (query==NULL || snap==NULL)
+		return NULL;
+
+	result		= (struct QueryResult*) calloc(1, sizeof(struct QueryResult));
+	tables		= (unsigned char**) calloc(query->op_count, sizeof(unsigned char*));
+	masks		= (unsigned char*) malloc((query->max_depth+1) * QUERY_BLOCK_SIZE);
+	col			= (unsigned long*) malloc(QUERY_BLOCK_SIZE * sizeof(unsigned long));
+	vma_col		= (unsigned int*) malloc(QUERY_BLOCK_SIZE * sizeof(unsigned int));
+	vma_start	= (unsigned int*) malloc((snap->vm_region_count+1) * sizeof(unsigned int));
+	if (query->group_by==QUERY_GROUP_VMA)
+		vma_counts = (unsigned long*) calloc(snap->vm_region_count+1, sizeof(unsigned long));
+
+	if (result==NULL || tables==NULL || masks==NULL || col==NULL || vma_col==NULL || vma_start==NULL || (query->group_by==QUERY_GROUP_VMA && vma_counts==NULL))
+	{
+		printf("ERROR: Out of memory. (query)\n");
+		goto cleanup;
+	}
+	result->group_by = query->group_by;
+
+	// vma predicates are evaluated once per region
+	needs_vma = query->group_by==QUERY_GROUP_VMA;
+	for (j=0;j<query->op_count;j++)
+	{
+		op = &query->ops[j];
+		if (op->type==QUERY_OP_VMA || op->type==QUERY_OP_HEAP || op->type==QUERY_OP_STACK)
+		{
+			tables[j] = CreateVMATable(op, snap);
+			if (tables[j]==NULL)
+			{
+				printf("ERROR: Out of memory. (query)\n");
+				goto cleanup;
+			}
+			needs_vma = 1;
+		}
+	}
+
+	// first page record of every region - physical snapshots do not set page_start_index
+	record = 0;
+	for (v=0;v<snap->vm_region_count;v++)
+	{
+		if (snap->pid==0)
+		{
+			vma_start[v] = record;
+			record += snap->vms[v].present_page_count;
+		}
+		else
+			vma_start[v] = snap->vms[v].page_start_index;
+	}
+	vma_start[snap->vm_region_count] = snap->available_pages;
+
+	zerohash = GetZeroPageHash(snap->flags);
+	hash_size = GetHashSize(snap->flags);
+	v = 0;
+
+	for (base=0;base<snap->available_pages;base+=QUERY_BLOCK_SIZE)
+	{
+		n = snap->available_pages - base < QUERY_BLOCK_SIZE ? snap->available_pages - base : QUERY_BLOCK_SIZE;
+		pages = &snap->pages[base];
+
+		if (needs_vma)
+		{
+			for (i=0;i<n;i++)
+			{
+				while (v < snap->vm_region_count && base+i >= vma_start[v+1])
+					v++;
+				vma_col[i] = v;
+			}
+		}
+
+		sp = 0;
+		for (j=0;j<query->op_count;j++)
+		{
+			op = &query->ops[j];
+			mask = &masks[sp*QUERY_BLOCK_SIZE];
+			switch (op->type)
+			{
+			case QUERY_OP_FIELD:
+				LoadColumn(op->field, pages, n, col);
+				CompareColumn(op->field, op->cmp, col, n, op->value, mask);
+				sp++;
+				break;
+			case QUERY_OP_VMA:
+			case QUERY_OP_HEAP:
+			case QUERY_OP_STACK:
+				for (i=0;i<n;i++)
+					mask[i] = tables[j][vma_col[i]];
+				sp++;
+				break;
+			case QUERY_OP_HASH:
+				for (i=0;i<n;i++)
+					mask[i] = (memcmp(pages[i].hash, op->hash, op->hash_len)==0) == (op->cmp==QUERY_EQ);
+				sp++;
+				break;
+			case QUERY_OP_ZERO:
+				for (i=0;i<n;i++)
+					mask[i] = memcmp(pages[i].hash, zerohash, hash_size)==0;
+				sp++;
+				break;
+			case QUERY_OP_AND:
+				sp--;
+				mask = &masks[(sp-1)*QUERY_BLOCK_SIZE];
+				other = &masks[sp*QUERY_BLOCK_SIZE];
+				for (i=0;i<n;i++)
+					mask[i] &= other[i];
+				break;
+			case QUERY_OP_OR:
+				sp--;
+				mask = &masks[(sp-1)*QUERY_BLOCK_SIZE];
+				other = &masks[sp*QUERY_BLOCK_SIZE];
+				for (i=0;i<n;i++)
+					mask[i] |= other[i];
+				break;
+			case QUERY_OP_NOT:
+				mask = &masks[(sp-1)*QUERY_BLOCK_SIZE];
+				for (i=0;i<n;i++)
+					mask[i] ^= 1;
+				break;
+			}
+		}
+
+		// aggregate the final mask
+		mask = masks;
+		if (query->op_count==0)
+			memset(mask, 1, n);
+
+		for (i=0;i<n;i++)
+			result->matched += mask[i];
+
+		if (query->group_by==QUERY_GROUP_VMA)
+		{
+			for (i=0;i<n;i++)
+				vma_counts[vma_col[i]] += mask[i];
+		}
+		else if (query->group_by==QUERY_GROUP_INODE)
+		{
+			for (i=0;i<n;i++)
+			{
+				if (!mask[i])
+					continue;
+				if (inode_count==inode_capacity)
+				{
+					inode_capacity = inode_capacity ? inode_capacity*2 : QUERY_BLOCK_SIZE;
+					tmp = (unsigned long*) realloc(inodes, inode_capacity * sizeof(unsigned long));
+					if (tmp==NULL)
+					{
+						printf("ERROR: Out of memory. (query)\n");
+						goto cleanup;
+					}
+					inodes = tmp;
+				}
+				inodes[inode_count++] = pages[i].inode_no;
+			}
+		}
+	}
+	result->scanned = snap->available_pages;
+
+	// build groups
+	if (query->group_by==QUERY_GROUP_VMA)
+	{
+		result->groups = (struct QueryGroup*) calloc(snap->vm_region_count+1, sizeof(struct QueryGroup));
+		if (result->groups==NULL)
+			goto cleanup;
+		for (v=0;v<snap->vm_region_count;v++)
+		{
+			if (vma_counts[v]==0)
+				continue;
+			result->groups[result->group_count].key = v;
+			result->groups[result->group_count].count = vma_counts[v];
+			result->group_count++;
+		}
+	}
+	else if (query->group_by==QUERY_GROUP_INODE && inode_count>0)
+	{
+		qsort(inodes, inode_count, sizeof(unsigned long), CompareInodes);
+		result->groups = (struct QueryGroup*) calloc(inode_count, sizeof(struct QueryGroup));
+		if (result->groups==NULL)
+			goto cleanup;
+		for (base=0;base<inode_count;base++)
+		{
+			if (base==0 || inodes[base]!=inodes[base-1])
+			{
+				result->groups[result->group_count].key = inodes[base];
+				result->group_count++;
+			}
+			result->groups[result->group_count-1].count++;
+		}
+	}
+
+	for (j=0;j<query->op_count;j++)
+		free(tables[j]);
+	free(tables);
+	free(masks);
+	free(col);
+	free(vma_col);
+	free(vma_start);
+	free(vma_counts);
+	free(inodes);
+
+	return result;
+
+cleanup:
+	if (tables!=NULL)
+	{
+		for (j=0;j<query->op_count;j++)
+			free(tables[j]);
+	}
+	free(tables);
+	free(masks);
+	free(col);
+	free(vma_col);
+	free(vma_start);
+	free(vma_counts);
+	free(inodes);
+	ReleaseQueryResult(result);
+	return NULL;
+}
+
+void ReleaseQueryResult(struct QueryResult *result)
+{
+	if (result!=NULL)
+	{
+		free(result->groups);
+		free(result);
+	}
+}
+
+void PrintQueryResult(VMSNAPSHOT snap, struct QueryResult *result)
+{
+	struct VirtualMemoryInfo *vma;
+	int i;
+
+	if (snap==NULL || result==NULL)
+		return;
+
+	printf("scanned;matched;\n");
+	printf("%lu;%lu;\n", result->scanned, result->matched);
+
+	if (result->group_by==QUERY_GROUP_VMA)
+	{
+		printf("vma;start;end;name;matched;\n");
+		for (i=0;i<result->group_count;i++)
+		{
+			vma = &snap->vms[result->groups[i].key];
+			printf("%lu;%lx;%lx;%s;%lu;\n", result->groups[i].key, vma->start_address, vma->end_address, vma->file_name, result->groups[i].count);
+		}
+	}
+	else if (result->group_by==QUERY_GROUP_INODE)
+	{
+		printf("inode;matched;\n");
+		for (i=0;i<result->group_count;i++)
+			printf("%lu;%lu;\n", result->groups[i].key, result->groups[i].count);
+	}
+}
+
+// for internal use only
+static void NextToken(struct QueryParser *parser)
+{
+	const char *p = parser->pos;
+	int len = 0;
+	int i;
+
+	while (isspace((unsigned char)*p))
+		p++;
+
+	parser->token[0] = '\0';
+	if (*p=='\0')
+	{
+		parser->type = TOKEN_END;
+	}
+	else if (isalnum((unsigned char)*p) || *p=='_')
+	{
+		while ((isalnum((unsigned char)*p) || *p=='_') && len < MAX_TOKEN_SIZE-1)
+			parser->token[len++] = *p++;
+		parser->type = TOKEN_WORD;
+	}
+	else if (*p=='"')
+	{
+		p++;
+		while (*p!='\0' && *p!='"' && len < MAX_TOKEN_SIZE-1)
+			parser->token[len++] = *p++;
+		if (*p=='"')
+			p++;
+		parser->type = TOKEN_STRING;
+	}
+	else
+	{
+		// two character operators first
+		static const char *OPERATORS[] = { "&&", "||", "==", "!=", "<=", ">=", "!", "(", ")", "<", ">", "&", "~", "=", NULL };
+		parser->type = TOKEN_OP;
+		for (i=0;OPERATORS[i]!=NULL;i++)
+		{
+			len = strlen(OPERATORS[i]);
+			if (strncmp(p, OPERATORS[i], len)==0)
+				break;
+		}
+		if (OPERATORS[i]==NULL)
+		{
+			len = 1;
+			parser->pos = p;
+			QueryError(parser, "unknown character");
+		}
+		// single = is accepted as ==
+		if (len==1 && *p=='=')
+		{
+			strcpy(parser->token, "==");
+			p++;
+			len = 2;
+		}
+		else
+		{
+			strncpy(parser->token, p, len);
+			p += len;
+		}
+	}
+	parser->token[len] = '\0';
+	parser->pos = p;
+}
+
+static int IsToken(struct QueryParser *parser, const char *token)
+{
+	return parser->type!=TOKEN_END && parser->type!=TOKEN_STRING && strcmp(parser->token, token)==0;
+}
+
+static void QueryError(struct QueryParser *parser, const char *message)
+{
+	if (!parser->error)
+		printf("Query error at position %d (%s): %s\n", (int)(parser->pos - parser->start), parser->token, message);
+	parser->error = 1;
+}
+
+static void EmitOp(struct QueryParser *parser, struct QueryOp *op)
+{
+	struct PageQuery *query = parser->query;
+	struct QueryOp *ops;
+
+	if (parser->error)
+		return;
+
+	if (query->op_count==parser->capacity)
+	{
+		parser->capacity = parser->capacity ? parser->capacity*2 : 16;
+		ops = (struct QueryOp*) realloc(query->ops, parser->capacity * sizeof(struct QueryOp));
+		if (ops==NULL)
+		{
+			QueryError(parser, "out of memory");
+			return;
+		}
+		query->ops = ops;
+	}
+	query->ops[query->op_count++] = *op;
+
+	// track the mask stack
+	if (op->type==QUERY_OP_AND || op->type==QUERY_OP_OR)
+		parser->depth--;
+	else if (op->type!=QUERY_OP_NOT)
+		parser->depth++;
+	if (parser->depth > query->max_depth)
+		query->max_depth = parser->depth;
+}
+
+static void ParseExpression(struct QueryParser *parser)
+{
+	struct QueryOp op;
+
+	memset(&op, 0, sizeof(struct QueryOp));
+	op.type = QUERY_OP_OR;
+
+	ParseTerm(parser);
+	while (!parser->error && IsToken(parser, "||"))
+	{
+		NextToken(parser);
+		ParseTerm(parser);
+		EmitOp(parser, &op);
+	}
+}
+
+static void ParseTerm(struct QueryParser *parser)
+{
+	struct QueryOp op;
+
+	memset(&op, 0, sizeof(struct QueryOp));
+	op.type = QUERY_OP_AND;
+
+	ParseFactor(parser);
+	while (!parser->error && IsToken(parser, "&&"))
+	{
+		NextToken(parser);
+		ParseFactor(parser);
+		EmitOp(parser, &op);
+	}
+}
+
+static void ParseFactor(struct QueryParser *parser)
+{
+	struct QueryOp op;
+
+	if (parser->error)
+		return;
+
+	if (IsToken(parser, "!"))
+	{
+		memset(&op, 0, sizeof(struct QueryOp));
+		op.type = QUERY_OP_NOT;
+		NextToken(parser);
+		ParseFactor(parser);
+		EmitOp(parser, &op);
+	}
+	else if (IsToken(parser, "("))
+	{
+		NextToken(parser);
+		ParseExpression(parser);
+		if (!IsToken(parser, ")"))
+			QueryError(parser, ") expected");
+		NextToken(parser);
+	}
+	else
+		ParseAtom(parser);
+}
+
+static void ParseAtom(struct QueryParser *parser)
+{
+	struct QueryOp op;
+	char *end;
+	int i;
+
+	if (parser->type!=TOKEN_WORD)
+	{
+		QueryError(parser, "flag or field expected");
+		return;
+	}
+
+	memset(&op, 0, sizeof(struct QueryOp));
+
+	// a flag followed by a comparison is parsed as the field of the same name, e.g. present > 0
+	for (i=0;QUERYFLAGS[i].name!=NULL && !IsComparisonNext(parser);i++)
+	{
+		if (strcmp(parser->token, QUERYFLAGS[i].name)==0)
+		{
+			op.type		= QUERYFLAGS[i].type;
+			op.field	= QUERYFLAGS[i].field;
+			op.cmp		= QUERYFLAGS[i].cmp;
+			op.value	= QUERYFLAGS[i].value;
+			NextToken(parser);
+			EmitOp(parser, &op);
+			return;
+		}
+	}
+
+	if (strcmp(parser->token, "vma")==0)
+	{
+		NextToken(parser);
+		op.type = QUERY_OP_VMA;
+		op.cmp = ParseComparison(parser);
+		if (op.cmp!=QUERY_EQ && op.cmp!=QUERY_NE && op.cmp!=QUERY_CONTAINS)
+			QueryError(parser, "vma supports ==, != and ~");
+		if (parser->type!=TOKEN_STRING && parser->type!=TOKEN_WORD)
+			QueryError(parser, "name expected");
+		snprintf(op.text, sizeof(op.text), "%s", parser->token);
+		NextToken(parser);
+		EmitOp(parser, &op);
+		return;
+	}
+
+	if (strcmp(parser->token, "hash")==0)
+	{
+		NextToken(parser);
+		op.type = QUERY_OP_HASH;
+		op.cmp = ParseComparison(parser);
+		if (op.cmp!=QUERY_EQ && op.cmp!=QUERY_NE)
+			QueryError(parser, "hash supports == and !=");
+		op.hash_len = ParseHexString(parser->token, op.hash, 20);
+		if (op.hash_len<=0)
+			QueryError(parser, "hexadecimal hash expected");
+		NextToken(parser);
+		EmitOp(parser, &op);
+		return;
+	}
+
+	for (i=0;QUERYFIELDS[i]!=NULL;i++)
+	{
+		if (strcmp(parser->token, QUERYFIELDS[i])==0)
+		{
+			NextToken(parser);
+			op.type = QUERY_OP_FIELD;
+			op.field = i;
+			op.cmp = ParseComparison(parser);
+			if (op.cmp==QUERY_CONTAINS)
+				QueryError(parser, "~ is only supported by vma");
+			op.value = strtoul(parser->token, &end, 0);
+			if (parser->type!=TOKEN_WORD || *end!='\0')
+				QueryError(parser, "number expected");
+			NextToken(parser);
+			EmitOp(parser, &op);
+			return;
+		}
+	}
+
+	QueryError(parser, "unknown flag or field");
+}
+
+static int ParseComparison(struct QueryParser *parser)
+{
+	int i;
+
+	if (parser->type==TOKEN_OP)
+	{
+		for (i=0;QUERYCOMPARISONS[i]!=NULL;i++)
+		{
+			if (strcmp(parser->token, QUERYCOMPARISONS[i])==0)
+			{
+				NextToken(parser);
+				return i;
+			}
+		}
+	}
+	QueryError(parser, "comparison expected");
+	return -1;
+}
+
+// looks at the next token without consuming it
+static int IsComparisonNext(struct QueryParser *parser)
+{
+	const char *p = parser->pos;
+
+	while (isspace((unsigned char)*p))
+		p++;
+	if (p[0]=='&')
+		return p[1]!='&';
+	if (p[0]=='!')
+		return p[1]=='=';
+	return p[0]=='=' || p[0]=='<' || p[0]=='>' || p[0]=='~';
+}
+
+// returns the amount of bytes or -1
+static int ParseHexString(const char *str, unsigned char *result, int size)
+{
+	int len = strlen(str);
+	int i;
+	unsigned int byte;
+
+	if (len==0 || len%2 || len/2 > size)
+		return -1;
+	for (i=0;i<len/2;i++)
+	{
+		if (!isxdigit((unsigned char)str[2*i]) || !isxdigit((unsigned char)str[2*i+1]) || sscanf(&str[2*i], "%2x", &byte)!=1)
+			return -1;
+		result[i] = byte;
+	}
+	return len/2;
+}
+
+// copies a field of every page of the block into col
+static void LoadColumn(int field, const struct PageTableEntryInfo *pages, int n, unsigned long *col)
+{
+	int i;
+
+	switch (field)
+	{
+	case QUERY_FIELD_PFN:
+		for (i=0;i<n;i++)
+			col[i] = pages[i].pfn;
+		break;
+	case QUERY_FIELD_PTE:
+		for (i=0;i<n;i++)
+			col[i] = pages[i].pte_flags;
+		break;
+	case QUERY_FIELD_FLAGS:
+		for (i=0;i<n;i++)
+			col[i] = pages[i].page_flags;
+		break;
+	case QUERY_FIELD_INODE:
+		for (i=0;i<n;i++)
+			col[i] = pages[i].inode_no;
+		break;
+	case QUERY_FIELD_REFCOUNT:
+		for (i=0;i<n;i++)
+			col[i] = (long) pages[i].reference_count;
+		break;
+	case QUERY_FIELD_MAPCOUNT:
+		for (i=0;i<n;i++)
+			col[i] = (long) pages[i].mapping_count;
+		break;
+	case QUERY_FIELD_PRESENT:
+		for (i=0;i<n;i++)
+			col[i] = (long) pages[i].present;
+		break;
+	}
+}
+
+#define COMPARE_LOOP(type, op) \
+	for (i=0;i<n;i++) \
+		mask[i] = (type)col[i] op (type)value;
+
+// counters are signed, all other fields are compared unsigned
+static void CompareColumn(int field, int cmp, const unsigned long *col, int n, unsigned long value, unsigned char *mask)
+{
+	int is_signed = field==QUERY_FIELD_REFCOUNT || field==QUERY_FIELD_MAPCOUNT || field==QUERY_FIELD_PRESENT;
+	int i;
+
+	switch (cmp)
+	{
+	case QUERY_EQ:
+		COMPARE_LOOP(unsigned long, ==)
+		break;
+	case QUERY_NE:
+		COMPARE_LOOP(unsigned long, !=)
+		break;
+	case QUERY_LT:
+		if (is_signed)
+			COMPARE_LOOP(long, <)
+		else
+			COMPARE_LOOP(unsigned long, <)
+		break;
+	case QUERY_LE:
+		if (is_signed)
+			COMPARE_LOOP(long, <=)
+		else
+			COMPARE_LOOP(unsigned long, <=)
+		break;
+	case QUERY_GT:
+		if (is_signed)
+			COMPARE_LOOP(long, >)
+		else
+			COMPARE_LOOP(unsigned long, >)
+		break;
+	case QUERY_GE:
+		if (is_signed)
+			COMPARE_LOOP(long, >=)
+		else
+			COMPARE_LOOP(unsigned long, >=)
+		break;
+	case QUERY_BITS:
+		for (i=0;i<n;i++)
+			mask[i] = (col[i] & value)!=0;
+		break;
+	}
+}
+
+// evaluates a vma predicate for every region - the additional entry is used for pages without region
+static unsigned char* CreateVMATable(struct QueryOp *op, VMSNAPSHOT snap)
+{
+	struct VirtualMemoryInfo *vma;
+	unsigned char *table;
+	int v;
+
+	table = (unsigned char*) calloc(snap->vm_region_count+1, 1);
+	if (table==NULL)
+		return NULL;
+
+	for (v=0;v<snap->vm_region_count;v++)
+	{
+		vma = &snap->vms[v];
+		switch (op->type)
+		{
+		case QUERY_OP_VMA:
+			if (op->cmp==QUERY_CONTAINS)
+				table[v] = strstr(vma->file_name, op->text)!=NULL;
+			else
+				table[v] = (strncmp(vma->file_name, op->text, DNAME_INLINE_LEN_MAX)==0) == (op->cmp==QUERY_EQ);
+			break;
+		case QUERY_OP_HEAP:
+			table[v] = vma->file_name[0]==HEAP_MARK || (snap->pid!=0 && snap->heap_start>=vma->start_address && snap->heap_start<vma->end_address);
+			break;
+		case QUERY_OP_STACK:
+			table[v] = vma->file_name[0]==STACK_MARK || (snap->pid!=0 && snap->stack_start>=vma->start_address && snap->stack_start<vma->end_address);
+			break;
+		}
+	}
+
+	return table;
+}
+
+static int CompareInodes(const void *a, const void *b)
+{
+	unsigned long i1 = *(const unsigned long*) a;
+	unsigned long i2 = *(const unsigned long*) b;
+
+	if (i1 > i2)
+		return 1;
+	else if (i1 < i2)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,266 @@
+// per file sharing report - interned files and file pairs of the dedup tuples
+
+#include "../include/vmsreport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPORT_INITIAL_BUCKETS 256
+
+// helper functions for internal use
+static uint64_t HashFile(unsigned long inode, const char *name);
+static int GrowBuckets(struct FileReport *report);
+static unsigned int InternFile(struct FileReport *report, unsigned long inode, const char *name);
+static int CompareUInt64(const void *a, const void *b);
+static int ComparePairs(const void *a, const void *b);
+
+
+struct FileReport* CreateFileReport()
+{
+	struct FileReport *report;
+
+	report = (struct FileReport*) calloc(1, sizeof(struct FileReport));
+	if (report==NULL)
+		return NULL;
+
+	if (GrowBuckets(report)!=0)
+	{
+		free(report);
+		return NULL;
+	}
+	return report;
+}
+
+void ReleaseFileReport(struct FileReport *report)
+{
+	if (report==NULL)
+		return;
+
+	free(report->files);
+	free(report->buckets);
+	free(report->chain);
+	free(report->pair_keys);
+	free(report->pairs);
+	free(report);
+}
+
+int AddSnapshotFiles(struct FileReport *report, VMSNAPSHOT snap, unsigned int *vma_files)
+{
+	struct VirtualMemoryInfo *vma;
+	int i;
+
+	if (report==NULL || snap==NULL || vma_files==NULL)
+		return -1;
+
+	for (i=0;i<snap->vm_region_count;i++)
+	{
+		vma = &snap->vms[i];
+		vma_files[i] = InternFile(report, vma->inode_number, GetRegionName(vma));
+		if (vma_files[i]==REPORT_NO_FILE)
+		{
+			printf("ERROR: Out of memory. (files)\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int AddFilePair(struct FileReport *report, unsigned int file, unsigned int first)
+{
+	unsigned long capacity;
+	uint64_t *keys;
+
+	if (report->pair_key_count == report->pair_key_capacity)
+	{
+		capacity = report->pair_key_capacity==0 ? 4096 : report->pair_key_capacity * 2;
+		keys = (uint64_t*) realloc(report->pair_keys, capacity * sizeof(uint64_t));
+		if (keys==NULL)
+		{
+			report->failed = 1;
+			return -1;
+		}
+		report->pair_keys = keys;
+		report->pair_key_capacity = capacity;
+	}
+
+	report->pair_keys[report->pair_key_count++] = (uint64_t)first << 32 | file;
+	return 0;
+}
+
+int FinishFileReport(struct FileReport *report)
+{
+	struct FilePairSharing *pairs;
+	unsigned long i, count = 0;
+
+	if (report==NULL || report->failed)
+		return -1;
+
+	// equal pairs are neighbours after sorting the keys
+	qsort(report->pair_keys, report->pair_key_count, sizeof(uint64_t), CompareUInt64);
+	for (i=0;i<report->pair_key_count;i++)
+		if (i==0 || report->pair_keys[i]!=report->pair_keys[i-1])
+			count++;
+
+	pairs = (struct FilePairSharing*) realloc(report->pairs, (count+1) * sizeof(struct FilePairSharing));
+	if (pairs==NULL)
+		return -1;
+	report->pairs = pairs;
+	report->pair_count = 0;
+
+	for (i=0;i<report->pair_key_count;i++)
+	{
+		if (i==0 || report->pair_keys[i]!=report->pair_keys[i-1])
+		{
+			pairs[report->pair_count].first = report->pair_keys[i] >> 32;
+			pairs[report->pair_count].file = report->pair_keys[i] & 0xffffffff;
+			pairs[report->pair_count].shareable = 0;
+			report->pair_count++;
+		}
+		pairs[report->pair_count-1].shareable++;
+	}
+	qsort(pairs, report->pair_count, sizeof(struct FilePairSharing), ComparePairs);
+
+	free(report->pair_keys);
+	report->pair_keys = NULL;
+	report->pair_key_count = 0;
+	report->pair_key_capacity = 0;
+	return 0;
+}
+
+void PrintFileReport(struct FileReport *report, int top)
+{
+	struct FileSharing *file, *first;
+	unsigned int *order, i, j, best, tmp;
+	unsigned long p;
+
+	if (report==NULL)
+		return;
+	if (top <= 0)
+		top = REPORT_DEFAULT_TOP;
+
+	order = (unsigned int*) malloc((report->file_count+1) * sizeof(unsigned int));
+	if (order==NULL)
+		return;
+	for (i=0;i<report->file_count;i++)
+		order[i] = i;
+
+	// only the top rows are sorted
+	printf("file;inode;pages;shareable;shared;sharing op;\n");
+	for (i=0;i<report->file_count && i<(unsigned int)top;i++)
+	{
+		best = i;
+		for (j=i+1;j<report->file_count;j++)
+			if (report->files[order[j]].shareable > report->files[order[best]].shareable)
+				best = j;
+		tmp = order[i];
+		order[i] = order[best];
+		order[best] = tmp;
+
+		file = &report->files[order[i]];
+		printf("%s;%lu;%lu;%lu;%lu;%lu;\n", file->file_name, file->inode, file->pages, file->shareable, file->shared, file->sharing_op);
+	}
+	free(order);
+
+	printf("\nfile;first file;shareable;\n");
+	for (p=0;p<report->pair_count && p<(unsigned long)top;p++)
+	{
+		file = &report->files[report->pairs[p].file];
+		first = &report->files[report->pairs[p].first];
+		printf("%s;%s;%lu;\n", file->file_name, first->file_name, report->pairs[p].shareable);
+	}
+}
+
+// for internal use only
+static uint64_t HashFile(unsigned long inode, const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ull ^ inode;
+	int i;
+
+	// FNV-1a over the stored part, names of the snapshot are not terminated if they fill the field
+	for (i=0;i<DNAME_INLINE_LEN_MAX-1 && name[i];i++)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 0x100000001b3ull;
+	}
+	return h ^ (h >> 32);
+}
+
+// doubles the buckets and the room for files, keeps less than one file per bucket
+static int GrowBuckets(struct FileReport *report)
+{
+	unsigned int count = report->bucket_count==0 ? REPORT_INITIAL_BUCKETS : report->bucket_count * 2;
+	struct FileSharing *files;
+	unsigned int *buckets, *chain, i, b;
+
+	buckets = (unsigned int*) malloc(count * sizeof(unsigned int));
+	chain = (unsigned int*) realloc(report->chain, count * sizeof(unsigned int));
+	if (chain!=NULL)
+		report->chain = chain;
+	files = (struct FileSharing*) realloc(report->files, count * sizeof(struct FileSharing));
+	if (files!=NULL)
+		report->files = files;
+	if (buckets==NULL || chain==NULL || files==NULL)
+	{
+		free(buckets);
+		return -1;
+	}
+
+	for (b=0;b<count;b++)
+		buckets[b] = REPORT_NO_FILE;
+	for (i=0;i<report->file_count;i++)
+	{
+		b = HashFile(files[i].inode, files[i].file_name) & (count-1);
+		chain[i] = buckets[b];
+		buckets[b] = i;
+	}
+
+	free(report->buckets);
+	report->buckets = buckets;
+	report->bucket_count = count;
+	report->file_capacity = count;
+	return 0;
+}
+
+static unsigned int InternFile(struct FileReport *report, unsigned long inode, const char *name)
+{
+	struct FileSharing *file;
+	unsigned int i, b;
+
+	b = HashFile(inode, name) & (report->bucket_count-1);
+	for (i=report->buckets[b];i!=REPORT_NO_FILE;i=report->chain[i])
+		if (report->files[i].inode==inode && strncmp(report->files[i].file_name, name, DNAME_INLINE_LEN_MAX-1)==0)
+			return i;
+
+	if (report->file_count == report->file_capacity)
+	{
+		if (GrowBuckets(report)!=0)
+			return REPORT_NO_FILE;
+		b = HashFile(inode, name) & (report->bucket_count-1);
+	}
+
+	i = report->file_count++;
+	file = &report->files[i];
+	memset(file, 0, sizeof(struct FileSharing));
+	file->inode = inode;
+	strncpy(file->file_name, name, DNAME_INLINE_LEN_MAX-1);
+	report->chain[i] = report->buckets[b];
+	report->buckets[b] = i;
+	return i;
+}
+
+static int CompareUInt64(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t*) a;
+	uint64_t kb = *(const uint64_t*) b;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static int ComparePairs(const void *a, const void *b)
+{
+	const struct FilePairSharing *pa = (const struct FilePairSharing*) a;
+	const struct FilePairSharing *pb = (const struct FilePairSharing*) b;
+
+	return pa->shareable > pb->shareable ? -1 : pa->shareable < pb->shareable;
+}
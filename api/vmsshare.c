@@ -0,0 +1,287 @@
+// pairwise sharing - sharing matrix of many snapshots in one pass
+
+#include "../include/vmsshare.h"
+#include "../include/vmsdedup.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIGNATURE_BUFFER_FACTOR 8 // candidates collected per signature hash before pruning
+
+/// bottom-k MinHash signature: the smallest distinct content hashes of a snapshot
+struct Signature
+{
+	uint64_t *hashes; // sorted ascending
+	int size; // < signature size if the snapshot has less contents
+	unsigned long pages;
+};
+
+// helper functions for internal use
+static struct SharingMatrix* CreateSharingMatrix(int count);
+static int CompareHashValue(const void *a, const void *b);
+static int PruneSignature(uint64_t *hashes, int used, int size);
+static int BuildSignature(VMSNAPSHOT snap, struct Signature *sig, int size);
+static double EstimateContents(const struct Signature *sig, int size);
+static double EstimateSharedContents(const struct Signature *a, const struct Signature *b, int size);
+
+
+struct SharingMatrix* ComputeSharingMatrix(VMSNAPSHOT *snaps, int count, int thread_count)
+{
+	struct SharingMatrix *matrix;
+	struct DedupTuple *tuples, *tmp, *sorted;
+	struct CollisionInfo info;
+	unsigned long total = 0, used = 0, start, end, i;
+	unsigned long *pages;
+	int *members;
+	int member_count, a, b, snap_no;
+
+	if (snaps==NULL)
+		return NULL;
+	for (a=0;a<count;a++)
+	{
+		if (snaps[a]==NULL)
+			return NULL;
+		total += snaps[a]->available_pages;
+	}
+
+	matrix = CreateSharingMatrix(count);
+	tuples = (struct DedupTuple*) malloc((total+1) * sizeof(struct DedupTuple));
+	tmp = (struct DedupTuple*) malloc((total+1) * sizeof(struct DedupTuple));
+	pages = (unsigned long*) calloc(count, sizeof(unsigned long));
+	members = (int*) malloc(count * sizeof(int));
+	if (matrix==NULL || tuples==NULL || tmp==NULL || pages==NULL || members==NULL)
+	{
+		printf("Could not allocate %lu page tuples.\n", total);
+		ReleaseSharingMatrix(matrix);
+		matrix = NULL;
+		goto out;
+	}
+
+	memset(&info, 0, sizeof(struct CollisionInfo));
+	for (a=0;a<count;a++)
+		used += FillDedupTuples(snaps[a], a, &tuples[used], &info);
+
+	sorted = RadixSortDedupTuples(tuples, tmp, used, DEDUP_SORT_HASH, thread_count);
+	if (sorted==NULL)
+	{
+		ReleaseSharingMatrix(matrix);
+		matrix = NULL;
+		goto out;
+	}
+
+	for (start=0;start<used;start=end)
+	{
+		end = NextHashRun(sorted, used, start);
+
+		// counts the pages of every snapshot in the run of one content
+		member_count = 0;
+		for (i=start;i<end;i++)
+		{
+			snap_no = sorted[i].seq >> 32;
+			if (pages[snap_no]++ == 0)
+				members[member_count++] = snap_no;
+		}
+
+		for (a=0;a<member_count;a++)
+		{
+			for (b=0;b<member_count;b++)
+				matrix->pages[members[a]*count + members[b]] += pages[members[a]];
+		}
+		for (a=0;a<member_count;a++)
+			pages[members[a]] = 0;
+	}
+
+out:
+	free(tuples);
+	free(tmp);
+	free(pages);
+	free(members);
+	return matrix;
+}
+
+struct SharingMatrix* EstimateSharingMatrix(VMSNAPSHOT *snaps, int count, int signature_size)
+{
+	struct SharingMatrix *matrix;
+	struct Signature *sigs;
+	double contents, shared;
+	int a, b;
+
+	if (snaps==NULL)
+		return NULL;
+	if (signature_size <= 0)
+		signature_size = SHARE_DEFAULT_SIGNATURE;
+
+	matrix = CreateSharingMatrix(count);
+	sigs = (struct Signature*) calloc(count, sizeof(struct Signature));
+	if (matrix==NULL || sigs==NULL)
+	{
+		ReleaseSharingMatrix(matrix);
+		free(sigs);
+		return NULL;
+	}
+
+	for (a=0;a<count;a++)
+	{
+		if (snaps[a]==NULL || BuildSignature(snaps[a], &sigs[a], signature_size)!=0)
+		{
+			ReleaseSharingMatrix(matrix);
+			matrix = NULL;
+			break;
+		}
+	}
+
+	for (a=0;a<count && matrix!=NULL;a++)
+	{
+		matrix->pages[a*count + a] = sigs[a].pages;
+		contents = EstimateContents(&sigs[a], signature_size);
+		if (contents <= 0)
+			continue;
+
+		for (b=0;b<count;b++)
+		{
+			if (a==b)
+				continue;
+			shared = EstimateSharedContents(&sigs[a], &sigs[b], signature_size);
+			if (shared > contents)
+				shared = contents;
+			matrix->pages[a*count + b] = (unsigned long)(shared * sigs[a].pages / contents + 0.5);
+		}
+	}
+
+	for (a=0;a<count;a++)
+		free(sigs[a].hashes);
+	free(sigs);
+	return matrix;
+}
+
+void ReleaseSharingMatrix(struct SharingMatrix *matrix)
+{
+	if (matrix==NULL)
+		return;
+
+	free(matrix->pages);
+	free(matrix);
+}
+
+// for internal use only
+static struct SharingMatrix* CreateSharingMatrix(int count)
+{
+	struct SharingMatrix *matrix;
+
+	if (count <= 0)
+		return NULL;
+
+	matrix = (struct SharingMatrix*) malloc(sizeof(struct SharingMatrix));
+	if (matrix==NULL)
+		return NULL;
+	matrix->pages = (unsigned long*) calloc((unsigned long)count * count, sizeof(unsigned long));
+	if (matrix->pages==NULL)
+	{
+		free(matrix);
+		return NULL;
+	}
+	matrix->count = count;
+
+	return matrix;
+}
+
+static int CompareHashValue(const void *a, const void *b)
+{
+	uint64_t ha = *(const uint64_t*) a;
+	uint64_t hb = *(const uint64_t*) b;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+// sorts the collected hashes and keeps the smallest size distinct ones
+static int PruneSignature(uint64_t *hashes, int used, int size)
+{
+	int i, kept = 0;
+
+	qsort(hashes, used, sizeof(uint64_t), CompareHashValue);
+	for (i=0;i<used && kept<size;i++)
+		if (kept==0 || hashes[i]!=hashes[kept-1])
+			hashes[kept++] = hashes[i];
+
+	return kept;
+}
+
+// hashes above the largest kept one can not enter the signature, so most pages are skipped
+static int BuildSignature(VMSNAPSHOT snap, struct Signature *sig, int size)
+{
+	uint64_t *hashes, h, limit = UINT64_MAX;
+	int capacity = size * SIGNATURE_BUFFER_FACTOR;
+	int used = 0;
+	int hash_size = GetHashSize(snap->flags);
+	unsigned char key[HASH_KEY_SIZE];
+	unsigned long i;
+
+	hashes = (uint64_t*) malloc(capacity * sizeof(uint64_t));
+	if (hashes==NULL)
+		return -1;
+
+	sig->pages = 0;
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (snap->pages[i].present <= 0)
+			continue;
+		sig->pages++;
+
+		BuildContentKey(snap->pages[i].hash, hash_size, key);
+		h = HashContentKey(key);
+		if (h > limit)
+			continue;
+
+		hashes[used++] = h;
+		if (used==capacity)
+		{
+			used = PruneSignature(hashes, used, size);
+			if (used==size)
+				limit = hashes[size-1];
+		}
+	}
+
+	sig->size = PruneSignature(hashes, used, size);
+	sig->hashes = hashes;
+	return 0;
+}
+
+// distinct contents of a snapshot, exact if the signature is not full
+static double EstimateContents(const struct Signature *sig, int size)
+{
+	if (sig->size < size)
+		return sig->size;
+	return (size - 1) / ((double)sig->hashes[size-1] / (double)UINT64_MAX);
+}
+
+// walks the smallest size hashes of the union, the fraction found in both signatures
+// estimates the Jaccard similarity of the contents
+static double EstimateSharedContents(const struct Signature *a, const struct Signature *b, int size)
+{
+	int exact = a->size < size && b->size < size;
+	int i = 0, j = 0, taken = 0, both = 0;
+	uint64_t last = 0;
+
+	while ((taken < size || exact) && (i < a->size || j < b->size))
+	{
+		if (j >= b->size || (i < a->size && a->hashes[i] < b->hashes[j]))
+			last = a->hashes[i++];
+		else if (i >= a->size || b->hashes[j] < a->hashes[i])
+			last = b->hashes[j++];
+		else
+		{
+			last = a->hashes[i++];
+			j++;
+			both++;
+		}
+		taken++;
+	}
+
+	// both signatures hold all contents, so the union is exact
+	if (taken < size || exact)
+		return both;
+
+	return (double)both / taken * (size - 1) / ((double)last / (double)UINT64_MAX);
+}
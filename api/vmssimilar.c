@@ -0,0 +1,230 @@
+// near-duplicate pages - LSH index over the page sketches
+
+#include "../include/vmssimilar.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+struct SketchNode
+{
+	uint64_t key; // content key of the page hash
+	uint64_t sketch;
+	unsigned long pages;
+};
+
+// helper functions for internal use
+static int CompareNodes(const void *a, const void *b);
+static int CompareUInt64(const void *a, const void *b);
+static unsigned int FindRoot(unsigned int *parent, unsigned int n);
+static unsigned long EstimateDelta(int distance);
+
+
+int FindNearDuplicates(VMSNAPSHOT *snaps, int count, int max_distance, struct SimilarityInfo *info)
+{
+	const unsigned char *zerohash;
+	unsigned char key[HASH_KEY_SIZE];
+	struct SketchNode *nodes;
+	unsigned int *parent, *size;
+	unsigned char *nearest;
+	uint64_t *band_keys;
+	unsigned long total = 0, used = 0, n, i, j, k, start;
+	int hash_size, bands, band_bits, band, distance, s;
+	unsigned int a, other, ra, rb;
+
+	if (snaps==NULL || count <= 0 || info==NULL)
+		return -1;
+	if (max_distance <= 0)
+		max_distance = SIMILAR_DEFAULT_DISTANCE;
+	if (max_distance > SIMILAR_MAX_DISTANCE)
+		max_distance = SIMILAR_MAX_DISTANCE;
+
+	for (s=0;s<count;s++)
+	{
+		if (!(snaps[s]->flags & VMS_SKETCH_SIMHASH))
+		{
+			printf("The snapshots were not taken with similarity sketches.\n");
+			return -1;
+		}
+		total += snaps[s]->available_pages;
+	}
+	memset(info, 0, sizeof(struct SimilarityInfo));
+
+	nodes = (struct SketchNode*) malloc((total+1) * sizeof(struct SketchNode));
+	if (nodes==NULL)
+	{
+		printf("ERROR: Out of memory. (nodes)\n");
+		return -1;
+	}
+
+	// one node per distinct content
+	for (s=0;s<count;s++)
+	{
+		hash_size = GetHashSize(snaps[s]->flags);
+		zerohash = GetZeroPageHash(snaps[s]->flags);
+		for (i=0;i<snaps[s]->available_pages;i++)
+		{
+			if (snaps[s]->pages[i].present <= 0 || memcmp(snaps[s]->pages[i].hash, zerohash, hash_size)==0)
+				continue;
+			BuildContentKey(snaps[s]->pages[i].hash, hash_size, key);
+			nodes[used].key = HashContentKey(key);
+			nodes[used].sketch = snaps[s]->pages[i].sketch;
+			nodes[used].pages = 1;
+			used++;
+		}
+	}
+	info->pages = used;
+	qsort(nodes, used, sizeof(struct SketchNode), CompareNodes);
+	for (i=0,n=0;i<used;i++)
+	{
+		if (n > 0 && nodes[n-1].key==nodes[i].key)
+			nodes[n-1].pages++;
+		else
+			nodes[n++] = nodes[i];
+	}
+	info->contents = n;
+
+	parent = (unsigned int*) malloc((n+1) * sizeof(unsigned int));
+	size = (unsigned int*) malloc((n+1) * sizeof(unsigned int));
+	nearest = (unsigned char*) malloc(n+1);
+	band_keys = (uint64_t*) malloc((n+1) * sizeof(uint64_t));
+	if (parent==NULL || size==NULL || nearest==NULL || band_keys==NULL)
+	{
+		printf("ERROR: Out of memory. (lsh)\n");
+		free(parent);
+		free(size);
+		free(nearest);
+		free(band_keys);
+		free(nodes);
+		return -1;
+	}
+	for (i=0;i<n;i++)
+	{
+		parent[i] = i;
+		size[i] = 1;
+		nearest[i] = 64;
+	}
+
+	// sketches within max_distance bits are equal in at least one of max_distance+1 bands
+	bands = max_distance + 1;
+	band_bits = 64 / bands;
+	for (band=0;band<bands;band++)
+	{
+		for (i=0;i<n;i++)
+			band_keys[i] = ((nodes[i].sketch >> (band * band_bits)) & ((1ull << band_bits) - 1)) << 32 | i;
+		qsort(band_keys, n, sizeof(uint64_t), CompareUInt64);
+
+		for (start=0;start<n;start=j)
+		{
+			for (j=start+1;j<n && band_keys[j]>>32 == band_keys[start]>>32;j++)
+				;
+			// every content of the run is compared with the next SIMILAR_MAX_RUN ones
+			for (i=start;i<j;i++)
+			{
+				a = band_keys[i] & 0xffffffff;
+				for (k=i+1;k<j && k<=i+SIMILAR_MAX_RUN;k++)
+				{
+					other = band_keys[k] & 0xffffffff;
+					info->candidates++;
+					distance = __builtin_popcountll(nodes[a].sketch ^ nodes[other].sketch);
+					if (distance > max_distance)
+						continue;
+					if (distance < nearest[a])
+						nearest[a] = distance;
+					if (distance < nearest[other])
+						nearest[other] = distance;
+
+					// union by size
+					ra = FindRoot(parent, a);
+					rb = FindRoot(parent, other);
+					if (ra==rb)
+						continue;
+					if (size[ra] < size[rb])
+					{
+						parent[ra] = rb;
+						size[rb] += size[ra];
+					}
+					else
+					{
+						parent[rb] = ra;
+						size[ra] += size[rb];
+					}
+				}
+			}
+		}
+	}
+
+	// the root of every group is kept, the other contents become deltas
+	for (i=0;i<n;i++)
+	{
+		ra = FindRoot(parent, i);
+		if (size[ra] < 2)
+			continue;
+		if (ra==i)
+			info->groups++;
+		else
+		{
+			info->delta_contents++;
+			info->delta_bytes += EstimateDelta(nearest[i]);
+		}
+		info->grouped_contents++;
+		info->grouped_pages += nodes[i].pages;
+	}
+
+	free(parent);
+	free(size);
+	free(nearest);
+	free(band_keys);
+	free(nodes);
+	return 0;
+}
+
+void PrintSimilarityInfoHeader()
+{
+	printf("pages;contents;candidates;groups;grouped contents;grouped pages;delta contents;delta bytes;saved MB;");
+}
+
+void PrintSimilarityInfo(const struct SimilarityInfo *info)
+{
+	double saved = (info->delta_contents * (double)VMS_PAGE_SIZE - info->delta_bytes) / (1024 * 1024);
+
+	printf("%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%.2f;", info->pages, info->contents, info->candidates, info->groups,
+		info->grouped_contents, info->grouped_pages, info->delta_contents, info->delta_bytes, saved);
+}
+
+// for internal use only
+static int CompareNodes(const void *a, const void *b)
+{
+	uint64_t ka = ((const struct SketchNode*) a)->key;
+	uint64_t kb = ((const struct SketchNode*) b)->key;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static int CompareUInt64(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t*) a;
+	uint64_t kb = *(const uint64_t*) b;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+// with path halving
+static unsigned int FindRoot(unsigned int *parent, unsigned int n)
+{
+	while (parent[n]!=n)
+	{
+		parent[n] = parent[parent[n]];
+		n = parent[n];
+	}
+	return n;
+}
+
+// changed words of a delta against a page with a sketch distance bits away
+static unsigned long EstimateDelta(int distance)
+{
+	unsigned long bytes = (1.0 - cos(M_PI * distance / 64.0)) * VMS_PAGE_SIZE;
+
+	return bytes < SIMILAR_MIN_DELTA ? SIMILAR_MIN_DELTA : bytes;
+}
@@ -0,0 +1,244 @@
+// unique page estimator - HyperLogLog sketches of page hashes
+
+#include "../include/vmssketch.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SKETCH_MAGIC	0x4c4c4856 // "VHLL"
+#define SKETCH_VERSION	1
+#define SKETCH_HASH_MASK (VMS_HASH_CRC32 | VMS_HASH_CRC32_EX | VMS_HASH_PATTERN | VMS_HASH_SHA1 | VMS_HASH_SUPERFAST | VMS_HASH_CHUNKS | VMS_CHUNK_2K)
+
+struct SketchFileHeader
+{
+	unsigned int magic;
+	int precision;
+	unsigned int hash_flags;
+	unsigned int version;
+};
+
+// helper functions for internal use
+static int ReadAll(int file, void *data, unsigned long size);
+static int WriteAll(int file, const void *data, unsigned long size);
+
+
+struct PageSketch* CreatePageSketch(int precision)
+{
+	struct PageSketch *sketch;
+
+	if (precision <= 0)
+		precision = SKETCH_DEFAULT_PRECISION;
+	if (precision < SKETCH_MIN_PRECISION || precision > SKETCH_MAX_PRECISION)
+	{
+		printf("Illegal sketch precision %d.\n", precision);
+		return NULL;
+	}
+
+	sketch = (struct PageSketch*) malloc(sizeof(struct PageSketch));
+	if (sketch==NULL)
+		return NULL;
+	sketch->registers = (unsigned char*) calloc(1ul << precision, 1);
+	if (sketch->registers==NULL)
+	{
+		free(sketch);
+		return NULL;
+	}
+	sketch->precision = precision;
+	sketch->hash_flags = 0;
+
+	return sketch;
+}
+
+void ReleasePageSketch(struct PageSketch *sketch)
+{
+	if (sketch==NULL)
+		return;
+
+	free(sketch->registers);
+	free(sketch);
+}
+
+int AddSnapshotToSketch(struct PageSketch *sketch, VMSNAPSHOT snap)
+{
+	unsigned int hash_flags = (snap->flags & SKETCH_HASH_MASK) | SKETCH_HASH_SET;
+	int precision = sketch->precision;
+	unsigned char rank;
+	uint64_t h, rest;
+	int hash_size = GetHashSize(snap->flags);
+	unsigned char key[HASH_KEY_SIZE];
+	unsigned long i;
+
+	if (sketch->hash_flags!=0 && sketch->hash_flags!=hash_flags)
+	{
+		printf("The snapshot uses another page hash than the sketch.\n");
+		return -1;
+	}
+	sketch->hash_flags = hash_flags;
+
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (snap->pages[i].present <= 0)
+			continue;
+
+		// the first bits select the register, the others are counted up to the first 1
+		BuildContentKey(snap->pages[i].hash, hash_size, key);
+		h = HashContentKey(key);
+		rest = h << precision;
+		rank = rest==0 ? 64 - precision + 1 : __builtin_clzll(rest) + 1;
+		if (rank > sketch->registers[h >> (64 - precision)])
+			sketch->registers[h >> (64 - precision)] = rank;
+	}
+
+	return 0;
+}
+
+int MergePageSketch(struct PageSketch *dest, const struct PageSketch *src)
+{
+	unsigned long i;
+
+	if (dest->precision!=src->precision)
+	{
+		printf("Sketches with precision %d and %d can not be merged.\n", dest->precision, src->precision);
+		return -1;
+	}
+	// an empty sketch matches every hash
+	if (dest->hash_flags!=0 && src->hash_flags!=0 && dest->hash_flags!=src->hash_flags)
+	{
+		printf("Sketches of different page hashes can not be merged.\n");
+		return -1;
+	}
+	if (src->hash_flags!=0)
+		dest->hash_flags = src->hash_flags;
+
+	for (i=0;i < (1ul << src->precision);i++)
+		if (src->registers[i] > dest->registers[i])
+			dest->registers[i] = src->registers[i];
+
+	return 0;
+}
+
+unsigned long EstimateDistinctPages(const struct PageSketch *sketch)
+{
+	unsigned long m = 1ul << sketch->precision;
+	unsigned long i, zeros = 0;
+	double sum = 0, estimate;
+
+	for (i=0;i<m;i++)
+	{
+		sum += ldexp(1.0, -sketch->registers[i]);
+		if (sketch->registers[i]==0)
+			zeros++;
+	}
+
+	estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+	// linear counting is more accurate for small sets, 64 bit hashes need no large range correction
+	if (estimate <= 2.5 * m && zeros!=0)
+		estimate = m * log((double)m / zeros);
+
+	return (unsigned long)(estimate + 0.5);
+}
+
+int SavePageSketch(const char *path, const struct PageSketch *sketch)
+{
+	struct SketchFileHeader header;
+	int file, ret;
+
+	file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file<0)
+	{
+		printf("Cannot open %s. errno=%d\n", path, errno);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SKETCH_MAGIC;
+	header.precision = sketch->precision;
+	header.hash_flags = sketch->hash_flags;
+	header.version = SKETCH_VERSION;
+
+	ret = WriteAll(file, &header, sizeof(header));
+	if (ret==0)
+		ret = WriteAll(file, sketch->registers, 1ul << sketch->precision);
+	close(file);
+
+	if (ret!=0)
+		printf("Could not write %s.\n", path);
+	return ret;
+}
+
+struct PageSketch* LoadPageSketch(const char *path)
+{
+	struct SketchFileHeader header;
+	struct PageSketch *sketch;
+	int file;
+
+	file = open(path, O_RDONLY);
+	if (file<0)
+	{
+		printf("Could not open %s. errno=%d\n", path, errno);
+		return NULL;
+	}
+
+	if (ReadAll(file, &header, sizeof(header))!=0 || header.magic!=SKETCH_MAGIC || header.version!=SKETCH_VERSION)
+	{
+		printf("%s is not a sketch file.\n", path);
+		close(file);
+		return NULL;
+	}
+
+	sketch = CreatePageSketch(header.precision);
+	if (sketch==NULL)
+	{
+		close(file);
+		return NULL;
+	}
+	sketch->hash_flags = header.hash_flags;
+
+	if (ReadAll(file, sketch->registers, 1ul << sketch->precision)!=0)
+	{
+		printf("Could not read %s.\n", path);
+		ReleasePageSketch(sketch);
+		sketch = NULL;
+	}
+	close(file);
+
+	return sketch;
+}
+
+// for internal use only
+static int ReadAll(int file, void *data, unsigned long size)
+{
+	unsigned long done = 0;
+	ssize_t ret;
+
+	while (done < size)
+	{
+		ret = read(file, (char*)data + done, size - done);
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
+
+static int WriteAll(int file, const void *data, unsigned long size)
+{
+	unsigned long done = 0;
+	ssize_t ret;
+
+	while (done < size)
+	{
+		ret = write(file, (const char*)data + done, size - done);
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
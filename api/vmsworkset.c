@@ -0,0 +1,392 @@
+// working set estimation - access counts of sampled Accessed bits or idle pages
+
+#include "../include/vmsworkset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+struct PfnRecord
+{
+	unsigned long pfn;
+	unsigned long record; // index into snap->pages
+};
+
+// helper functions for internal use
+static VMSNAPSHOT TakeSample(struct WorkingSet *ws);
+static int ClearReferences(int pid);
+static struct PfnRecord* CollectPfns(VMSNAPSHOT snap, unsigned long *count);
+static int MarkPagesIdle(int fd, const struct PfnRecord *pfns, unsigned long count);
+static int ReadIdlePages(int fd, const struct PfnRecord *pfns, unsigned long count, unsigned char *used);
+static int ComparePfns(const void *a, const void *b);
+static void SleepMilliseconds(unsigned long ms);
+
+
+struct WorkingSet* CreateWorkingSet(int pid, int flags, int page_idle)
+{
+	struct WorkingSet *ws;
+
+	if (pid <= 0)
+	{
+		printf("The working set needs a task, not a physical snapshot.\n");
+		return NULL;
+	}
+
+	ws = (struct WorkingSet*) calloc(1, sizeof(struct WorkingSet));
+	if (ws==NULL)
+	{
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+
+	ws->pid = pid;
+	ws->flags = flags!=0 ? flags : WORKSET_DEFAULT_FLAGS;
+	ws->page_idle = page_idle;
+	return ws;
+}
+
+void ReleaseWorkingSet(struct WorkingSet *ws)
+{
+	if (ws==NULL)
+		return;
+
+	ReleaseSnapshotIndex(ws->index);
+	if (ws->snap!=NULL)
+		ReleaseSnapshot(ws->snap);
+	free(ws->access_counts);
+	free(ws);
+}
+
+int SampleWorkingSet(struct WorkingSet *ws, unsigned long interval_ms)
+{
+	VMSNAPSHOT snap = NULL;
+	struct SnapshotIndex *index;
+	struct PfnRecord *pfns = NULL;
+	struct PageIterator iter, old_iter;
+	struct PageTableEntryInfo *page, *old_page = NULL;
+	unsigned long address, old_address = 0, count = 0, i;
+	unsigned short *counts;
+	unsigned char *used;
+	int fd = -1, ret;
+
+	if (ws==NULL)
+		return -1;
+
+	if (ws->page_idle)
+	{
+		// the pages of the snapshot are used if they are not idle after the interval
+		fd = open(PAGE_IDLE_BITMAP, O_RDWR);
+		if (fd < 0)
+		{
+			printf("ERROR: Opening %s. errno=%d\n", PAGE_IDLE_BITMAP, errno);
+			return -1;
+		}
+		snap = TakeSample(ws);
+		if (snap!=NULL)
+			pfns = CollectPfns(snap, &count);
+		if (pfns==NULL || MarkPagesIdle(fd, pfns, count)!=0)
+		{
+			close(fd);
+			free(pfns);
+			if (snap!=NULL)
+				ReleaseSnapshot(snap);
+			return -1;
+		}
+		SleepMilliseconds(interval_ms);
+	}
+	else
+	{
+		// the pages of the snapshot are used if their Accessed bit was set again
+		if (ClearReferences(ws->pid)!=0)
+			return -1;
+		SleepMilliseconds(interval_ms);
+		snap = TakeSample(ws);
+		if (snap==NULL)
+			return -1;
+	}
+
+	used = (unsigned char*) calloc(snap->available_pages+1, 1);
+	counts = (unsigned short*) calloc(snap->available_pages+1, sizeof(unsigned short));
+	if (used==NULL || counts==NULL)
+		printf("ERROR: Out of memory. (samples)\n");
+	index = used!=NULL && counts!=NULL ? CreateSnapshotIndex(snap) : NULL;
+	if (index==NULL)
+	{
+		if (fd >= 0)
+			close(fd);
+		free(pfns);
+		free(used);
+		free(counts);
+		ReleaseSnapshot(snap);
+		return -1;
+	}
+
+	if (ws->page_idle)
+	{
+		ret = ReadIdlePages(fd, pfns, count, used);
+		close(fd);
+		free(pfns);
+		if (ret!=0)
+		{
+			free(used);
+			free(counts);
+			ReleaseSnapshotIndex(index);
+			ReleaseSnapshot(snap);
+			return -1;
+		}
+	}
+	else
+	{
+		for (i=0;i<snap->available_pages;i++)
+			used[i] = snap->pages[i].present > 0 && (snap->pages[i].pte_flags & VMS_PTE_ACCESSED)!=0;
+	}
+
+	// both samples are walked in address order, the counts follow the addresses
+	if (ws->snap!=NULL)
+	{
+		InitPageIterator(ws->index, 0, ~0ul, &old_iter);
+		old_page = NextPage(&old_iter, &old_address, NULL);
+	}
+	InitPageIterator(index, 0, ~0ul, &iter);
+	while ((page = NextPage(&iter, &address, NULL))!=NULL)
+	{
+		while (old_page!=NULL && old_address < address)
+			old_page = NextPage(&old_iter, &old_address, NULL);
+		i = page - snap->pages;
+		if (old_page!=NULL && old_address==address)
+			counts[i] = ws->access_counts[old_page - ws->snap->pages];
+		counts[i] += used[i];
+	}
+	free(used);
+
+	ReleaseSnapshotIndex(ws->index);
+	if (ws->snap!=NULL)
+		ReleaseSnapshot(ws->snap);
+	free(ws->access_counts);
+	ws->snap = snap;
+	ws->index = index;
+	ws->access_counts = counts;
+	ws->samples++;
+	return 0;
+}
+
+struct WorkingSetInfo* ComputeWorkingSetInfo(struct WorkingSet *ws, int hot_samples)
+{
+	struct WorkingSetInfo *infos, *info, *total;
+	struct PageTableEntryInfo *page;
+	unsigned long i;
+
+	if (ws==NULL || ws->snap==NULL)
+		return NULL;
+	if (hot_samples < 1)
+		hot_samples = 1;
+
+	infos = (struct WorkingSetInfo*) calloc(ws->snap->vm_region_count+1, sizeof(struct WorkingSetInfo));
+	if (infos==NULL)
+	{
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	total = &infos[ws->snap->vm_region_count];
+
+	for (i=0;i<ws->snap->available_pages;i++)
+	{
+		page = &ws->snap->pages[i];
+		if (page->present <= 0 || page->present > ws->snap->vm_region_count)
+			continue;
+		// present is the region number of process snapshots
+		info = &infos[page->present - 1];
+		info->pages++;
+		total->pages++;
+		if (ws->access_counts[i] >= hot_samples)
+		{
+			info->hot++;
+			total->hot++;
+		}
+		else if (ws->access_counts[i] > 0)
+		{
+			info->warm++;
+			total->warm++;
+		}
+		else
+		{
+			info->cold++;
+			total->cold++;
+		}
+	}
+
+	return infos;
+}
+
+void PrintWorkingSetInfoHeader()
+{
+	printf("region;name;pages;hot;warm;cold;hot MB;hot+warm MB;");
+}
+
+void PrintWorkingSet(struct WorkingSet *ws, const struct WorkingSetInfo *infos)
+{
+	const struct WorkingSetInfo *info;
+	int v;
+
+	if (ws==NULL || ws->snap==NULL || infos==NULL)
+		return;
+
+	for (v=0;v<=ws->snap->vm_region_count;v++)
+	{
+		info = &infos[v];
+		if (info->pages==0 && v < ws->snap->vm_region_count)
+			continue;
+		if (v < ws->snap->vm_region_count)
+			printf("0x%lx;%s;", ws->snap->vms[v].start_address, GetRegionName(&ws->snap->vms[v]));
+		else
+			printf("total;%d samples;", ws->samples);
+		printf("%lu;%lu;%lu;%lu;%.2f;%.2f;\n", info->pages, info->hot, info->warm, info->cold,
+			info->hot * (double)VMS_PAGE_SIZE / (1024 * 1024), (info->hot + info->warm) * (double)VMS_PAGE_SIZE / (1024 * 1024));
+	}
+}
+
+void PrintAccessCounts(struct WorkingSet *ws)
+{
+	struct PageIterator iter;
+	struct PageTableEntryInfo *page;
+	unsigned long address;
+	int vma_index;
+
+	if (ws==NULL || ws->snap==NULL)
+		return;
+
+	printf("address;name;access count;\n");
+	InitPageIterator(ws->index, 0, ~0ul, &iter);
+	while ((page = NextPage(&iter, &address, &vma_index))!=NULL)
+	{
+		if (page->present <= 0)
+			continue;
+		printf("0x%lx;%s;%u;\n", address, GetRegionName(&ws->snap->vms[vma_index]), ws->access_counts[page - ws->snap->pages]);
+	}
+}
+
+// for internal use only
+static VMSNAPSHOT TakeSample(struct WorkingSet *ws)
+{
+	VMSNAPSHOT snap;
+	char tmp_buffer[64];
+	int len;
+
+	// the module reads the flags as hex
+	len = snprintf(tmp_buffer, sizeof(tmp_buffer), "%d:%x", ws->pid, ws->flags);
+	snap = TakeSnapshotEx(tmp_buffer, len);
+	if (snap!=NULL)
+		MarkHeapAndStack(snap);
+	return snap;
+}
+
+// clears the Accessed bits of all ptes of the task and the referenced flags of their pages
+static int ClearReferences(int pid)
+{
+	char path[64];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+	{
+		printf("ERROR: Opening %s. errno=%d\n", path, errno);
+		return -1;
+	}
+	ret = write(fd, "1", 1);
+	close(fd);
+	if (ret!=1)
+	{
+		printf("Could not clear the references of %d. errno=%d\n", pid, errno);
+		return -1;
+	}
+	return 0;
+}
+
+// the present pages sorted by pfn, so every bitmap word is accessed once
+static struct PfnRecord* CollectPfns(VMSNAPSHOT snap, unsigned long *count)
+{
+	struct PfnRecord *pfns;
+	unsigned long i, n = 0;
+
+	pfns = (struct PfnRecord*) malloc((snap->available_pages+1) * sizeof(struct PfnRecord));
+	if (pfns==NULL)
+	{
+		printf("ERROR: Out of memory. (pfns)\n");
+		return NULL;
+	}
+
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (snap->pages[i].present <= 0 || snap->pages[i].pfn==0)
+			continue;
+		pfns[n].pfn = snap->pages[i].pfn;
+		pfns[n].record = i;
+		n++;
+	}
+	qsort(pfns, n, sizeof(struct PfnRecord), ComparePfns);
+
+	*count = n;
+	return pfns;
+}
+
+// the bitmap is written in 8 byte words, set bits mark pages idle and clear bits are ignored
+static int MarkPagesIdle(int fd, const struct PfnRecord *pfns, unsigned long count)
+{
+	unsigned long i = 0, word;
+	uint64_t bits;
+
+	while (i < count)
+	{
+		word = pfns[i].pfn >> 6;
+		bits = 0;
+		for (;i<count && pfns[i].pfn >> 6 == word;i++)
+			bits |= 1ull << (pfns[i].pfn & 63);
+		if (pwrite(fd, &bits, sizeof(bits), word * sizeof(bits))!=sizeof(bits))
+		{
+			printf("Could not mark pfn 0x%lx idle. errno=%d\n", word << 6, errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int ReadIdlePages(int fd, const struct PfnRecord *pfns, unsigned long count, unsigned char *used)
+{
+	unsigned long i = 0, word;
+	uint64_t bits;
+
+	while (i < count)
+	{
+		word = pfns[i].pfn >> 6;
+		if (pread(fd, &bits, sizeof(bits), word * sizeof(bits))!=sizeof(bits))
+		{
+			printf("Could not read the idle bits of pfn 0x%lx. errno=%d\n", word << 6, errno);
+			return -1;
+		}
+		for (;i<count && pfns[i].pfn >> 6 == word;i++)
+			used[pfns[i].record] = (bits >> (pfns[i].pfn & 63) & 1)==0;
+	}
+	return 0;
+}
+
+static int ComparePfns(const void *a, const void *b)
+{
+	unsigned long ka = ((const struct PfnRecord*) a)->pfn;
+	unsigned long kb = ((const struct PfnRecord*) b)->pfn;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static void SleepMilliseconds(unsigned long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts)!=0 && errno==EINTR)
+		;
+}
@@ -1,9 +1,13 @@
 // hash helper functions go here
 
 #include "vmsnapshot.h"
+#include "vmsflatmap.h"
+#include "vmsbloom.h"
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <string.h>
 
 #ifndef _DEBUG_ERROR
 #include <tr1/unordered_map>
@@ -16,18 +20,72 @@ using namespace std::tr1;
 
 // Create Hashmaps
 
-typedef pair<string, struct PageTableEntryInfo*> ContentPair;
-typedef unordered_map<string, struct PageTableEntryInfo*> ContentMap;
+// binary page hash used as key - compares the same bytes as the former hex string
+template<int SIZE> struct HashKey
+{
+	unsigned char bytes[SIZE];
+
+	HashKey() {}
+	HashKey(const unsigned char *hash) { memcpy(bytes, hash, SIZE); }
+	bool operator==(const HashKey &key) const { return memcmp(bytes, key.bytes, SIZE)==0; }
+};
+
+// page hashes are already well distributed - the first 8 bytes are used as bucket hash
+template<int SIZE> struct HashKeyHash
+{
+	size_t operator()(const HashKey<SIZE> &key) const
+	{
+		size_t value = 0;
+		memcpy(&value, key.bytes, SIZE < sizeof(size_t) ? SIZE : sizeof(size_t));
+		return value;
+	}
+};
+
+#define CONTENT_KEY_SIZE HASH_KEY_SIZE // MD5 size, ConvertMD5Hash used these bytes
+
+typedef HashKey<CONTENT_KEY_SIZE> ContentKey;
+typedef pair<ContentKey, struct PageTableEntryInfo*> ContentPair;
+typedef FlatMap<ContentKey, struct PageTableEntryInfo*, HashKeyHash<CONTENT_KEY_SIZE> > ContentMap;
+
+/// Builds the content key of a page hash with HASH_SIZE bytes, see BuildContentKey
+template<int HASH_SIZE> inline ContentKey MakeContentKey(const unsigned char *hash)
+{
+	ContentKey key;
+	BuildContentKey(hash, HASH_SIZE, key.bytes);
+	return key;
+}
+
+/// Same for a hash size known at run time, e.g. GetHashSize(snap->flags)
+inline ContentKey MakeContentKey(const unsigned char *hash, int hash_size)
+{
+	switch (hash_size)
+	{
+	case HASH_CRC32_SIZE:
+		return MakeContentKey<HASH_CRC32_SIZE>(hash);
+	case HASH_SHA1_SIZE:
+		return MakeContentKey<HASH_SHA1_SIZE>(hash);
+	default:
+		return MakeContentKey<HASH_KEY_SIZE>(hash);
+	}
+}
 
 typedef pair<unsigned long, struct PageTableEntryInfo*> PFNPair;
-typedef unordered_map<unsigned long, struct PageTableEntryInfo*> PFNMap;
+typedef FlatMap<unsigned long, struct PageTableEntryInfo*, std::tr1::hash<unsigned long> > PFNMap;
 
 typedef struct Maps
 {
 	ContentMap* hm;
 	PFNMap * pm;
+	BloomFilter *filter; // optional prefilter of hm, see EnableHashMapFilter
 } HashMap;
 
+// Contents and pfns are partitioned by key into shards, one thread per shard
+typedef struct ShardedMaps
+{
+	int shard_count;
+	HashMap **shards; // shard i owns the keys with KeyShard(key) == i
+} ShardedHashMap;
+
 HashMap* CreateHashMap();
 
 
@@ -44,4 +102,134 @@ void ClearHashMap(HashMap* map);
 
 int TestSnapshotAgainstHashMap(VMSNAPSHOT snap, HashMap* map, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2);
 
-int HashMapAgainstHashMap(HashMap *map1, HashMap *map2);
\ No newline at end of file
+int HashMapAgainstHashMap(HashMap *map1, HashMap *map2);
+
+/// Builds a bloom filter of the contents, which is checked before every content lookup
+/// of TestSnapshotAgainstHashMap, so pages missing in the map skip the map probes.
+/// Contents added later are added to the filter as well.
+/// @bits_per_key: <= 0 uses BLOOM_DEFAULT_BITS
+void EnableHashMapFilter(HashMap *map, int bits_per_key);
+
+void DisableHashMapFilter(HashMap *map);
+
+/// @shard_count: amount of shards and worker threads, <= 0 uses all online cpus
+ShardedHashMap* CreateShardedHashMap(int shard_count);
+
+void ReleaseShardedHashMap(ShardedHashMap *map);
+
+/// Parallel version of calling AddSnapshotToHashMap for every snapshot in order
+/// the CollisionInfo totals are identical to the sequential run
+/// return: info->shareable or a negative value on error
+int AddSnapshotsToShardedHashMap(ShardedHashMap *map, VMSNAPSHOT *snaps, int count, CollisionInfo *info);
+// Sliding window map
+// Entries own their content key and count the pages and snapshots of the window
+// with this content, so snapshots can be released after adding them. Every
+// snapshot keeps the contents it contributed, which are decremented on removal.
+
+struct WindowEntry
+{
+	unsigned long pages; // pages of this content in the window
+	unsigned int snapshots; // snapshots contributing pages
+};
+
+struct WindowRef
+{
+	ContentKey key;
+	unsigned int pages; // pages of the snapshot with this content
+};
+
+typedef FlatMap<ContentKey, struct WindowEntry, HashKeyHash<CONTENT_KEY_SIZE> > WindowContentMap;
+typedef unordered_map<int, vector<struct WindowRef>* > WindowSnapshotMap;
+
+typedef struct WindowMaps
+{
+	WindowContentMap *hm;
+	WindowSnapshotMap *snapshots; // contributions by snapshot id
+	int next_id;
+	int flags; // hash flags of the added snapshots
+	unsigned long pages;
+	unsigned long shared_contents; // contents of more than one snapshot
+} WindowHashMap;
+
+struct WindowInfo
+{
+	int snapshots;
+	unsigned long pages; // present pages
+	unsigned long contents; // distinct contents
+	unsigned long shareable; // pages - contents
+	unsigned long shared_contents; // contents of more than one snapshot
+	unsigned long zero_pages;
+};
+
+WindowHashMap* CreateWindowHashMap();
+
+void ReleaseWindowHashMap(WindowHashMap *map);
+
+/// Adds the present pages of a snapshot, the snapshot can be released afterwards
+/// return: id of the snapshot for RemoveSnapshotFromHashMap or a negative value on error
+int AddSnapshotToWindowHashMap(WindowHashMap *map, VMSNAPSHOT snap);
+
+/// Removes the pages of a snapshot added with AddSnapshotToWindowHashMap
+/// return: 0 on success, -1 if the id is unknown
+int RemoveSnapshotFromHashMap(WindowHashMap *map, int snapshot_id);
+
+void GetWindowInfo(WindowHashMap *map, struct WindowInfo *info);
+
+// Index files
+// A HashMap can be saved as an index file with the contents sorted by key and
+// the pfns of the PFNMap sorted by value. The file is mapped read only, so
+// probes against a baseline start without loading its snapshots again.
+
+#define HASHMAP_INDEX_MAGIC		0x494d4856 // "VHMI"
+#define HASHMAP_INDEX_VERSION	1
+#define HASHMAP_INDEX_DIR_BITS	16 // the directory splits the contents by their first key bytes
+
+struct HashMapIndexHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	int flags; // hash flags of the snapshots
+	int longsize;
+	unsigned long content_count;
+	unsigned long pfn_count;
+	unsigned long dir_offset; // (1 << HASHMAP_INDEX_DIR_BITS) + 1 content indices
+	unsigned long content_offset;
+	unsigned long pfn_offset;
+};
+
+struct IndexContent
+{
+	unsigned char key[CONTENT_KEY_SIZE];
+	unsigned long pfn; // pfn of the page kept in the ContentMap
+};
+
+typedef struct MappedIndex
+{
+	void *data;
+	size_t size;
+	const struct HashMapIndexHeader *header;
+	const unsigned long *dir;
+	const struct IndexContent *contents;
+	const unsigned long *pfns;
+} HashMapIndex;
+
+/// @flags: hash flags of the snapshots added to the map
+/// return: 0 on success, -1 on failure
+int SaveHashMapIndex(HashMap *map, int flags, const char *path);
+
+/// Maps an index file saved by SaveHashMapIndex
+/// return: on success, it returns a pointer to an index, which must be released
+///			on failure, it returns NULL
+HashMapIndex* LoadHashMapIndex(const char *path);
+
+void ReleaseHashMapIndex(HashMapIndex *index);
+
+/// @key: CONTENT_KEY_SIZE bytes, see MakeContentKey
+/// return: 1 if the content is in the index and its pfn is stored in pfn, otherwise 0
+int FindIndexContent(HashMapIndex *index, const unsigned char *key, unsigned long *pfn);
+
+/// return: 1 if the pfn was in the PFNMap, otherwise 0
+int FindIndexPFN(HashMapIndex *index, unsigned long pfn);
+
+/// Like TestSnapshotAgainstHashMap with an index file as baseline
+int TestSnapshotAgainstHashMapIndex(VMSNAPSHOT snap, HashMapIndex* index, HashMap* map2,  CollisionInfo *info, CollisionInfo *info2);
@@ -0,0 +1,89 @@
+/* This file contains a blocked bloom filter for the page maps
+   Every key sets one bit in each of the 8 words of a 256 bit block, so a
+   lookup reads a single half cache line. With 10 bits per key about 1% of
+   the keys which were not inserted are reported as contained.
+*/
+#ifndef VMSBLOOM_H
+#define VMSBLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BLOOM_BLOCK_WORDS		8
+#define BLOOM_DEFAULT_BITS		10 // bits per key
+
+class BloomFilter
+{
+public:
+	/// @keys: expected amount of keys
+	BloomFilter(size_t keys, int bits_per_key) : keys(keys), bits_per_key(bits_per_key)
+	{
+		if (this->bits_per_key <= 0)
+			this->bits_per_key = BLOOM_DEFAULT_BITS;
+		block_count = (keys * this->bits_per_key + 255) / 256;
+		if (block_count==0)
+			block_count = 1;
+		blocks = new Block[block_count];
+		clear();
+	}
+	~BloomFilter() { delete[] blocks; }
+
+	size_t capacity() const { return keys; }
+	int bits() const { return bits_per_key; }
+
+	void clear() { memset(blocks, 0, block_count * sizeof(Block)); }
+
+	/// @hash: well mixed 64 bit hash of the key
+	void insert(uint64_t hash)
+	{
+		Block &block = blocks[BlockIndex(hash)];
+		int i;
+
+		for (i=0;i<BLOOM_BLOCK_WORDS;i++)
+			block.words[i] |= BitMask(hash, i);
+	}
+
+	bool contains(uint64_t hash) const
+	{
+		const Block &block = blocks[BlockIndex(hash)];
+		int i;
+
+		for (i=0;i<BLOOM_BLOCK_WORDS;i++)
+			if ((block.words[i] & BitMask(hash, i))==0)
+				return false;
+		return true;
+	}
+
+private:
+	struct Block
+	{
+		uint32_t words[BLOOM_BLOCK_WORDS];
+	} __attribute__((aligned(32)));
+
+	Block *blocks;
+	size_t block_count;
+	size_t keys;
+	int bits_per_key;
+
+	BloomFilter(const BloomFilter&);
+	BloomFilter& operator=(const BloomFilter&);
+
+	// the high half selects the block without a division
+	size_t BlockIndex(uint64_t hash) const
+	{
+		return (size_t)(((hash >> 32) * (uint64_t)block_count) >> 32);
+	}
+
+	// odd multipliers spread the low half over one bit per word
+	static uint32_t BitMask(uint64_t hash, int word)
+	{
+		static const uint32_t SALT[BLOOM_BLOCK_WORDS] = {
+			0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+			0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u };
+
+		return 1u << (((uint32_t)hash * SALT[word]) >> 27);
+	}
+};
+
+#endif
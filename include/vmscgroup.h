@@ -0,0 +1,45 @@
+/* This file contains the cgroup snapshot api
+   All tasks of a cgroup (a container) are snapshotted as one consistent
+   batch: the cgroup is frozen (cgroup.freeze of cgroup v2 or freezer.state
+   of the v1 freezer), the member processes in cgroup.procs of the cgroup
+   and of all its descendant cgroups are snapshotted one after another and
+   the cgroup is thawed again. The snapshots of a batch are taken with
+   VMS_SHARED_FRAMES, so the module hashes frames which are mapped by
+   several members only once. The pause is bounded: members which are not
+   snapshotted before max_pause_ms are left out and the cgroup is thawed,
+   the result is marked incomplete then. A cgroup which is already frozen
+   is neither frozen nor thawed, it stays frozen after the batch.
+*/
+#ifndef VMSCGROUP_H
+#define VMSCGROUP_H
+
+#include "vmsnapshot.h"
+
+#define CGROUP_ROOT					"/sys/fs/cgroup/"
+#define CGROUP_FREEZE_TIMEOUT_MS	1000 // waiting for all tasks to be frozen
+#define CGROUP_DEFAULT_MAX_PAUSE_MS	5000
+
+/// Snapshots of all member processes of a cgroup
+struct CgroupSnapshot
+{
+	int count; // snapshots taken
+	int members; // processes in the cgroup when it was frozen
+	int complete; // 0 if max_pause_ms stopped the batch
+	int was_frozen; // the cgroup was frozen before and is left frozen
+	unsigned long freeze_ms; // until all tasks were frozen
+	unsigned long pause_ms; // from the freeze request to the thaw
+	VMSNAPSHOT *snaps;
+};
+
+/// Freezes a cgroup, snapshots all member processes and thaws it
+/// @cgroup_path: directory of the cgroup, relative paths are relative to CGROUP_ROOT
+/// @flags: snapshot flags of every member, VMS_SHARED_FRAMES is added
+/// @max_pause_ms: pause after which the batch is stopped, 0 uses CGROUP_DEFAULT_MAX_PAUSE_MS
+/// return: on success, it returns a pointer to the snapshots, which must be released
+///			on failure, it returns NULL, a cgroup frozen by the call is thawed again
+struct CgroupSnapshot* TakeCgroupSnapshot(const char *cgroup_path, int flags, unsigned long max_pause_ms);
+
+/// @cs: the snapshots to be released
+void ReleaseCgroupSnapshot(struct CgroupSnapshot *cs);
+
+#endif
@@ -0,0 +1,42 @@
+/* This file contains the sub-page chunk dedup api
+   Snapshots taken with VMS_HASH_CHUNKS (or VMS_HASH_CRC32_EX) carry a checksum
+   of every 1 KiB or 2 KiB chunk of a page. The pages are deduplicated
+   first, then the chunks of the remaining unique pages are indexed, so the
+   duplicate and zero chunks are the redundancy which only exists below page
+   granularity, e.g. for compressed memory or sub-page dedup schemes.
+   Both indexes are sorted arrays of 64 bit keys. The 20 byte page hash keeps
+   64 bits per 2 KiB chunk and 40 bits per 1 KiB chunk, smaller chunks would
+   not keep enough bits to tell distinct chunks apart.
+*/
+#ifndef VMSCHUNK_H
+#define VMSCHUNK_H
+
+#include "vmsnapshot.h"
+
+/// Redundancy of all snapshots at page and at chunk granularity
+struct ChunkInfo
+{
+	unsigned long chunk_size;
+	unsigned long pages; // present pages
+	unsigned long zero_pages;
+	unsigned long duplicate_pages; // non zero pages whose content exists in an earlier page
+	unsigned long unique_pages; // the first page of every non zero content
+
+	// chunks of the unique pages only
+	unsigned long chunks;
+	unsigned long zero_chunks;
+	unsigned long duplicate_chunks; // non zero chunks whose content exists in an earlier chunk
+	unsigned long distinct_chunks; // non zero chunk contents
+};
+
+/// Indexes the pages and the chunks of all snapshots
+/// @snaps: valid snapshot pointers, all taken with the same chunk size
+/// return: 0 on success, -1 on failure or if the snapshots have no chunk hashes
+int ComputeChunkInfo(VMSNAPSHOT *snaps, int count, struct ChunkInfo *info);
+
+void PrintChunkInfoHeader();
+
+/// Prints the counters and the saved MB of page dedup, of chunk dedup and the difference
+void PrintChunkInfo(const struct ChunkInfo *info);
+
+#endif
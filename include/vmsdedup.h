@@ -0,0 +1,113 @@
+/* This file contains the sort-merge dedup api
+   It computes the same CollisionInfo as adding the snapshots in order to one
+   HashMap with AddSnapshotToHashMap, but sorts compact page tuples instead of
+   building hash maps:
+     1. every present page becomes a tuple, seq keeps the order of the pages
+     2. the tuples are radix sorted by a hash prefix - the sort is stable, so
+        every run of equal hashes starts with the page the HashMap would keep
+     3. duplicates with a different pfn are radix sorted by pfn and seq, the
+        first page of every pfn is a sharing op and all others are shared
+*/
+#ifndef VMSDEDUP_H
+#define VMSDEDUP_H
+
+#include "vmsnapshot.h"
+#include "vmsreport.h"
+
+#define DEDUP_KEY_SIZE HASH_KEY_SIZE // content key of the page hash, like ContentMap
+#define DEDUP_PREFIX_SIZE 8 // bytes of the page hash sorted
+
+#define DEDUP_SORT_HASH		0 // by the hash prefix
+#define DEDUP_SORT_PFN		1 // by pfn and seq
+
+#define DEDUP_MAX_THREADS	64
+#define DEDUP_MAX_PARTITIONS 1000 // run files open at the same time
+
+/// Result of VerifyHashRuns
+struct VerifyInfo
+{
+	unsigned long runs; // runs of equal hashes with more than one page
+	unsigned long pages; // pages of these runs which were re-read
+	unsigned long false_collisions; // pages whose content differs from the first page of their run
+	unsigned long unreadable; // pages which could not be re-read or whose CRC32 changed, they keep their hash
+};
+
+struct DedupTuple
+{
+	unsigned char hash[DEDUP_KEY_SIZE];
+	unsigned long pfn;
+	unsigned long seq; // snapshot number << 32 | page index
+	unsigned int page_class; // PAGE_CLASS_* with flags
+	unsigned int file; // region index, the file id after AddSnapshotFiles
+};
+
+/// Appends a tuple for every present page of a snapshot
+/// counts shared_counter and named_shared_counter like AddSnapshotToHashMap
+/// @snap_no: position of the snapshot in the input order
+/// @tuples: room for snap->available_pages tuples
+/// return: amount of tuples, 0 if the regions could not be classified
+unsigned long FillDedupTuples(VMSNAPSHOT snap, unsigned int snap_no, struct DedupTuple *tuples, struct CollisionInfo *info);
+
+/// Stable LSD radix sort with one pass per key byte, passes over constant bytes are skipped
+/// @tmp: room for count tuples
+/// @key: DEDUP_SORT_HASH or DEDUP_SORT_PFN
+/// @thread_count: threads per pass, <= 0 uses all online cpus
+/// return: pointer to the sorted tuples, either tuples or tmp
+struct DedupTuple* RadixSortDedupTuples(struct DedupTuple *tuples, struct DedupTuple *tmp, unsigned long count, int key, int thread_count);
+
+/// Finds the end of the run of equal hashes starting at start in tuples sorted by DEDUP_SORT_HASH
+/// if start begins a run of equal prefixes, but different hashes, the run is sorted by hash and seq
+/// return: index of the first tuple with another hash
+unsigned long NextHashRun(struct DedupTuple *tuples, unsigned long count, unsigned long start);
+
+/// Splits runs of equal hashes by page content, so weak hashes (CRC32, pattern)
+/// are counted like a strong one. The pages of every run with more than one page are
+/// re-read through /proc/pid/mem and compared byte by byte. Every further content of
+/// a run gets its own key, its tuples stay in seq order.
+/// The processes must still run and should be suspended. A process started after its
+/// snapshot is not re-read. Pages of CRC32 snapshots are hashed again and count as
+/// unreadable if they changed, pages of other hashes changed since the snapshot count
+/// as different contents.
+/// Only SortMergeDedupEx verifies runs, AddSnapshotToHashMap keeps the hashes as they are.
+/// @snaps: the snapshots of the tuples, snap_no is the index
+/// @tuples: sorted by DEDUP_SORT_HASH
+/// return: amount of false collisions, on failure a negative value
+long VerifyHashRuns(VMSNAPSHOT *snaps, int count, struct DedupTuple *tuples, unsigned long tuple_count, struct VerifyInfo *verify);
+
+/// Classifies tuples sorted by DEDUP_SORT_HASH
+/// runs of equal prefixes, but different hashes are sorted by hash in place
+/// @candidates: receives the duplicates with a different pfn, room for count tuples
+/// @report: if not NULL, it counts the pages per file id, see FileReport
+/// return: amount of candidates
+unsigned long ClassifyHashRuns(struct DedupTuple *tuples, unsigned long count, struct DedupTuple *candidates, struct CollisionInfo *info, struct FileReport *report);
+
+/// Classifies candidates sorted by DEDUP_SORT_PFN
+/// @report: if not NULL, it counts the pages per file id
+void ClassifyPFNRuns(const struct DedupTuple *candidates, unsigned long count, struct CollisionInfo *info, struct FileReport *report);
+
+/// Computes the CollisionInfo of adding all snapshots in order to one HashMap
+/// @snaps: valid snapshot pointers
+/// @thread_count: threads of the radix sort, <= 0 uses all online cpus
+/// return: info->shareable, on failure a negative value
+int SortMergeDedup(VMSNAPSHOT *snaps, int count, int thread_count, struct CollisionInfo *info);
+
+/// Like SortMergeDedup, but verifies the runs of equal hashes with VerifyHashRuns first
+/// and counts the pages of every file in the same pass
+/// @verify: if NULL, nothing is verified
+/// @report: if not NULL, it receives the files of all snapshots and is finished
+int SortMergeDedupEx(VMSNAPSHOT *snaps, int count, int thread_count, struct CollisionInfo *info, struct VerifyInfo *verify, struct FileReport *report);
+
+/// Out-of-core version of SortMergeDedup for snapshot files
+/// the snapshots are loaded one by one, their tuples are spilled into run files
+/// partitioned by hash prefix, and one partition after the other is sorted.
+/// The duplicates with a different pfn are spilled into run files partitioned by pfn.
+/// A partition larger than memory_limit, e.g. of many equal pages, is sorted in chunks
+/// which are merged while they are classified.
+/// @paths: snapshot files in input order
+/// @tmp_dir: directory of the run files
+/// @memory_limit: bytes used for the tuples of one partition or chunk
+/// @thread_count: threads of the radix sort, <= 0 uses all online cpus
+/// return: info->shareable, on failure a negative value
+int ExternalSortMergeDedup(const char **paths, int count, const char *tmp_dir, unsigned long memory_limit, int thread_count, struct CollisionInfo *info);
+
+#endif
@@ -0,0 +1,59 @@
+/* This file contains the snapshot diff api
+   It compares two snapshots of the same process page by page
+*/
+#ifndef VMSDIFF_H
+#define VMSDIFF_H
+
+#include "vmsnapshot.h"
+
+/// Page classes of a diff
+#define DIFF_UNCHANGED		0 // same content and frame
+#define DIFF_CHANGED		1 // content changed
+#define DIFF_REMAPPED		2 // same content, but different frame
+#define DIFF_FAULTED		3 // newly present
+#define DIFF_SWAPPED		4 // present before, now swapped out
+#define DIFF_UNMAPPED		5 // present before, now gone or not recorded
+#define DIFF_CLASS_COUNT	6
+
+/// Address range in which both snapshots use the same regions
+struct RegionDiffInfo
+{
+	unsigned long start_address;
+	unsigned long end_address;
+	int old_vma; // index into old vms or -1 if not mapped
+	int new_vma; // index into new vms or -1 if not mapped
+	unsigned long count[DIFF_CLASS_COUNT];
+};
+
+struct SnapshotDiff
+{
+	VMSNAPSHOT old_snap;
+	VMSNAPSHOT new_snap;
+	unsigned long total[DIFF_CLASS_COUNT];
+	int region_count;
+	struct RegionDiffInfo *regions; // sorted by start_address
+};
+
+/// Called for every classified page - pages can be NULL if they are not present
+typedef void (*DiffCallback)(unsigned long address, int diff_class, struct PageTableEntryInfo *old_page, struct PageTableEntryInfo *new_page, void *data);
+
+/// Compares two snapshots taken with the same hash function
+/// runs in linear time over both page arrays
+/// @old_snap: valid snapshot pointer
+/// @new_snap: valid snapshot pointer
+/// @callback: can be NULL
+/// @data: passed to callback
+/// return: on success, it returns a pointer to a diff, which must be released
+///			on failure, it returns NULL
+struct SnapshotDiff* DiffSnapshots(VMSNAPSHOT old_snap, VMSNAPSHOT new_snap, DiffCallback callback, void *data);
+
+/// @diff: a diff to be released - the snapshots are not released
+void ReleaseSnapshotDiff(struct SnapshotDiff *diff);
+
+/// Prints the region totals and the overall totals in csv format
+void PrintSnapshotDiff(struct SnapshotDiff *diff);
+
+/// returns the name of a diff class
+const char* GetDiffClassName(int diff_class);
+
+#endif
@@ -0,0 +1,21 @@
+/* This file contains the parallel export api
+   The page array is split into chunks which are formatted by a pool of
+   threads and written in order while the next chunks are formatted.
+*/
+#ifndef VMSEXPORT_H
+#define VMSEXPORT_H
+
+#include "vmsnapshot.h"
+
+#define EXPORT_CHUNK_PAGES	65536 // page records per chunk
+#define EXPORT_MAX_THREADS	256
+
+/// Writes the same text as PrintPages to a file descriptor
+/// @snap: valid snapshot pointer
+/// @start, count: page records like PrintPages
+/// @fd: file descriptor
+/// @thread_count: formatting threads, <= 0 uses all online cpus
+/// return: 0 on success, -1 on failure
+int ExportPages(VMSNAPSHOT snap, int start, int count, int fd, int thread_count);
+
+#endif
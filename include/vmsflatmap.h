@@ -0,0 +1,261 @@
+/* This file contains an open addressing hash map for the page maps
+   Entries are stored inline in one array. A control byte per slot holds
+   7 bits of the hash or FLATMAP_EMPTY, and groups of 16 control bytes are
+   matched at once with SSE2. Slots are probed group by group (linear).
+   Erased slots become FLATMAP_DELETED, unless their group still has an empty
+   slot, and are dropped when the map is rehashed.
+*/
+#ifndef VMSFLATMAP_H
+#define VMSFLATMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FLATMAP_GROUP_SIZE	16
+#define FLATMAP_EMPTY		0x80
+#define FLATMAP_DELETED		0xfe // full slots have the high bit cleared
+
+template<class Key, class Value, class Hash>
+class FlatMap
+{
+public:
+	typedef std::pair<Key, Value> value_type;
+
+	class iterator
+	{
+	public:
+		iterator() : map(NULL), index(0) {}
+		iterator(FlatMap *map, size_t index) : map(map), index(index) {}
+
+		value_type& operator*() const { return map->slots[index]; }
+		value_type* operator->() const { return &map->slots[index]; }
+		iterator& operator++() { index = map->NextFull(index+1); return *this; }
+		iterator operator++(int) { iterator tmp = *this; ++*this; return tmp; }
+		bool operator==(const iterator &it) const { return index==it.index; }
+		bool operator!=(const iterator &it) const { return index!=it.index; }
+
+	private:
+		friend class FlatMap;
+		FlatMap *map;
+		size_t index;
+	};
+
+	FlatMap() : ctrl(NULL), slots(NULL), capacity(0), count(0), deleted(0) {}
+	~FlatMap()
+	{
+		delete[] ctrl;
+		delete[] slots;
+	}
+
+	iterator begin() { return iterator(this, NextFull(0)); }
+	iterator end() { return iterator(this, capacity); }
+	size_t size() const { return count; }
+
+	/// makes room for n entries without rehashing
+	void reserve(size_t n)
+	{
+		size_t cap = CapacityFor(n);
+
+		// deleted slots count as used, rehashing drops them
+		if (CapacityFor(n + deleted) > capacity)
+			Rehash(cap > capacity ? cap : capacity);
+	}
+
+	void clear()
+	{
+		size_t i;
+		for (i=0;i<capacity;i++)
+			ctrl[i] = FLATMAP_EMPTY;
+		count = 0;
+		deleted = 0;
+	}
+
+	iterator find(const Key &key)
+	{
+		bool found;
+		size_t index;
+
+		if (count==0)
+			return end();
+		index = FindSlot(key, Mix(Hash()(key)), found);
+		return found ? iterator(this, index) : end();
+	}
+
+	std::pair<iterator, bool> insert(const value_type &entry)
+	{
+		uint64_t hash;
+		bool found;
+		size_t index;
+
+		// deleted slots count as used, leave room for half as many inserts after rehashing
+		if (count + deleted + 1 > capacity - capacity/8)
+			Rehash(CapacityFor(count + count/2 + 1));
+
+		hash = Mix(Hash()(entry.first));
+		index = FindSlot(entry.first, hash, found);
+		if (found)
+			return std::pair<iterator, bool>(iterator(this, index), false);
+
+		if (ctrl[index]==FLATMAP_DELETED)
+			deleted--;
+		ctrl[index] = hash >> 57;
+		slots[index] = entry;
+		count++;
+		return std::pair<iterator, bool>(iterator(this, index), true);
+	}
+
+	void erase(iterator it)
+	{
+		size_t index = it.index;
+		size_t group = index & ~(size_t)(FLATMAP_GROUP_SIZE-1);
+		size_t i;
+
+		// probes stop at the first group with an empty slot, so none passes this group
+		for (i=group;i<group+FLATMAP_GROUP_SIZE;i++)
+			if (ctrl[i]==FLATMAP_EMPTY)
+				break;
+		if (i < group+FLATMAP_GROUP_SIZE)
+			ctrl[index] = FLATMAP_EMPTY;
+		else
+		{
+			ctrl[index] = FLATMAP_DELETED;
+			deleted++;
+		}
+		// the slot is overwritten by the next insert, the maps only hold plain values
+		count--;
+	}
+
+	size_t erase(const Key &key)
+	{
+		iterator it = find(key);
+
+		if (it==end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+private:
+	unsigned char *ctrl;
+	value_type *slots;
+	size_t capacity; // power of two, at least one group
+	size_t count;
+	size_t deleted; // FLATMAP_DELETED slots
+
+	FlatMap(const FlatMap&);
+	FlatMap& operator=(const FlatMap&);
+
+	// the table hashes of page contents and pfns are not spread over all bits
+	static uint64_t Mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// keeps the load factor below 7/8
+	static size_t CapacityFor(size_t n)
+	{
+		size_t cap = FLATMAP_GROUP_SIZE;
+
+		while (cap - cap/8 < n)
+			cap *= 2;
+		return cap;
+	}
+
+	// returns the slot of the key or the first empty or deleted slot where it belongs
+	size_t FindSlot(const Key &key, uint64_t hash, bool &found) const
+	{
+		unsigned char tag = hash >> 57;
+		size_t group = hash & (capacity-1) & ~(size_t)(FLATMAP_GROUP_SIZE-1);
+		size_t free_slot = capacity;
+		unsigned int match, empty, erased;
+		int i;
+
+		while (1)
+		{
+#ifdef __SSE2__
+			__m128i g = _mm_loadu_si128((const __m128i*)(ctrl + group));
+			match = _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(tag)));
+			empty = _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)FLATMAP_EMPTY)));
+			erased = deleted==0 ? 0 : _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)FLATMAP_DELETED)));
+#else
+			match = 0;
+			empty = 0;
+			erased = 0;
+			for (i=0;i<FLATMAP_GROUP_SIZE;i++)
+			{
+				if (ctrl[group+i]==tag)
+					match |= 1u << i;
+				else if (ctrl[group+i]==FLATMAP_EMPTY)
+					empty |= 1u << i;
+				else if (ctrl[group+i]==FLATMAP_DELETED)
+					erased |= 1u << i;
+			}
+#endif
+			while (match!=0)
+			{
+				i = __builtin_ctz(match);
+				if (slots[group+i].first == key)
+				{
+					found = true;
+					return group+i;
+				}
+				match &= match-1;
+			}
+			if (erased!=0 && free_slot==capacity)
+				free_slot = group + __builtin_ctz(erased);
+			if (empty!=0)
+			{
+				found = false;
+				return free_slot!=capacity ? free_slot : group + __builtin_ctz(empty);
+			}
+			group = (group + FLATMAP_GROUP_SIZE) & (capacity-1);
+		}
+	}
+
+	size_t NextFull(size_t index) const
+	{
+		while (index < capacity && (ctrl[index] & 0x80))
+			index++;
+		return index;
+	}
+
+	void Rehash(size_t new_capacity)
+	{
+		unsigned char *old_ctrl = ctrl;
+		value_type *old_slots = slots;
+		size_t old_capacity = capacity;
+		size_t i, index;
+		bool found;
+
+		ctrl = new unsigned char[new_capacity];
+		slots = new value_type[new_capacity];
+		capacity = new_capacity;
+		clear();
+
+		for (i=0;i<old_capacity;i++)
+		{
+			if (old_ctrl[i] & 0x80)
+				continue;
+			uint64_t hash = Mix(Hash()(old_slots[i].first));
+			index = FindSlot(old_slots[i].first, hash, found);
+			ctrl[index] = hash >> 57;
+			slots[index] = old_slots[i];
+			count++;
+		}
+
+		delete[] old_ctrl;
+		delete[] old_slots;
+	}
+};
+
+#endif
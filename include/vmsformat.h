@@ -0,0 +1,69 @@
+/* This file contains the output formatter api
+   Text is collected in a large buffer and written with few write() calls.
+   Flag strings and hex digits come from lookup tables which are generated
+   from the Convert*Flags functions, so the output does not change.
+*/
+#ifndef VMSFORMAT_H
+#define VMSFORMAT_H
+
+#include "vmsnapshot.h"
+
+#define OUTPUT_BUFFER_SIZE (1<<20)
+
+/// Buffer in front of a file descriptor or in memory
+struct OutputBuffer
+{
+	int fd; // -1 for memory buffers
+	int failed; // set if text was lost
+	unsigned long used;
+	unsigned long size;
+	char *data;
+};
+
+/// Creates a buffer for a file descriptor
+/// stdout is flushed, so that printf output in front of the buffer stays in order
+/// @fd: file descriptor, e.g. STDOUT_FILENO
+/// return: on success, it returns a pointer to a buffer, which must be released
+///			on failure, it returns NULL
+struct OutputBuffer* CreateOutputBuffer(int fd);
+
+/// Creates a buffer in memory which grows if necessary
+/// @size: initial size
+/// return: on success, it returns a pointer to a buffer, which must be released
+///			on failure, it returns NULL
+struct OutputBuffer* CreateMemoryBuffer(unsigned long size);
+
+/// Writes the remaining text and releases the buffer
+void ReleaseOutputBuffer(struct OutputBuffer *out);
+
+/// Writes the buffered text to the file descriptor
+/// return: 0 on success, -1 on failure
+int FlushOutputBuffer(struct OutputBuffer *out);
+
+/// Writes the buffered text to another file descriptor, e.g. of a memory buffer
+/// return: 0 on success, -1 on failure
+int WriteOutputBuffer(struct OutputBuffer *out, int fd);
+
+void AppendString(struct OutputBuffer *out, const char *str);
+void AppendChars(struct OutputBuffer *out, const char *str, unsigned long len);
+void AppendChar(struct OutputBuffer *out, char c);
+
+/// like printf("%*lx", width, value)
+void AppendHex(struct OutputBuffer *out, unsigned long value, int width);
+/// like printf("%*ld", width, value)
+void AppendDecimal(struct OutputBuffer *out, long value, int width);
+/// like printf("%lu", value)
+void AppendUnsigned(struct OutputBuffer *out, unsigned long value);
+/// like PrintHash without the newline
+void AppendHash(struct OutputBuffer *out, const unsigned char *hash, int size);
+
+/// like ConvertVMFlags, ConvertPTEFlags and ConvertPageFlags
+void AppendVMFlags(struct OutputBuffer *out, unsigned long flags);
+void AppendPTEFlags(struct OutputBuffer *out, unsigned long flags);
+void AppendPageFlags(struct OutputBuffer *out, unsigned long flags);
+
+/// Formats like PrintPages and PrintVMA
+void FormatPages(struct OutputBuffer *out, VMSNAPSHOT snap, int start, int count);
+void FormatVMA(struct OutputBuffer *out, VMSNAPSHOT snap, int start, int count);
+
+#endif
@@ -0,0 +1,72 @@
+/* This file contains the snapshot index api
+   It maps addresses to page records without scanning the whole snapshot
+*/
+#ifndef VMSINDEX_H
+#define VMSINDEX_H
+
+#include "vmsnapshot.h"
+
+/// Index information of one virtual memory region
+struct VMAIndexEntry
+{
+	unsigned long start_address;
+	unsigned long end_address; // first address behind the region
+	int vma_index; // index into snap->vms
+	unsigned int page_count; // pages covered by the region
+	unsigned int record_start; // index of the first page record of the region
+	unsigned int record_count; // amount of page records of the region
+
+	// only used if records are not dense (VMS_ONLY_PRESENT_PAGES, physical snapshots)
+	uint64_t *present; // one bit per page of the region
+	unsigned int *rank; // records in front of every bitmap word
+};
+
+/// Index over a snapshot - the snapshot must stay valid while the index is used
+struct SnapshotIndex
+{
+	VMSNAPSHOT snap;
+	int count;
+	struct VMAIndexEntry *entries; // sorted by start_address
+};
+
+/// Iterates page records of an address range in ascending address order
+struct PageIterator
+{
+	struct SnapshotIndex *index;
+	unsigned long end_address;
+	int entry;
+	unsigned int offset; // next page offset inside the current entry
+	unsigned int record; // next record inside the current entry
+};
+
+/// Creates the index of a snapshot
+/// @snap: valid snapshot pointer
+/// return: on success, it returns a pointer to an index, which must be released
+///			on failure, it returns NULL
+struct SnapshotIndex* CreateSnapshotIndex(VMSNAPSHOT snap);
+
+/// @index: an index to be released
+void ReleaseSnapshotIndex(struct SnapshotIndex *index);
+
+/// Looks up the page record of an address
+/// physical snapshots are addressed by physical address
+/// @index: valid index
+/// @address: any address
+/// @vma_index: if not NULL, it receives the index into snap->vms
+/// return: the page record or NULL if the snapshot does not contain the page
+struct PageTableEntryInfo* LookupPage(struct SnapshotIndex *index, unsigned long address, int *vma_index);
+
+/// Finds the index entry containing address
+/// return: index into index->entries or -1
+int LookupVMA(struct SnapshotIndex *index, unsigned long address);
+
+/// Prepares iter to walk all page records in [start, end)
+void InitPageIterator(struct SnapshotIndex *index, unsigned long start, unsigned long end, struct PageIterator *iter);
+
+/// Fetches the next page record
+/// @address: receives the address of the page
+/// @vma_index: if not NULL, it receives the index into snap->vms
+/// return: the next page record or NULL at the end of the range
+struct PageTableEntryInfo* NextPage(struct PageIterator *iter, unsigned long *address, int *vma_index);
+
+#endif
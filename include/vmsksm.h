@@ -0,0 +1,116 @@
+/* This file contains the KSM merge simulator api
+   It replays a time series of snapshots through a model of ksmd: every
+   wakeup scans pages_to_scan pages of the mergeable regions in process and
+   address order. A page is merged once its hash did not change since the
+   last scan, either into a KSM page of the stable tree or with an equal
+   page of the unstable tree, which is emptied after every full scan. Pages
+   changed or unmapped by a later snapshot break their sharing (COW).
+   The page hashes of the snapshots stand in for the page compares.
+*/
+#ifndef VMSKSM_H
+#define VMSKSM_H
+
+#include "hashhelper.h"
+
+#define VMS_VM_MERGEABLE			0x80000000ul // vm_flags bit set by MADV_MERGEABLE
+#define KSM_VM_UNMERGEABLE			0x00404408ul // VM_SHARED, VM_PFNMAP, VM_IO and VM_HUGETLB regions are never merged
+
+#define KSM_DEFAULT_PAGES_TO_SCAN	100 // defaults of /sys/kernel/mm/ksm
+#define KSM_DEFAULT_SLEEP_MS		20
+#define KSM_DEFAULT_INTERVAL_MS		1000 // snapshot interval if the timestamps do not increase
+#define KSM_SCAN_COST_NS			1000 // checksum of a scanned page
+#define KSM_COMPARE_COST_NS			250 // page compare of a tree lookup
+
+#define KSM_NO_NODE					0xffffffffu
+
+/// Parameters of ksmd and of the cost model
+struct KSMParams
+{
+	unsigned int pages_to_scan;
+	unsigned int sleep_ms;
+	int all_anonymous; // treats every region as mergeable, like madvise on all anonymous memory
+	unsigned long scan_cost_ns;
+	unsigned long compare_cost_ns;
+};
+
+/// Counters like /sys/kernel/mm/ksm and the scan cost
+struct KSMStats
+{
+	unsigned long time_ms; // simulated time
+	unsigned long pages; // anonymous pages of mergeable regions
+	unsigned long pages_shared; // KSM pages
+	unsigned long pages_sharing; // further pages mapping KSM pages, the saved pages
+	unsigned long pages_unshared; // pages in the unstable tree
+	unsigned long pages_volatile; // pages changing too fast to be merged
+	unsigned long full_scans;
+	unsigned long pages_scanned;
+	unsigned long compares; // page compares of the tree lookups
+	unsigned long cow_breaks; // merged pages changed by the process
+	double cpu_ms; // scan cost of ksmd
+};
+
+struct KSMItem
+{
+	unsigned long address;
+	ContentKey key; // content of the last snapshot
+	ContentKey checksum; // content at the last scan
+	unsigned int node; // stable node or KSM_NO_NODE
+	unsigned char scanned; // checksum is valid
+};
+
+struct KSMProcess
+{
+	int pid;
+	vector<struct KSMItem> items; // sorted by address
+};
+
+struct KSMNode
+{
+	ContentKey key;
+	unsigned int mappers; // items merged into this KSM page
+};
+
+/// item of the unstable tree, it is checked on lookup as the items change
+struct KSMRef
+{
+	size_t process;
+	size_t item;
+};
+
+typedef FlatMap<ContentKey, unsigned int, HashKeyHash<CONTENT_KEY_SIZE> > KSMStableMap;
+typedef FlatMap<ContentKey, struct KSMRef, HashKeyHash<CONTENT_KEY_SIZE> > KSMUnstableMap;
+
+typedef struct KSMState
+{
+	struct KSMParams params;
+	vector<struct KSMProcess*> processes; // scan order
+	vector<struct KSMNode> nodes;
+	vector<unsigned int> free_nodes;
+	KSMStableMap *stable;
+	KSMUnstableMap *unstable;
+	size_t cursor_process, cursor_item;
+	unsigned long merged; // items merged into KSM pages
+	unsigned long pending_ms; // time since the last wakeup
+	int started;
+	struct KSMStats stats;
+} KSMSimulator;
+
+/// Fills params with the defaults of ksmd and of the cost model
+void InitKSMParams(struct KSMParams *params);
+
+/// @params: if NULL, the defaults are used
+KSMSimulator* CreateKSMSimulator(const struct KSMParams *params);
+
+void ReleaseKSMSimulator(KSMSimulator *sim);
+
+/// Runs ksmd until time_ms, then replaces the pages of the process of the snapshot
+/// @time_ms: time of the snapshot, not older than the last time
+/// return: 0 on success, -1 on failure
+int AddSnapshotToKSMSimulator(KSMSimulator *sim, VMSNAPSHOT snap, unsigned long time_ms);
+
+/// Runs ksmd until time_ms without new snapshots
+void RunKSMSimulator(KSMSimulator *sim, unsigned long time_ms);
+
+void GetKSMStats(KSMSimulator *sim, struct KSMStats *stats);
+
+#endif
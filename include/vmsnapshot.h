@@ -1,8 +1,12 @@
 /* This file contains the api
 
 */
+#ifndef VMSNAPSHOT_H
+#define VMSNAPSHOT_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <unistd.h>
 
 /// Defines for vm_snapshot flags
@@ -18,6 +22,29 @@
 #define VMS_HASH_PATTERN	64
 #define VMS_HASH_SHA1		128
 #define VMS_HASH_SUPERFAST	256
+/// 64 bit checksums of every chunk of a page, packed into the page hash
+#define VMS_HASH_CHUNKS		512
+
+/// chunk size of VMS_HASH_CHUNKS, default 1024 bytes
+#define VMS_CHUNK_2K		4096
+
+/// flags which select the page hash, snapshots are only comparable if they are equal
+#define VMS_HASH_MASK		(VMS_HASH_CRC32 | VMS_HASH_CRC32_EX | VMS_HASH_PATTERN | VMS_HASH_SHA1 | VMS_HASH_SUPERFAST | VMS_HASH_CHUNKS | VMS_CHUNK_2K)
+
+/// compressed size of every page for zswap/zram sizing, see compressed_size
+#define VMS_COMPRESS_LZO		8192 // lzo1x_1 like zram
+#define VMS_COMPRESS_ENTROPY	16384 // order-0 entropy estimate, faster
+
+/// SimHash of every page for near-duplicate detection, see sketch
+#define VMS_SKETCH_SIMHASH		32768
+
+/// frames mapped by several tasks are hashed once per batch, the first snapshot
+/// of a batch adds VMS_NEW_BATCH, the tasks must be frozen, see vmscgroup.h
+#define VMS_SHARED_FRAMES		65536
+#define VMS_NEW_BATCH			131072
+
+/// written alone with pid 0, it releases the snapshot and the frame cache of the module
+#define VMS_RELEASE_SNAPSHOT	1024
 
 // one for all
 #define DNAME_INLINE_LEN_MAX 40
@@ -30,6 +57,21 @@
 
 #define PAGE_NOT_AVAILABLE -42
 
+// page size used by the module (x86)
+#define VMS_PAGE_SHIFT		12
+#define VMS_PAGE_SIZE		(1ul<<VMS_PAGE_SHIFT)
+
+/// since this module version reserved contains the page offset inside its vma
+/// for snapshots taken with VMS_ONLY_PRESENT_PAGES
+#define VMS_VERSION_PAGE_OFFSET	0x43
+
+/// since this module version page records contain compressed_size, older
+/// records are recognized by their size and widened when they are loaded
+#define VMS_VERSION_COMPRESSED_SIZE	0x44
+
+/// since this module version page records contain sketch
+#define VMS_VERSION_SKETCH			0x45
+
 
 #define MAX_PIDS			1024
 
@@ -40,6 +82,10 @@
 #define HASH_CRC32EX_SIZE 16
 #define HASH_SP_SIZE 16
 #define HASH_SUPER_SIZE 4
+#define HASH_CHUNKS_SIZE 20
+
+// content keys of page hashes, see BuildContentKey
+#define HASH_KEY_SIZE 16
 
 struct PageTableEntryInfo
 {
@@ -52,13 +98,19 @@ struct PageTableEntryInfo
 	int reference_count; // _count.counter
 	int mapping_count; // _mapping.counter
 	int present;
-	int reserved;
+	int reserved; // page offset inside its vma for VMS_ONLY_PRESENT_PAGES
 
 	//page content hash
 	unsigned char hash[20]; //16 for just bytes, 32 for string, should be suitable for md5, crc32 and other patterns
 
+	unsigned short compressed_size; // bytes of the compressed page, 0 if not measured
+	uint64_t sketch; // SimHash of the 8 byte words of the page and their offsets, 0 if not measured
 }__attribute__((__packed__));
 
+// size of the page records before VMS_VERSION_COMPRESSED_SIZE and VMS_VERSION_SKETCH
+#define VMS_PAGE_RECORD_SIZE_V43	offsetof(struct PageTableEntryInfo, compressed_size)
+#define VMS_PAGE_RECORD_SIZE_V44	offsetof(struct PageTableEntryInfo, sketch)
+
 /// Virtual memory regions
 struct VirtualMemoryInfo
 {
@@ -131,6 +183,7 @@ struct InputParams
 	int autosave;
 	int csv;
 	int extra;
+	int max_pause; // ms a frozen cgroup may be paused, 0 for the default
 };
 
 /// Used for HashMap Collisions
@@ -165,6 +218,23 @@ struct CollisionInfo
 	int named_shared_counter;
 };
 
+/// Page classes of the CollisionInfo counters
+#define PAGE_CLASS_NAMED		0
+#define PAGE_CLASS_ANON			1
+#define PAGE_CLASS_HEAP			2
+#define PAGE_CLASS_STACK		3
+#define PAGE_CLASS_MASK			3
+#define PAGE_CLASS_WRITEABLE	4
+#define PAGE_CLASS_ZERO			8
+#define PAGE_CLASS_COUNT		16
+
+/// Shared pages and sharing ops counted by page class, see AddClassCounters
+struct ClassCounters
+{
+	int shared[PAGE_CLASS_COUNT];
+	int sharing_op[PAGE_CLASS_COUNT];
+};
+
 ///
 /// @pid: an existing process id
 /// @flags: any of the defined flags - can be 0
@@ -211,6 +281,10 @@ VMSNAPSHOT AcquireSnapshot(const char* input, int len);
 
 int MarkHeapAndStack(VMSNAPSHOT snap);
 
+/// return: the file name of a region, [heap] and [stack] for the regions of
+///			MarkHeapAndStack and [anon] for regions without a file
+const char* GetRegionName(const struct VirtualMemoryInfo *vma);
+
 /// This function takes a pid and suspends the execution of the associated task
 int SuspendTask(int pid);
 
@@ -331,10 +405,85 @@ int IsWriteable(unsigned long pte_flags);
 
 const unsigned char* GetZeroPageHash(int flags);
 
+/// return: bytes of the page hash written by the hash function of the snapshot flags
+int GetHashSize(int flags);
+
+/// return: bytes per chunk hashed separately by the hash function (VMS_HASH_CHUNKS,
+///			VMS_HASH_CRC32_EX), 0 if the page is hashed as a whole
+int GetChunkSize(int flags);
+
+/// return: bits of every chunk checksum in the page hash, 0 if there are no chunks
+int GetChunkBits(int flags);
+
+/// Extracts the checksum of a chunk from a page hash, zero chunks have the checksum 0
+/// @chunk: index of the chunk inside the page, < VMS_PAGE_SIZE / GetChunkSize(flags)
+uint64_t GetChunkHash(const unsigned char *hash, int flags, int chunk);
+
+/// Builds the HASH_KEY_SIZE bytes content key of a page hash
+/// The bytes behind shorter hashes are not written by the module and become zero,
+/// the bytes behind HASH_KEY_SIZE of longer hashes (SHA1) are folded into the key.
+/// With a constant hash_size the compiler specializes it for the hash size.
+static inline void BuildContentKey(const unsigned char *hash, int hash_size, unsigned char *key)
+{
+	int i;
+
+	if (hash_size >= HASH_KEY_SIZE)
+		memcpy(key, hash, HASH_KEY_SIZE);
+	else
+	{
+		memcpy(key, hash, hash_size);
+		memset(key + hash_size, 0, HASH_KEY_SIZE - hash_size);
+	}
+	for (i=HASH_KEY_SIZE;i<hash_size;i++)
+		key[i - HASH_KEY_SIZE] ^= hash[i];
+}
+
+/// Mixes a content key of BuildContentKey over all 64 bits
+/// CRC32 hashes fill only 4 of the bytes, sorted and sampled keys need all bits.
+static inline uint64_t HashContentKey(const unsigned char *key)
+{
+	uint64_t low, high, h;
+
+	memcpy(&low, key, sizeof(low));
+	memcpy(&high, key + sizeof(low), sizeof(high));
+
+	h = low ^ (high * 0x9e3779b97f4a7c15ull);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+/// Classifies every virtual memory region by its file name once
+/// Pages of regions with a path are named or anonymous depending on their inode,
+/// so every region has two classes: [2*i] for pages without, [2*i+1] with an inode.
+/// @snap: valid snapshot pointer
+/// return: on success, it returns 2*vm_region_count classes, which must be freed
+///			on failure, it returns NULL
+unsigned char* CreateVMAClasses(VMSNAPSHOT snap);
+
+/// Looks up the class of a present page with the classes of CreateVMAClasses
+static inline unsigned int GetPageClass(const unsigned char *vma_classes, const struct PageTableEntryInfo *page, const unsigned char *zerohash, int hash_size)
+{
+	return vma_classes[2*(page->present-1) + (page->inode_no>=1)]
+		| (unsigned int)(page->pte_flags & 2) << 1 // IsWriteable
+		| (memcmp(page->hash, zerohash, hash_size)==0) << 3;
+}
+
+/// Adds the counters of every page class to the CollisionInfo fields
+void AddClassCounters(struct CollisionInfo *info, const struct ClassCounters *counters);
+
 void PrintCollisionInfoHeader();
 
 void PrintCollisionInfo(struct CollisionInfo *info);
 
+/// Adds all counters of src to dest
+void MergeCollisionInfo(struct CollisionInfo *dest, const struct CollisionInfo *src);
+
 int CountSharedPages(VMSNAPSHOT snap);
 
 int CountAnonymousVMA(VMSNAPSHOT snap);
+
+#endif
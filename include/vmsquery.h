@@ -0,0 +1,109 @@
+/* This file contains the page query api
+   Queries filter and aggregate the pages of a snapshot, e.g.
+     writable && anon && refcount>1 group by vma
+
+   expression := term { || term }
+   term       := factor { && factor }
+   factor     := ! factor | ( expression ) | atom
+   atom       := flag | field op number | vma op "name" | hash op hexstring
+   flag       := present writable user accessed dirty nx anon named shared zero heap stack
+   field      := pfn pte flags inode refcount mapcount
+   op         := == != < <= > >= & (bit test)   vma also supports ~ (contains)
+   grouping   := group by vma | group by inode
+*/
+#ifndef VMSQUERY_H
+#define VMSQUERY_H
+
+#include "vmsnapshot.h"
+
+// fields of a page record
+#define QUERY_FIELD_PFN			0
+#define QUERY_FIELD_PTE			1
+#define QUERY_FIELD_FLAGS		2
+#define QUERY_FIELD_INODE		3
+#define QUERY_FIELD_REFCOUNT	4
+#define QUERY_FIELD_MAPCOUNT	5
+#define QUERY_FIELD_PRESENT		6
+
+// comparisons
+#define QUERY_EQ		0
+#define QUERY_NE		1
+#define QUERY_LT		2
+#define QUERY_LE		3
+#define QUERY_GT		4
+#define QUERY_GE		5
+#define QUERY_BITS		6
+#define QUERY_CONTAINS	7
+
+// operations of a compiled query - evaluated in postfix order
+#define QUERY_OP_FIELD	0 // field cmp value
+#define QUERY_OP_VMA	1 // vma name cmp text
+#define QUERY_OP_HEAP	2
+#define QUERY_OP_STACK	3
+#define QUERY_OP_HASH	4 // hash cmp hash[hash_len]
+#define QUERY_OP_ZERO	5
+#define QUERY_OP_AND	6
+#define QUERY_OP_OR		7
+#define QUERY_OP_NOT	8
+
+#define QUERY_GROUP_NONE	0
+#define QUERY_GROUP_VMA		1
+#define QUERY_GROUP_INODE	2
+
+struct QueryOp
+{
+	int type;
+	int field;
+	int cmp;
+	unsigned long value;
+	char text[DNAME_INLINE_LEN_MAX];
+	unsigned char hash[20];
+	int hash_len;
+};
+
+struct PageQuery
+{
+	int op_count;
+	int max_depth; // masks required during evaluation
+	int group_by;
+	struct QueryOp *ops;
+};
+
+struct QueryGroup
+{
+	unsigned long key; // vma index or inode
+	unsigned long count;
+};
+
+struct QueryResult
+{
+	int group_by;
+	unsigned long scanned;
+	unsigned long matched;
+	int group_count;
+	struct QueryGroup *groups;
+};
+
+/// Compiles a query
+/// @query: query string
+/// return: on success, it returns a pointer to a query, which must be released
+///			on failure, it prints the error and returns NULL
+struct PageQuery* CompilePageQuery(const char *query);
+
+/// @query: a query to be released
+void ReleasePageQuery(struct PageQuery *query);
+
+/// Evaluates the query blockwise over all pages of a snapshot
+/// @query: compiled query
+/// @snap: valid snapshot pointer
+/// return: on success, it returns a pointer to a result, which must be released
+///			on failure, it returns NULL
+struct QueryResult* RunPageQuery(struct PageQuery *query, VMSNAPSHOT snap);
+
+/// @result: a result to be released
+void ReleaseQueryResult(struct QueryResult *result);
+
+/// Prints a query result in csv format
+void PrintQueryResult(VMSNAPSHOT snap, struct QueryResult *result);
+
+#endif
@@ -0,0 +1,78 @@
+/* This file contains the per file sharing report api
+   The sort-merge dedup counts the pages of every mapped file, identified by
+   inode and file name, and the shareable pages of every pair of files, i.e.
+   the file of a duplicate page and the file of the page kept for its content.
+   Files are interned into compact ids when the snapshots are added, so the
+   dedup tuples only carry a 4 byte id and the report needs no extra pass.
+*/
+#ifndef VMSREPORT_H
+#define VMSREPORT_H
+
+#include "vmsnapshot.h"
+
+#define REPORT_DEFAULT_TOP	20
+#define REPORT_NO_FILE		0xffffffffu
+
+/// Pages of one mapped file in all snapshots
+struct FileSharing
+{
+	unsigned long inode;
+	char file_name[DNAME_INLINE_LEN_MAX];
+	unsigned long pages; // present pages
+	unsigned long shareable;
+	unsigned long shared;
+	unsigned long sharing_op;
+};
+
+/// Shareable pages of file whose contents are kept in pages of first
+struct FilePairSharing
+{
+	unsigned int file;
+	unsigned int first;
+	unsigned long shareable;
+};
+
+struct FileReport
+{
+	struct FileSharing *files; // indexed by file id
+	unsigned int file_count;
+	unsigned int file_capacity;
+	unsigned int *buckets; // first file id of every hash bucket or REPORT_NO_FILE
+	unsigned int *chain; // next file id of the same bucket
+	unsigned int bucket_count; // power of two
+
+	uint64_t *pair_keys; // first << 32 | file of every shareable page, until FinishFileReport
+	unsigned long pair_key_count;
+	unsigned long pair_key_capacity;
+	struct FilePairSharing *pairs; // sorted by shareable pages, descending
+	unsigned long pair_count;
+	int failed; // set if pairs were lost
+};
+
+/// Creates an empty report
+/// return: on success, it returns a pointer to a report, which must be released
+///			on failure, it returns NULL
+struct FileReport* CreateFileReport();
+
+/// @report: a report to be released
+void ReleaseFileReport(struct FileReport *report);
+
+/// Interns the files of all regions of a snapshot
+/// heap, stack and regions without a name are reported as [heap], [stack] and [anon]
+/// @vma_files: receives the file id of every region, room for vm_region_count ids
+/// return: 0 on success, -1 on failure
+int AddSnapshotFiles(struct FileReport *report, VMSNAPSHOT snap, unsigned int *vma_files);
+
+/// Counts a shareable page of file whose content is kept in a page of first
+/// return: 0 on success, -1 on failure, then failed is set
+int AddFilePair(struct FileReport *report, unsigned int file, unsigned int first);
+
+/// Sums up the pages of every file pair and sorts the pairs
+/// return: 0 on success, -1 on failure or if pairs were lost
+int FinishFileReport(struct FileReport *report);
+
+/// Prints the files and the file pairs with the most shareable pages in csv format
+/// @top: amount of rows of each table, <= 0 uses REPORT_DEFAULT_TOP
+void PrintFileReport(struct FileReport *report, int top);
+
+#endif
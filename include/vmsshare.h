@@ -0,0 +1,41 @@
+/* This file contains the pairwise sharing api
+   It computes for every pair of snapshots A and B the amount of present pages
+   of A whose content also exists in B, e.g. to decide which processes should
+   run on the same host. All snapshots are indexed once:
+     exact:  the page tuples of all snapshots are sorted by hash (see vmsdedup.h),
+             every run of equal hashes adds its pages to the pairs of its snapshots
+     approx: every snapshot gets a bottom-k MinHash signature of its contents,
+             the signatures of a pair estimate the distinct shared contents,
+             which are scaled by the pages per content of A
+*/
+#ifndef VMSSHARE_H
+#define VMSSHARE_H
+
+#include "vmsnapshot.h"
+
+#define SHARE_DEFAULT_SIGNATURE 256 // hashes per MinHash signature
+
+/// Sharing matrix of count snapshots
+struct SharingMatrix
+{
+	int count;
+	unsigned long *pages; // pages[a*count+b]: pages of a which exist in b, pages[a*count+a]: present pages of a
+};
+
+/// Computes the exact sharing matrix
+/// @snaps: valid snapshot pointers
+/// @thread_count: threads of the radix sort, <= 0 uses all online cpus
+/// return: on success, it returns a pointer to a matrix, which must be released
+///			on failure, it returns NULL
+struct SharingMatrix* ComputeSharingMatrix(VMSNAPSHOT *snaps, int count, int thread_count);
+
+/// Estimates the sharing matrix with MinHash signatures
+/// @signature_size: hashes per signature, <= 0 uses SHARE_DEFAULT_SIGNATURE
+/// return: on success, it returns a pointer to a matrix, which must be released
+///			on failure, it returns NULL
+struct SharingMatrix* EstimateSharingMatrix(VMSNAPSHOT *snaps, int count, int signature_size);
+
+/// @matrix: a matrix to be released
+void ReleaseSharingMatrix(struct SharingMatrix *matrix);
+
+#endif
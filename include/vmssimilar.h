@@ -0,0 +1,45 @@
+/* This file contains the near-duplicate page api
+   Snapshots taken with VMS_SKETCH_SIMHASH carry a 64 bit SimHash of every page,
+   pages which differ in a few words differ in a few sketch bits. The distinct
+   contents of all snapshots are indexed by LSH: the sketch is split into
+   max_distance+1 bands, so two sketches within max_distance bits are equal in
+   at least one band. Contents with an equal band are compared, and near
+   duplicates are grouped with union-find. Every group keeps one content and
+   could store the others as deltas, the delta size is estimated from the
+   sketch distance: equal words ~ cos(pi * distance / 64).
+*/
+#ifndef VMSSIMILAR_H
+#define VMSSIMILAR_H
+
+#include "vmsnapshot.h"
+
+#define SIMILAR_DEFAULT_DISTANCE	3 // sketch bits two near duplicates may differ in
+#define SIMILAR_MAX_DISTANCE		7 // at least 8 bits per band
+#define SIMILAR_MAX_RUN				64 // contents compared with each content of an equal band
+#define SIMILAR_MIN_DELTA			64 // bytes of the smallest delta
+
+/// Near duplicates of all snapshots, exact duplicates and zero pages are left to the dedup
+struct SimilarityInfo
+{
+	unsigned long pages; // present pages with a sketch, without zero pages
+	unsigned long contents; // distinct contents of these pages
+	unsigned long candidates; // content pairs compared
+	unsigned long groups; // groups of near duplicate contents
+	unsigned long grouped_contents; // contents in these groups
+	unsigned long grouped_pages; // pages of these contents
+	unsigned long delta_contents; // contents stored as delta, grouped_contents - groups
+	unsigned long delta_bytes; // estimated size of their deltas
+};
+
+/// Groups the near duplicate contents of all snapshots
+/// @snaps: valid snapshot pointers taken with VMS_SKETCH_SIMHASH
+/// @max_distance: sketch bits near duplicates may differ in, <= 0 uses SIMILAR_DEFAULT_DISTANCE
+/// return: 0 on success, -1 on failure or if a snapshot has no sketches
+int FindNearDuplicates(VMSNAPSHOT *snaps, int count, int max_distance, struct SimilarityInfo *info);
+
+void PrintSimilarityInfoHeader();
+
+/// Prints the counters and the MB saved by storing the delta contents as deltas
+void PrintSimilarityInfo(const struct SimilarityInfo *info);
+
+#endif
@@ -0,0 +1,58 @@
+/* This file contains the unique page estimator api
+   A HyperLogLog sketch counts the distinct page contents of snapshots in a
+   few kilobytes. Sketches of the same precision and hash type can be merged,
+   so the distinct pages of many snapshots can be estimated from the sketches
+   saved next to the snapshot files, without loading the snapshots again.
+   The relative error is about 1.04 / sqrt(2^precision), 0.8% for precision 14.
+*/
+#ifndef VMSSKETCH_H
+#define VMSSKETCH_H
+
+#include "vmsnapshot.h"
+
+#define SKETCH_MIN_PRECISION		4
+#define SKETCH_MAX_PRECISION		18
+#define SKETCH_DEFAULT_PRECISION	14 // 16 KB registers
+#define SKETCH_EXTENSION			".hll"
+
+// set in hash_flags once a snapshot was added, MD5 pages have no VMS_HASH_* flag
+#define SKETCH_HASH_SET				0x80000000
+
+/// HyperLogLog sketch of page contents
+struct PageSketch
+{
+	int precision; // 2^precision registers
+	unsigned int hash_flags; // VMS_HASH_* flags of the added snapshots | SKETCH_HASH_SET, 0 while empty
+	unsigned char *registers;
+};
+
+/// Creates an empty sketch
+/// @precision: SKETCH_MIN_PRECISION to SKETCH_MAX_PRECISION, <= 0 uses SKETCH_DEFAULT_PRECISION
+/// return: on success, it returns a pointer to a sketch, which must be released
+///			on failure, it returns NULL
+struct PageSketch* CreatePageSketch(int precision);
+
+/// @sketch: a sketch to be released
+void ReleasePageSketch(struct PageSketch *sketch);
+
+/// Adds the hashes of all present pages of a snapshot
+/// return: 0 on success, -1 if the snapshot uses another hash than the sketch
+int AddSnapshotToSketch(struct PageSketch *sketch, VMSNAPSHOT snap);
+
+/// Adds the registers of src to dest, afterwards dest counts the union of both
+/// return: 0 on success, -1 if the precision or the hash differs
+int MergePageSketch(struct PageSketch *dest, const struct PageSketch *src);
+
+/// return: the estimated amount of distinct page contents
+unsigned long EstimateDistinctPages(const struct PageSketch *sketch);
+
+/// Saves a sketch, e.g. to the snapshot path with SKETCH_EXTENSION appended
+/// return: 0 on success, -1 on failure
+int SavePageSketch(const char *path, const struct PageSketch *sketch);
+
+/// Loads a sketch saved by SavePageSketch
+/// return: on success, it returns a pointer to a sketch, which must be released
+///			on failure, it returns NULL
+struct PageSketch* LoadPageSketch(const char *path);
+
+#endif
@@ -0,0 +1,85 @@
+/* This file contains the working set api
+   A single snapshot only shows which pages were accessed at some time since
+   the Accessed bits were cleared last. The working set is sampled instead:
+   every sample clears the Accessed bits of the task (/proc/pid/clear_refs),
+   waits an interval and takes a snapshot, the pages with the Accessed bit in
+   pte_flags were used during the interval. With page idle tracking the bits
+   are not touched, the pfns of a snapshot are marked idle in
+   /sys/kernel/mm/page_idle/bitmap and the pages which are not idle after the
+   interval were used, also through the mappings of other tasks.
+   The access counts are kept per page address across the samples, a page is
+   hot if it was used in at least hot_samples of them, warm if it was used
+   less often and cold if it was never used. Both interfaces need root.
+*/
+#ifndef VMSWORKSET_H
+#define VMSWORKSET_H
+
+#include "vmsnapshot.h"
+#include "vmsindex.h"
+
+#define WORKSET_DEFAULT_SAMPLES		10
+#define WORKSET_DEFAULT_INTERVAL_MS	1000
+#define WORKSET_DEFAULT_HOT_PERCENT	50 // of the samples a hot page was used in
+
+// default snapshot flags of the samples, hashes are not needed
+#define WORKSET_DEFAULT_FLAGS		(VMS_ALLOW_RAW_OUTPUT | VMS_ONLY_PRESENT_PAGES | VMS_HASH_CRC32)
+
+// Accessed bit of pte_flags, "Ac" of PTEFLAGSTOCHAR
+#define VMS_PTE_ACCESSED			0x20
+
+#define PAGE_IDLE_BITMAP			"/sys/kernel/mm/page_idle/bitmap"
+
+/// Access counts of a task over all samples
+struct WorkingSet
+{
+	int pid;
+	int flags; // snapshot flags of the samples
+	int page_idle; // samples with page idle tracking instead of clear_refs
+	int samples; // samples taken so far
+	VMSNAPSHOT snap; // the last sample
+	struct SnapshotIndex *index; // index of snap
+	unsigned short *access_counts; // samples every page record of snap was used in
+};
+
+/// Hot, warm and cold pages of a region or of the whole task
+struct WorkingSetInfo
+{
+	unsigned long pages; // present pages of the last sample
+	unsigned long hot; // used in at least hot_samples samples
+	unsigned long warm; // used in fewer samples
+	unsigned long cold; // not used in any sample
+};
+
+/// Creates an empty working set of a task
+/// @pid: an existing process id
+/// @flags: snapshot flags of the samples, 0 uses WORKSET_DEFAULT_FLAGS
+/// @page_idle: if not 0, the samples use PAGE_IDLE_BITMAP instead of clear_refs
+/// return: on success, it returns a pointer to a working set, which must be released
+///			on failure, it returns NULL
+struct WorkingSet* CreateWorkingSet(int pid, int flags, int page_idle);
+
+/// @ws: a working set to be released
+void ReleaseWorkingSet(struct WorkingSet *ws);
+
+/// Takes one sample, the pages used during the next interval_ms are counted
+/// @ws: valid working set
+/// return: 0 on success, -1 on failure, the earlier samples are kept
+int SampleWorkingSet(struct WorkingSet *ws, unsigned long interval_ms);
+
+/// Sorts the present pages of the last sample into hot, warm and cold
+/// @hot_samples: samples a hot page was used in, at least 1
+/// return: on success, it returns vm_region_count+1 entries of the last sample,
+///			the last entry sums up all regions, which must be freed
+///			on failure, it returns NULL
+struct WorkingSetInfo* ComputeWorkingSetInfo(struct WorkingSet *ws, int hot_samples);
+
+void PrintWorkingSetInfoHeader();
+
+/// Prints the counters and their size in MB of every region with present pages and of the task
+/// @infos: the entries of ComputeWorkingSetInfo
+void PrintWorkingSet(struct WorkingSet *ws, const struct WorkingSetInfo *infos);
+
+/// Prints the address, the region and the access count of every present page
+void PrintAccessCounts(struct WorkingSet *ws);
+
+#endif
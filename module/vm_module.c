@@ -50,6 +50,20 @@
 #define VMS_HASH_PATTERN	64
 #define VMS_HASH_SHA1		128
 #define VMS_HASH_SUPERFAST	256
+#define VMS_HASH_CHUNKS		512
+
+#define VMS_CHUNK_2K		4096 // chunk size of VMS_HASH_CHUNKS, default 1024
+
+#define VMS_COMPRESS_LZO	8192 // compressed size of every page with lzo1x_1
+#define VMS_COMPRESS_ENTROPY	16384 // order-0 entropy estimate of every page
+
+#define VMS_SKETCH_SIMHASH	32768 // similarity sketch of every page
+
+#define VMS_SHARED_FRAMES	65536 // frames mapped by several tasks are hashed once per batch
+#define VMS_NEW_BATCH		131072 // clears the frame cache, first snapshot of a batch
+
+#define FRAME_CACHE_BITS	12
+#define FRAME_CACHE_LIFETIME_MS	60000 // a batch which is not released is dropped after this time
 
 #define VMS_RELEASE_SNAPSHOT	1024
 
@@ -90,7 +104,7 @@
 // DNAME_INLINE_LEN set to the maximum so far
 #define DNAME_INLINE_LEN_MAX 40
 
-#define VM_MODULE_VERSION 0x42
+#define VM_MODULE_VERSION 0x45
 
 // for proc_fs
 #include <linux/proc_fs.h>
@@ -103,6 +117,12 @@
 #include <linux/scatterlist.h>
 // for crc32 
 #include <linux/crc32.h>
+// for compressed page sizes
+#include <linux/lzo.h>
+// for the frame cache
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
 
 
 // GPL stuff, to keep the kernel nice and clean
@@ -124,11 +144,13 @@ struct PageTableEntryInfo
 	int reference_count; // _count.counter
 	int mapping_count; // _mapping.counter
 	int present;
-	int reserved;
+	int reserved; // page offset inside its vma for VMS_ONLY_PRESENT_PAGES
 
 	//page content hash
 	unsigned char hash[20]; //20 for just bytes, 40 for string, should be suitable for md5, crc32 and other patterns
 
+	unsigned short compressed_size; // bytes of the compressed page, 0 if not measured
+	u64 sketch; // SimHash of the 8 byte words of the page and their offsets, 0 if not measured
 }__attribute__((__packed__));
 
 /// Virtual memory regions
@@ -208,6 +230,32 @@ struct input_buffer
 };
 
 
+// compressed size function of the current snapshot or NULL
+static int (*compress_page)(struct page *pg, unsigned short *result) = NULL;
+// sketch function of the current snapshot or NULL
+static int (*sketch_page)(struct page *pg, u64 *result) = NULL;
+// lzo buffers, allocated before the page table lock is taken
+static unsigned char *lzo_wrkmem = NULL;
+static unsigned char *lzo_dst = NULL;
+
+/// hash, compressed size and sketch of a shared frame, valid for one batch
+/// mapping, index and count identify the page of the frame when it was hashed
+struct frame_cache_entry
+{
+	struct hlist_node node;
+	unsigned long pfn;
+	struct address_space *mapping;
+	pgoff_t index;
+	int count;
+	unsigned char hash[MAX_HASH_SIZE];
+	unsigned short compressed_size;
+	u64 sketch;
+};
+
+// buckets of the frame cache of the current batch or NULL
+static struct hlist_head *frame_cache = NULL;
+static unsigned long frame_cache_expires = 0; // in jiffies
+
 // functions
 
 static int process_input(const char *buffer, struct input_buffer *result);
@@ -219,6 +267,9 @@ static int hash_page_crc32(struct page *pg, char *result);
 static int hash_page_crc32_ex(struct page *pg, char *result);
 static int hash_page_pattern(struct page *pg, char *result);
 static int hash_page_superfast(struct page *pg, char *result);
+static int hash_page_chunks(struct page *pg, char *result, int chunk_size);
+static int hash_page_chunks1k(struct page *pg, char *result);
+static int hash_page_chunks2k(struct page *pg, char *result);
 
 uint32_t SuperFastHash (const char * data, int len);
 
@@ -255,6 +306,20 @@ static unsigned long collect_frame_data(unsigned long pfnno, unsigned int count,
 
 int (*get_hashfunction(int flags))(struct page *pg, char *result);
 
+// compressed size functions - they run under the page table lock and must not sleep
+static int compress_page_lzo(struct page *pg, unsigned short *result);
+static int compress_page_entropy(struct page *pg, unsigned short *result);
+static int (*get_compressfunction(int flags))(struct page *pg, unsigned short *result);
+static void release_compress_buffers(void);
+
+// similarity sketch of a page
+static int sketch_page_simhash(struct page *pg, u64 *result);
+
+// hashing of the frames of a process snapshot, shared frames are looked up in the frame cache
+static void hash_frame(struct page *pg, struct PageTableEntryInfo *pages, int (*hash_page)(struct page *pg, char *result));
+static int prepare_frame_cache(int flags);
+static void release_frame_cache(void);
+
 
 // snapshot pointer
 static struct SnapshotInfo *gl_snapshot_ptr = NULL;
@@ -274,6 +339,8 @@ void cleanup_module(void)
 	release_procfs_entry();
 	
 	release_global_snapshot();
+	release_compress_buffers();
+	release_frame_cache();
 
 	printk(KERN_INFO "Kernel module vm_snapshot unloaded.\n");
 }
@@ -366,10 +433,12 @@ static int write_proc_vm_snapshot(struct file *filp, char *buffer, size_t count,
 	buf[len] = '\0';
 	if (process_input(buf, &input)==0)
 	{
-		if (input.flags == VMS_RELEASE_SNAPSHOT)
+		// process_input adds VMS_ALLOW_RAW_OUTPUT to every request
+		if ((input.flags & ~VMS_ALLOW_RAW_OUTPUT) == VMS_RELEASE_SNAPSHOT)
 		{
 			release_global_snapshot();
-			return 0;
+			release_frame_cache();
+			return count;
 		}
 
 		if (input.pid == 0)
@@ -727,6 +796,11 @@ static int take_snapshot(struct input_buffer *input, struct SnapshotInfo **ptr)
 	// timestamp for measurements
 	snapshot->timestamp_begin = jiffies_to_msecs(jiffies);
 
+	// may allocate, so before the spinlock
+	compress_page = get_compressfunction(input->flags);
+	sketch_page = input->flags & VMS_SKETCH_SIMHASH ? sketch_page_simhash : NULL;
+	prepare_frame_cache(input->flags);
+
 	//take page table spinlock
 	spin_lock(&meminfo->page_table_lock);
 
@@ -795,6 +869,7 @@ static int take_snapshot(struct input_buffer *input, struct SnapshotInfo **ptr)
 		
 	// release spinlock
 	spin_unlock(&meminfo->page_table_lock);
+	release_compress_buffers();
 
 	// release semaphore
 	up_read(&meminfo->mmap_sem);
@@ -1113,7 +1188,7 @@ static unsigned long collect_complete_page_data(int index, struct mm_struct* mem
 					}
 				}
 
-				hash_page(cur_page, pages->hash);
+				hash_frame(cur_page, pages, hash_page);
 				
 				vminfo->present_page_count++;
 			}
@@ -1251,8 +1326,11 @@ static unsigned long collect_page_data(int index, struct mm_struct* meminfo, str
 					}
 				}
 				
-				hash_page(cur_page, pages->hash);
-				
+				hash_frame(cur_page, pages, hash_page);
+
+				// address is not stored otherwise - userland needs it for lookups
+				pages->reserved			= (cur_addr - vma->vm_start) >> PAGE_SHIFT;
+
 				vminfo->present_page_count++;
 
 			}
@@ -1352,6 +1430,10 @@ static unsigned long collect_frame_data(unsigned long pfnno, unsigned int count,
 					}
 		hash:
 					hash_page(cur_page, pages->hash);
+					if (compress_page!=NULL)
+						compress_page(cur_page, &pages->compressed_size);
+					if (sketch_page!=NULL)
+						sketch_page(cur_page, &pages->sketch);
 					
 					pages++;
 					ret++;
@@ -1599,6 +1681,54 @@ static int hash_page_superfast(struct page *pg, char *result)
 	return 0;
 }
 
+/// creates a 64 bit checksum of every chunk_size bytes, crc32_le and crc32_be
+/// the checksums are truncated to 160/chunks bits (at most 64) and packed
+/// pg: is a pointer to a page (PAGE_SIZE)
+/// result: must contain at least 20 bytes (160 bit)
+static int hash_page_chunks(struct page *pg, char *result, int chunk_size)
+{
+	char *buffer;
+	u64 value;
+	int chunks, bits, pos, i, b;
+
+	chunks = PAGE_SIZE / chunk_size;
+	bits = MAX_HASH_SIZE * 8 / chunks;
+	if (bits > 64)
+		bits = 64;
+
+	buffer = (char*) kmap_atomic(pg);
+	if (buffer==NULL)
+	{
+		printk(KERN_ALERT "Unable to map page.\n");
+		return -1;
+	}
+
+	memset(result, 0, MAX_HASH_SIZE);
+	pos = 0;
+	for (i=0;i<chunks;i++)
+	{
+		// zero chunks have the checksum 0
+		value = (u64)crc32_be(0, buffer + i*chunk_size, chunk_size) << 32 | crc32(0, buffer + i*chunk_size, chunk_size);
+		for (b=0;b<bits;b++,pos++)
+			if (value & (1ull << b))
+				result[pos/8] |= 1 << (pos%8);
+	}
+
+	kunmap_atomic(buffer);
+
+	return 0;
+}
+
+static int hash_page_chunks1k(struct page *pg, char *result)
+{
+	return hash_page_chunks(pg, result, 1024);
+}
+
+static int hash_page_chunks2k(struct page *pg, char *result)
+{
+	return hash_page_chunks(pg, result, 2048);
+}
+
 #define get16bits(d) (*((const uint16_t *) (d)))
 
 //TODO implement SuperFastHash Not implemented yet
@@ -1686,6 +1816,15 @@ int (*get_hashfunction(int flags))(struct page *pg, char *result)
 #endif
 		return hash_page_superfast;
 	}
+	else if (flags & VMS_HASH_CHUNKS)
+	{
+#ifdef IDEBUG
+		printk(KERN_INFO "Using hash_page_chunks.\n");
+#endif
+		if (flags & VMS_CHUNK_2K)
+			return hash_page_chunks2k;
+		return hash_page_chunks1k;
+	}
 	else
 	{
 #ifdef IDEBUG
@@ -1696,6 +1835,254 @@ int (*get_hashfunction(int flags))(struct page *pg, char *result)
 
 }
 
+/// stores the size of the page compressed with lzo1x_1
+/// pg: is a pointer to a page (PAGE_SIZE)
+/// result: receives the compressed size, PAGE_SIZE if the page does not shrink
+static int compress_page_lzo(struct page *pg, unsigned short *result)
+{
+	char *buffer;
+	size_t len = lzo1x_worst_compress(PAGE_SIZE);
+	int ret;
+
+	buffer = (char*) kmap_atomic(pg);
+	if (buffer==NULL)
+	{
+		printk(KERN_ALERT "Unable to map page.\n");
+		return -1;
+	}
+
+	ret = lzo1x_1_compress(buffer, PAGE_SIZE, lzo_dst, &len, lzo_wrkmem);
+
+	kunmap_atomic(buffer);
+
+	if (ret!=LZO_E_OK)
+		return -1;
+	*result = len < PAGE_SIZE ? len : PAGE_SIZE;
+	return 0;
+}
+
+// log2(1 + m/16) * 256
+static const unsigned short LOG2_FRACTION[16] = {0, 22, 44, 63, 82, 100, 118, 134, 150, 165, 179, 193, 207, 220, 232, 244};
+
+/// estimates the compressed size from the byte histogram (order-0 entropy)
+/// the kernel has no floating point, log2 is approximated with 1/256 bits
+/// pg: is a pointer to a page (PAGE_SIZE)
+/// result: receives the estimated size in bytes, at least 1
+static int compress_page_entropy(struct page *pg, unsigned short *result)
+{
+	unsigned char *buffer;
+	unsigned short counts[256];
+	unsigned long bits = 0;
+	unsigned int c, e;
+	int i;
+
+	buffer = (unsigned char*) kmap_atomic(pg);
+	if (buffer==NULL)
+	{
+		printk(KERN_ALERT "Unable to map page.\n");
+		return -1;
+	}
+
+	memset(counts, 0, sizeof(counts));
+	for (i=0;i<PAGE_SIZE;i++)
+		counts[buffer[i]]++;
+
+	kunmap_atomic(buffer);
+
+	// bits = sum c * log2(PAGE_SIZE / c)
+	for (i=0;i<256;i++)
+	{
+		c = counts[i];
+		if (c==0)
+			continue;
+		e = fls(c) - 1;
+		bits += c * ((PAGE_SHIFT << 8) - ((e << 8) + LOG2_FRACTION[((c << 4) >> e) & 15]));
+	}
+
+	bits >>= 8;
+	*result = bits < 8 ? 1 : bits / 8;
+	return 0;
+}
+
+static int (*get_compressfunction(int flags))(struct page *pg, unsigned short *result)
+{
+	if (flags & VMS_COMPRESS_LZO)
+	{
+		release_compress_buffers();
+		lzo_wrkmem = (unsigned char*) vmalloc(LZO1X_1_MEM_COMPRESS);
+		lzo_dst = (unsigned char*) vmalloc(lzo1x_worst_compress(PAGE_SIZE));
+		if (lzo_wrkmem==NULL || lzo_dst==NULL)
+		{
+			printk(KERN_ALERT "OUT_OF_MEMORY: allocating lzo buffers\n");
+			release_compress_buffers();
+			return NULL;
+		}
+#ifdef IDEBUG
+		printk(KERN_INFO "Using compress_page_lzo.\n");
+#endif
+		return compress_page_lzo;
+	}
+	else if (flags & VMS_COMPRESS_ENTROPY)
+	{
+#ifdef IDEBUG
+		printk(KERN_INFO "Using compress_page_entropy.\n");
+#endif
+		return compress_page_entropy;
+	}
+	return NULL;
+}
+
+/// creates a 64 bit SimHash over the aligned 8 byte words of a page and their offsets
+/// pages which differ in a few words differ in a few bits, like an in-place delta
+/// pg: is a pointer to a page (PAGE_SIZE)
+/// result: receives the sketch
+static int sketch_page_simhash(struct page *pg, u64 *result)
+{
+	u64 *words;
+	u64 h, sketch = 0;
+	unsigned short ones[64];
+	int i, b;
+
+	words = (u64*) kmap_atomic(pg);
+	if (words==NULL)
+	{
+		printk(KERN_ALERT "Unable to map page.\n");
+		return -1;
+	}
+
+	memset(ones, 0, sizeof(ones));
+	for (i=0;i<PAGE_SIZE/8;i++)
+	{
+		// every word votes with the bits of its mixed value, zero words vote by offset
+		h = (words[i] + i * 0x632be59bd9b4e019ull) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 29;
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 32;
+		for (b=0;b<64;b++)
+			ones[b] += (h >> b) & 1;
+	}
+
+	kunmap_atomic(words);
+
+	for (b=0;b<64;b++)
+		if (ones[b] > PAGE_SIZE/16)
+			sketch |= 1ull << b;
+	*result = sketch;
+	return 0;
+}
+
+static void release_compress_buffers(void)
+{
+	if (lzo_wrkmem!=NULL)
+		vfree(lzo_wrkmem);
+	if (lzo_dst!=NULL)
+		vfree(lzo_dst);
+	lzo_wrkmem = NULL;
+	lzo_dst = NULL;
+}
+
+/// hashes a frame of a process snapshot together with its compressed size and sketch
+/// frames mapped by several tasks are computed once per batch of VMS_SHARED_FRAMES snapshots
+/// pg: is a pointer to a page (PAGE_SIZE)
+/// pages: the page record, pfn and mapping_count are already set
+static void hash_frame(struct page *pg, struct PageTableEntryInfo *pages, int (*hash_page)(struct page *pg, char *result))
+{
+	struct frame_cache_entry *entry = NULL;
+	struct hlist_head *bucket = NULL;
+	struct hlist_node *pos;
+
+	// _mapcount starts at -1, so frames of several mappings are > 0
+	if (frame_cache!=NULL && pages->mapping_count > 0)
+	{
+		bucket = &frame_cache[hash_long(pages->pfn, FRAME_CACHE_BITS)];
+		for (pos=bucket->first;pos!=NULL;pos=pos->next)
+		{
+			entry = hlist_entry(pos, struct frame_cache_entry, node);
+			if (entry->pfn!=pages->pfn)
+				continue;
+			// the frame may have been freed and reused since it was hashed
+			if (entry->mapping==pg->mapping && entry->index==pg->index && entry->count==page_count(pg))
+			{
+				memcpy(pages->hash, entry->hash, MAX_HASH_SIZE);
+				pages->compressed_size = entry->compressed_size;
+				pages->sketch = entry->sketch;
+				return;
+			}
+			break;
+		}
+		if (pos==NULL)
+			entry = NULL;
+	}
+
+	hash_page(pg, pages->hash);
+	if (compress_page!=NULL)
+		compress_page(pg, &pages->compressed_size);
+	if (sketch_page!=NULL)
+		sketch_page(pg, &pages->sketch);
+
+	if (bucket==NULL)
+		return;
+	// under the page table lock, a frame which is not cached is hashed again
+	if (entry==NULL)
+	{
+		entry = (struct frame_cache_entry*) kmalloc(sizeof(struct frame_cache_entry), GFP_ATOMIC);
+		if (entry==NULL)
+			return;
+		hlist_add_head(&entry->node, bucket);
+	}
+	entry->pfn = pages->pfn;
+	entry->mapping = pg->mapping;
+	entry->index = pg->index;
+	entry->count = page_count(pg);
+	memcpy(entry->hash, pages->hash, MAX_HASH_SIZE);
+	entry->compressed_size = pages->compressed_size;
+	entry->sketch = pages->sketch;
+}
+
+/// keeps the frame cache for VMS_SHARED_FRAMES and releases it otherwise, for VMS_NEW_BATCH
+/// or after FRAME_CACHE_LIFETIME_MS, a batch ends with a write of VMS_RELEASE_SNAPSHOT
+static int prepare_frame_cache(int flags)
+{
+	int i;
+
+	if (!(flags & VMS_SHARED_FRAMES) || flags & VMS_NEW_BATCH || time_after(jiffies, frame_cache_expires))
+		release_frame_cache();
+	if (!(flags & VMS_SHARED_FRAMES) || frame_cache!=NULL)
+		return 0;
+
+	frame_cache = (struct hlist_head*) vmalloc(sizeof(struct hlist_head) << FRAME_CACHE_BITS);
+	if (frame_cache==NULL)
+	{
+		printk(KERN_ALERT "OUT_OF_MEMORY: allocating frame cache\n");
+		return -1;
+	}
+	for (i=0;i<1<<FRAME_CACHE_BITS;i++)
+		INIT_HLIST_HEAD(&frame_cache[i]);
+	frame_cache_expires = jiffies + msecs_to_jiffies(FRAME_CACHE_LIFETIME_MS);
+	return 0;
+}
+
+static void release_frame_cache(void)
+{
+	struct frame_cache_entry *entry;
+	struct hlist_node *pos;
+	int i;
+
+	if (frame_cache==NULL)
+		return;
+	for (i=0;i<1<<FRAME_CACHE_BITS;i++)
+	{
+		while ((pos = frame_cache[i].first)!=NULL)
+		{
+			entry = hlist_entry(pos, struct frame_cache_entry, node);
+			hlist_del(pos);
+			kfree(entry);
+		}
+	}
+	vfree(frame_cache);
+	frame_cache = NULL;
+}
+
 static int take_physical_snapshot(struct input_buffer *input, struct SnapshotInfo ** result)
 {
 	struct resource *t;
@@ -1732,6 +2119,9 @@ static int take_physical_snapshot(struct input_buffer *input, struct SnapshotInf
 
 			
 	hashfunction = get_hashfunction(input->flags);
+	compress_page = get_compressfunction(input->flags);
+	sketch_page = input->flags & VMS_SKETCH_SIMHASH ? sketch_page_simhash : NULL;
+	release_frame_cache();
 
 
 	snap->timestamp_begin = jiffies_to_msecs(jiffies);
@@ -1748,6 +2138,7 @@ static int take_physical_snapshot(struct input_buffer *input, struct SnapshotInf
 	}
 
 	snap->timestamp_end = jiffies_to_msecs(jiffies);
+	release_compress_buffers();
 
 	snap->size_pages = sizeof(struct PageTableEntryInfo) * snap->available_pages;
 	
@@ -0,0 +1,394 @@
+// compares the flat page maps of hashhelper with tr1 unordered_maps
+// needs to be compiled as c++
+
+#include "../include/vmsnapshot.h"
+#include "../include/hashhelper.h"
+#include "../include/vmsdedup.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef unordered_map<ContentKey, struct PageTableEntryInfo*, HashKeyHash<CONTENT_KEY_SIZE> > TR1ContentMap;
+typedef unordered_map<unsigned long, struct PageTableEntryInfo*> TR1PFNMap;
+
+double GetTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// inserts and finds every present page by content and by pfn
+template<class CMap, class PMap> void BenchMaps(const char *name, VMSNAPSHOT snap)
+{
+	CMap *content = new CMap();
+	PMap *pfns = new PMap();
+	double start, insert_time, find_time;
+	unsigned long found = 0;
+	unsigned long i;
+
+	start = GetTime();
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (snap->pages[i].present <= 0)
+			continue;
+		content->insert(ContentPair(ContentKey(snap->pages[i].hash), &snap->pages[i]));
+		pfns->insert(PFNPair((unsigned long)snap->pages[i].pfn, &snap->pages[i]));
+	}
+	insert_time = GetTime() - start;
+
+	start = GetTime();
+	for (i=0;i<snap->available_pages;i++)
+	{
+		if (content->find(ContentKey(snap->pages[i].hash))!=content->end())
+			found++;
+		if (pfns->find((unsigned long)snap->pages[i].pfn)!=pfns->end())
+			found++;
+	}
+	find_time = GetTime() - start;
+
+	printf("%s;%lu;%lu;%lu;%.2f;%.2f;\n", name, (unsigned long)content->size(), (unsigned long)pfns->size(), found, insert_time, find_time);
+
+	delete content;
+	delete pfns;
+}
+
+// adds all snapshots in order - sequentially, with shard threads and by sorting
+void BenchBatch(int count, const char* paths[], int shard_count)
+{
+	VMSNAPSHOT *snaps;
+	HashMap *map;
+	ShardedHashMap *sharded;
+	struct CollisionInfo info;
+	double start;
+	int i;
+
+	snaps = new VMSNAPSHOT[count];
+	for (i=0;i<count;i++)
+		if ((snaps[i] = LoadSnapshot(paths[i]))==NULL)
+			break;
+	if (i==count)
+	{
+		PrintCollisionInfoHeader();
+		printf("ms;\n");
+
+		memset(&info, 0, sizeof(struct CollisionInfo));
+		map = CreateHashMap();
+		start = GetTime();
+		for (i=0;i<count;i++)
+			AddSnapshotToHashMap(map, snaps[i], &info);
+		PrintCollisionInfo(&info);
+		printf("%.2f;\n", GetTime() - start);
+		ReleaseHashMap(map);
+
+		memset(&info, 0, sizeof(struct CollisionInfo));
+		sharded = CreateShardedHashMap(shard_count);
+		start = GetTime();
+		AddSnapshotsToShardedHashMap(sharded, snaps, count, &info);
+		PrintCollisionInfo(&info);
+		printf("%.2f;\n", GetTime() - start);
+		ReleaseShardedHashMap(sharded);
+
+		memset(&info, 0, sizeof(struct CollisionInfo));
+		start = GetTime();
+		SortMergeDedup(snaps, count, shard_count, &info);
+		PrintCollisionInfo(&info);
+		printf("%.2f;\n", GetTime() - start);
+	}
+
+	for (i=0;i<count;i++)
+		ReleaseSnapshot(snaps[i]);
+	delete[] snaps;
+}
+
+// slides a window of window_size snapshots over all snapshots, incrementally and by rebuilding
+void BenchWindow(int count, const char* paths[], int window_size)
+{
+	VMSNAPSHOT *window, snap;
+	WindowHashMap *map, *rebuilt;
+	struct WindowInfo info, check;
+	double start, update_time, rebuild_time;
+	int *ids;
+	int i, k;
+
+	window = new VMSNAPSHOT[window_size];
+	ids = new int[window_size];
+	for (k=0;k<window_size;k++)
+		window[k] = NULL;
+	map = CreateWindowHashMap();
+
+	printf("window;snapshots;pages;contents;shareable;shared contents;zero pages;update ms;rebuild ms;\n");
+	for (i=0;i<count;i++)
+	{
+		snap = LoadSnapshot(paths[i]);
+		if (snap==NULL)
+		{
+			printf("Could not load Snapshot %s\n", paths[i]);
+			break;
+		}
+
+		k = i % window_size;
+		start = GetTime();
+		if (window[k]!=NULL)
+		{
+			RemoveSnapshotFromHashMap(map, ids[k]);
+			ReleaseSnapshot(window[k]);
+		}
+		window[k] = snap;
+		ids[k] = AddSnapshotToWindowHashMap(map, snap);
+		update_time = GetTime() - start;
+		GetWindowInfo(map, &info);
+
+		// the oldest snapshot first, like the window
+		start = GetTime();
+		rebuilt = CreateWindowHashMap();
+		for (k=i+1;k<=i+window_size;k++)
+			if (window[k % window_size]!=NULL)
+				AddSnapshotToWindowHashMap(rebuilt, window[k % window_size]);
+		rebuild_time = GetTime() - start;
+		GetWindowInfo(rebuilt, &check);
+		ReleaseWindowHashMap(rebuilt);
+		if (memcmp(&info, &check, sizeof(struct WindowInfo))!=0)
+			printf("window differs from the rebuilt map\n");
+
+		printf("%s;%d;%lu;%lu;%lu;%lu;%lu;%.2f;%.2f;\n", paths[i], info.snapshots, info.pages, info.contents,
+			info.shareable, info.shared_contents, info.zero_pages, update_time, rebuild_time);
+	}
+
+	for (k=0;k<window_size;k++)
+		if (window[k]!=NULL)
+			ReleaseSnapshot(window[k]);
+	ReleaseWindowHashMap(map);
+	delete[] window;
+	delete[] ids;
+}
+
+// adds all snapshots to a HashMap and saves it as index file
+void SaveIndex(const char *path, int count, const char* paths[])
+{
+	VMSNAPSHOT *snaps;
+	HashMap *map;
+	struct CollisionInfo info;
+	double start;
+	int flags = 0;
+	int i;
+
+	snaps = new VMSNAPSHOT[count];
+	map = CreateHashMap();
+	memset(&info, 0, sizeof(struct CollisionInfo));
+	for (i=0;i<count;i++)
+	{
+		// the map points into the snapshots, they are released after saving
+		snaps[i] = LoadSnapshot(paths[i]);
+		if (snaps[i]==NULL)
+		{
+			printf("Could not load Snapshot %s\n", paths[i]);
+			continue;
+		}
+		flags = snaps[i]->flags;
+		AddSnapshotToHashMap(map, snaps[i], &info);
+	}
+
+	start = GetTime();
+	if (SaveHashMapIndex(map, flags, path)==0)
+		printf("%s;%lu;%lu;%.2f;\n", path, (unsigned long)map->hm->size(), (unsigned long)map->pm->size(), GetTime() - start);
+
+	ReleaseHashMap(map);
+	for (i=0;i<count;i++)
+		if (snaps[i]!=NULL)
+			ReleaseSnapshot(snaps[i]);
+	delete[] snaps;
+}
+
+// probes all snapshots against an index file like TestSnapshotAgainstHashMap
+void ProbeIndex(const char *path, int count, const char* paths[])
+{
+	VMSNAPSHOT snap;
+	HashMapIndex *index;
+	HashMap *map2;
+	struct CollisionInfo info, info2;
+	double start;
+	int i;
+
+	start = GetTime();
+	index = LoadHashMapIndex(path);
+	if (index==NULL)
+		return;
+	printf("%s;%lu;%lu;%.2f;\n", path, index->header->content_count, index->header->pfn_count, GetTime() - start);
+
+	map2 = CreateHashMap();
+	PrintCollisionInfoHeader();
+	printf("ms;\n");
+	for (i=0;i<count;i++)
+	{
+		snap = LoadSnapshot(paths[i]);
+		if (snap==NULL)
+		{
+			printf("Could not load Snapshot %s\n", paths[i]);
+			continue;
+		}
+
+		memset(&info, 0, sizeof(struct CollisionInfo));
+		memset(&info2, 0, sizeof(struct CollisionInfo));
+		start = GetTime();
+		TestSnapshotAgainstHashMapIndex(snap, index, map2, &info, &info2);
+		PrintCollisionInfo(&info);
+		printf("%.2f;\n", GetTime() - start);
+		PrintCollisionInfo(&info2);
+		printf("\n");
+
+		// map2 points into the snapshot
+		ClearHashMap(map2);
+		ReleaseSnapshot(snap);
+	}
+
+	ReleaseHashMap(map2);
+	ReleaseHashMapIndex(index);
+}
+
+// tests snapshots against a baseline HashMap without and with bloom filter
+void BenchFilter(int base_count, int count, const char* paths[])
+{
+	VMSNAPSHOT *snaps;
+	HashMap *map, *map2;
+	struct CollisionInfo info, info2, filtered, filtered2;
+	double start, plain_time, filter_time;
+	int i;
+
+	snaps = new VMSNAPSHOT[count];
+	for (i=0;i<count;i++)
+		if ((snaps[i] = LoadSnapshot(paths[i]))==NULL)
+			break;
+	if (i==count)
+	{
+		map = CreateHashMap();
+		map2 = CreateHashMap();
+		memset(&info, 0, sizeof(struct CollisionInfo));
+		for (i=0;i<base_count;i++)
+			AddSnapshotToHashMap(map, snaps[i], &info);
+
+		printf("snapshot;unshareable;shareable;ms;filter ms;\n");
+		for (i=base_count;i<count;i++)
+		{
+			memset(&info, 0, sizeof(struct CollisionInfo));
+			memset(&info2, 0, sizeof(struct CollisionInfo));
+			DisableHashMapFilter(map);
+			ClearHashMap(map2);
+			start = GetTime();
+			TestSnapshotAgainstHashMap(snaps[i], map, map2, &info, &info2);
+			plain_time = GetTime() - start;
+
+			memset(&filtered, 0, sizeof(struct CollisionInfo));
+			memset(&filtered2, 0, sizeof(struct CollisionInfo));
+			EnableHashMapFilter(map, 0);
+			ClearHashMap(map2);
+			start = GetTime();
+			TestSnapshotAgainstHashMap(snaps[i], map, map2, &filtered, &filtered2);
+			filter_time = GetTime() - start;
+
+			if (memcmp(&info, &filtered, sizeof(struct CollisionInfo))!=0 || memcmp(&info2, &filtered2, sizeof(struct CollisionInfo))!=0)
+				printf("filtered results differ\n");
+			printf("%s;%d;%d;%.2f;%.2f;\n", paths[i], info.unshareable, info.shareable, plain_time, filter_time);
+		}
+
+		ReleaseHashMap(map);
+		ReleaseHashMap(map2);
+	}
+	else
+		printf("Could not load Snapshot %s\n", paths[i]);
+
+	// the maps point into the snapshots
+	while (i-- > 0)
+		ReleaseSnapshot(snaps[i]);
+	delete[] snaps;
+}
+
+int main(int argc, const char* argv[])
+{
+	VMSNAPSHOT snap;
+	HashMap *map;
+	struct CollisionInfo info;
+	double start;
+	int shard_count = 0;
+	int window_size = 0;
+	int index = 1;
+	int i;
+
+	if (argc > 2 && strcmp(argv[1], "-t")==0)
+	{
+		shard_count = atoi(argv[2]);
+		index = 3;
+	}
+	else if (argc > 2 && strcmp(argv[1], "-w")==0)
+	{
+		window_size = atoi(argv[2]);
+		index = 3;
+	}
+	else if (argc > 3 && strcmp(argv[1], "-f")==0)
+	{
+		BenchFilter(atoi(argv[2]), argc-3, &argv[3]);
+		return 0;
+	}
+	else if (argc > 3 && strcmp(argv[1], "-s")==0)
+	{
+		SaveIndex(argv[2], argc-3, &argv[3]);
+		return 0;
+	}
+	else if (argc > 3 && strcmp(argv[1], "-i")==0)
+	{
+		ProbeIndex(argv[2], argc-3, &argv[3]);
+		return 0;
+	}
+
+	if (index >= argc)
+	{
+		printf("This program compares the page maps of hashhelper with tr1 unordered_maps\n");
+		printf("and the sequential AddSnapshotToHashMap with the sharded and the sort-merge version\n");
+		printf("USAGE: <-t shards> snapshot1 snapshot2 ... snapshotN\n");
+		printf("       -w size snapshot1 snapshot2 ... snapshotN\n");
+		printf("       (slides a window of size snapshots over the snapshots)\n");
+		printf("       -f count snapshot1 snapshot2 ... snapshotN\n");
+		printf("       (tests the snapshots behind the first count snapshots against their HashMap,\n");
+		printf("        without and with bloom filter)\n");
+		printf("       -s index snapshot1 snapshot2 ... snapshotN\n");
+		printf("       (saves the HashMap of the snapshots as index file)\n");
+		printf("       -i index snapshot1 snapshot2 ... snapshotN\n");
+		printf("       (tests every snapshot against the index file)\n");
+		return 0;
+	}
+
+	if (window_size > 0)
+	{
+		BenchWindow(argc-index, &argv[index], window_size);
+		return 0;
+	}
+
+	printf("map;contents;pfns;found;insert ms;find ms;\n");
+	for (i=index;i<argc;i++)
+	{
+		snap = LoadSnapshot(argv[i]);
+		if (snap==NULL)
+		{
+			printf("Could not load Snapshot %s\n", argv[i]);
+			continue;
+		}
+
+		BenchMaps<TR1ContentMap, TR1PFNMap>("tr1", snap);
+		BenchMaps<ContentMap, PFNMap>("flat", snap);
+
+		memset(&info, 0, sizeof(struct CollisionInfo));
+		map = CreateHashMap();
+		start = GetTime();
+		AddSnapshotToHashMap(map, snap, &info);
+		printf("AddSnapshotToHashMap;%d;%d;;%.2f;;\n", info.shareable, info.unshareable, GetTime() - start);
+		ReleaseHashMap(map);
+
+		ReleaseSnapshot(snap);
+	}
+
+	BenchBatch(argc-index, &argv[index], shard_count);
+
+	return 0;
+}
@@ -0,0 +1,283 @@
+// prints the dedup potential of snapshot files, larger sets than RAM are sorted on disk
+
+#include "../include/vmsnapshot.h"
+#include "../include/vmsdedup.h"
+#include "../include/vmssketch.h"
+#include "../include/vmsshare.h"
+#include "../include/vmsreport.h"
+#include "../include/vmschunk.h"
+#include "../include/vmssimilar.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// estimates the distinct pages of every file and of all files
+// files ending with SKETCH_EXTENSION are loaded as sketches, the others as snapshots
+int EstimateFiles(int count, const char* paths[], int save)
+{
+	struct PageSketch *total, *sketch;
+	VMSNAPSHOT snap;
+	char path[4096];
+	unsigned long len;
+	int i;
+
+	total = CreatePageSketch(SKETCH_DEFAULT_PRECISION);
+	if (total==NULL)
+		return -1;
+
+	printf("file;distinct pages;\n");
+	for (i=0;i<count;i++)
+	{
+		len = strlen(paths[i]);
+		if (len > strlen(SKETCH_EXTENSION) && strcmp(paths[i] + len - strlen(SKETCH_EXTENSION), SKETCH_EXTENSION)==0)
+			sketch = LoadPageSketch(paths[i]);
+		else
+		{
+			snap = LoadSnapshot(paths[i]);
+			if (snap==NULL)
+			{
+				printf("Could not load Snapshot %s\n", paths[i]);
+				continue;
+			}
+
+			sketch = CreatePageSketch(SKETCH_DEFAULT_PRECISION);
+			if (sketch!=NULL && AddSnapshotToSketch(sketch, snap)==0 && save)
+			{
+				snprintf(path, sizeof(path), "%s%s", paths[i], SKETCH_EXTENSION);
+				SavePageSketch(path, sketch);
+			}
+			ReleaseSnapshot(snap);
+		}
+		if (sketch==NULL)
+			continue;
+
+		printf("%s;%lu;\n", paths[i], EstimateDistinctPages(sketch));
+		if (MergePageSketch(total, sketch)!=0)
+		{
+			// a total over different page hashes would count equal pages twice
+			ReleasePageSketch(sketch);
+			ReleasePageSketch(total);
+			return -1;
+		}
+		ReleasePageSketch(sketch);
+	}
+	printf("total;%lu;\n", EstimateDistinctPages(total));
+
+	ReleasePageSketch(total);
+	return 0;
+}
+
+// prints one row per snapshot: pages of the row snapshot which exist in the column snapshot
+void PrintSharingMatrix(struct SharingMatrix *matrix, const char* paths[])
+{
+	int a, b;
+
+	printf("snapshot;");
+	for (b=0;b<matrix->count;b++)
+		printf("%s;", paths[b]);
+	printf("\n");
+
+	for (a=0;a<matrix->count;a++)
+	{
+		printf("%s;", paths[a]);
+		for (b=0;b<matrix->count;b++)
+			printf("%lu;", matrix->pages[a*matrix->count + b]);
+		printf("\n");
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	VMSNAPSHOT *snaps;
+	struct CollisionInfo info;
+	struct SharingMatrix *matrix = NULL;
+	const char *tmp_dir = "/tmp";
+	unsigned long memory_limit = 0;
+	int thread_count = 0;
+	int estimate = 0, save = 0;
+	int sharing = 0, signature_size = 0;
+	struct VerifyInfo verify;
+	struct FileReport *report = NULL;
+	int verify_runs = 0, top = 0;
+	struct ChunkInfo chunk_info;
+	int chunks = 0;
+	struct SimilarityInfo similar_info;
+	int similar = 0, max_distance = 0;
+	int index = 1;
+	int count, i, ret;
+
+	while (index+1 < argc && argv[index][0]=='-')
+	{
+		if (strcmp(argv[index], "-e")==0 || strcmp(argv[index], "-s")==0)
+		{
+			estimate = 1;
+			save |= argv[index][1]=='s';
+			index++;
+			continue;
+		}
+		if (strcmp(argv[index], "-x")==0)
+		{
+			sharing = 1;
+			index++;
+			continue;
+		}
+		if (strcmp(argv[index], "-v")==0)
+		{
+			verify_runs = 1;
+			index++;
+			continue;
+		}
+		if (strcmp(argv[index], "-c")==0)
+		{
+			chunks = 1;
+			index++;
+			continue;
+		}
+		if (strcmp(argv[index], "-a")==0)
+		{
+			sharing = 1;
+			signature_size = atoi(argv[index+1]);
+		}
+		else if (strcmp(argv[index], "-n")==0)
+		{
+			similar = 1;
+			max_distance = atoi(argv[index+1]);
+		}
+		else if (strcmp(argv[index], "-r")==0)
+			top = atoi(argv[index+1]);
+		else if (strcmp(argv[index], "-m")==0)
+			memory_limit = strtoul(argv[index+1], NULL, 10) << 20;
+		else if (strcmp(argv[index], "-d")==0)
+			tmp_dir = argv[index+1];
+		else if (strcmp(argv[index], "-t")==0)
+			thread_count = atoi(argv[index+1]);
+		else
+			break;
+		index += 2;
+	}
+
+	if (index >= argc)
+	{
+		printf("This program computes the CollisionInfo of adding all snapshots in order to one HashMap\n");
+		printf("USAGE: <options> snapshot1 snapshot2 ... snapshotN\n");
+		printf("Options:\n");
+		printf("-m MB \tSorts on disk, the tuples of one partition use at most MB megabytes\n");
+		printf("-d dir\tDirectory of the run files, default /tmp\n");
+		printf("-t n  \tThreads of the radix sort, default one per cpu\n");
+		printf("-e    \tOnly estimates the distinct pages with HyperLogLog sketches,\n");
+		printf("      \tfiles ending with %s are loaded as sketches\n", SKETCH_EXTENSION);
+		printf("-s    \tLike -e, but saves the sketch of every snapshot next to it\n");
+		printf("-x    \tPrints the sharing matrix: pages of every snapshot which exist in the others\n");
+		printf("-a n  \tLike -x, but estimates the matrix with MinHash signatures of n hashes\n");
+		printf("-r n  \tPrints the n files and file pairs with the most shareable pages\n");
+		printf("-v    \tVerifies equal hashes by comparing the pages of the running processes,\n");
+		printf("      \tfor weak hashes like CRC32, the processes should be suspended\n");
+		printf("-c    \tPrints the redundancy below page granularity of snapshots\n");
+		printf("      \ttaken with chunk hashes (flags 0x%x, 0x%x for 2 KiB chunks)\n", VMS_HASH_CHUNKS, VMS_CHUNK_2K);
+		printf("-n k  \tGroups the near duplicate pages whose sketches differ in at most k bits,\n");
+		printf("      \tsnapshots taken with flag 0x%x, default k %d\n", VMS_SKETCH_SIMHASH, SIMILAR_DEFAULT_DISTANCE);
+		return 0;
+	}
+
+	if (estimate)
+		return EstimateFiles(argc - index, &argv[index], save);
+
+	count = argc - index;
+	memset(&info, 0, sizeof(struct CollisionInfo));
+	memset(&verify, 0, sizeof(struct VerifyInfo));
+
+	if (top > 0)
+	{
+		report = CreateFileReport();
+		if (report==NULL)
+			return -1;
+	}
+
+	if (memory_limit > 0 && !sharing && !verify_runs && !chunks && !similar && report==NULL)
+		ret = ExternalSortMergeDedup(&argv[index], count, tmp_dir, memory_limit, thread_count, &info);
+	else
+	{
+		snaps = (VMSNAPSHOT*) malloc(count * sizeof(VMSNAPSHOT));
+		if (snaps==NULL)
+			return -1;
+		for (i=0;i<count;i++)
+		{
+			snaps[i] = LoadSnapshot(argv[index+i]);
+			if (snaps[i]==NULL)
+			{
+				printf("Could not load Snapshot %s\n", argv[index+i]);
+				break;
+			}
+		}
+		if (i < count)
+			ret = -1;
+		else if (chunks)
+			ret = ComputeChunkInfo(snaps, count, &chunk_info);
+		else if (similar)
+			ret = FindNearDuplicates(snaps, count, max_distance, &similar_info);
+		else if (sharing)
+		{
+			if (signature_size > 0)
+				matrix = EstimateSharingMatrix(snaps, count, signature_size);
+			else
+				matrix = ComputeSharingMatrix(snaps, count, thread_count);
+			ret = matrix!=NULL ? 0 : -1;
+		}
+		else
+			ret = SortMergeDedupEx(snaps, count, thread_count, &info, verify_runs ? &verify : NULL, report);
+		while (i-- > 0)
+			ReleaseSnapshot(snaps[i]);
+		free(snaps);
+	}
+
+	if (ret < 0)
+	{
+		ReleaseFileReport(report);
+		return -1;
+	}
+
+	if (matrix!=NULL)
+	{
+		PrintSharingMatrix(matrix, &argv[index]);
+		ReleaseSharingMatrix(matrix);
+		return 0;
+	}
+
+	if (chunks)
+	{
+		PrintChunkInfoHeader();
+		printf("\n");
+		PrintChunkInfo(&chunk_info);
+		printf("\n");
+		return 0;
+	}
+
+	if (similar)
+	{
+		PrintSimilarityInfoHeader();
+		printf("\n");
+		PrintSimilarityInfo(&similar_info);
+		printf("\n");
+		return 0;
+	}
+
+	if (verify_runs)
+	{
+		printf("runs;pages;false collisions;unreadable;\n");
+		printf("%lu;%lu;%lu;%lu;\n", verify.runs, verify.pages, verify.false_collisions, verify.unreadable);
+	}
+
+	PrintCollisionInfoHeader();
+	printf("\n");
+	PrintCollisionInfo(&info);
+	printf("\n");
+
+	if (report!=NULL)
+	{
+		printf("\n");
+		PrintFileReport(report, top);
+		ReleaseFileReport(report);
+	}
+	return 0;
+}
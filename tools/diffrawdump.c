@@ -0,0 +1,67 @@
+#include "../include/vmsnapshot.h"
+#include "../include/vmsdiff.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void PrintDiffPage(unsigned long address, int diff_class, struct PageTableEntryInfo *old_page, struct PageTableEntryInfo *new_page, void *data)
+{
+	if (diff_class == DIFF_UNCHANGED)
+		return;
+
+	printf("%lx;%s;", address, GetDiffClassName(diff_class));
+	if (old_page!=NULL && old_page->present > 0)
+		printf("%lx;", old_page->pfn);
+	else
+		printf(";");
+	if (new_page!=NULL && new_page->present > 0)
+		printf("%lx;\n", new_page->pfn);
+	else
+		printf(";\n");
+}
+
+int main(int argc, const char* argv[])
+{
+	VMSNAPSHOT old_snap, new_snap;
+	struct SnapshotDiff *diff;
+	struct InputParams result;
+	int index;
+
+	index = ProcessInputParams(argc, argv, &result);
+
+	if (index+2 > argc)
+	{
+		printf("This program compares two snapshots of the same process\n");
+		printf("USAGE: <options> old new\n");
+		printf("old and new are snapshot files or pid:flags\n");
+		printf("Options:\n");
+		printf("-x \tPrints every page which is not unchanged\n");
+		return 0;
+	}
+
+	old_snap = AcquireSnapshot(argv[index], strlen(argv[index]));
+	if (old_snap==NULL)
+	{
+		printf("Could not load Snapshot %s\n", argv[index]);
+		return -1;
+	}
+	new_snap = AcquireSnapshot(argv[index+1], strlen(argv[index+1]));
+	if (new_snap==NULL)
+	{
+		printf("Could not load Snapshot %s\n", argv[index+1]);
+		ReleaseSnapshot(old_snap);
+		return -1;
+	}
+
+	diff = DiffSnapshots(old_snap, new_snap, result.extra ? PrintDiffPage : NULL, NULL);
+	if (diff!=NULL)
+	{
+		PrintSnapshotDiff(diff);
+		ReleaseSnapshotDiff(diff);
+	}
+
+	ReleaseSnapshot(new_snap);
+	ReleaseSnapshot(old_snap);
+
+	return diff!=NULL ? 0 : -1;
+}
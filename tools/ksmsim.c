@@ -0,0 +1,105 @@
+// replays a time series of snapshots through the KSM merge simulator
+// needs to be compiled as c++
+
+#include "../include/vmsnapshot.h"
+#include "../include/vmsksm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+void PrintKSMStats(const char *name, int pid, const struct KSMStats *stats, unsigned long start_ms)
+{
+	printf("%s;%d;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%.2f;%.2f;\n", name, pid, stats->time_ms - start_ms, stats->pages,
+		stats->pages_shared, stats->pages_sharing, stats->pages_unshared, stats->pages_volatile,
+		stats->full_scans, stats->pages_scanned, stats->cow_breaks, stats->cpu_ms,
+		stats->pages_sharing * 4096.0 / (1024 * 1024));
+}
+
+int main(int argc, const char* argv[])
+{
+	KSMSimulator *sim;
+	struct KSMParams params;
+	struct KSMStats stats;
+	VMSNAPSHOT snap;
+	unsigned long interval_ms = 0, extra_ms = 0;
+	unsigned long time_ms = 0, start_ms = 0;
+	int index = 1;
+	int i;
+
+	InitKSMParams(&params);
+	while (index < argc && argv[index][0]=='-')
+	{
+		if (strcmp(argv[index], "-a")==0)
+		{
+			params.all_anonymous = 1;
+			index++;
+			continue;
+		}
+		if (index+1 >= argc)
+			break;
+		if (strcmp(argv[index], "-p")==0)
+			params.pages_to_scan = strtoul(argv[index+1], NULL, 10);
+		else if (strcmp(argv[index], "-s")==0)
+			params.sleep_ms = strtoul(argv[index+1], NULL, 10);
+		else if (strcmp(argv[index], "-i")==0)
+			interval_ms = strtoul(argv[index+1], NULL, 10);
+		else if (strcmp(argv[index], "-e")==0)
+			extra_ms = strtoul(argv[index+1], NULL, 10);
+		else
+			break;
+		index += 2;
+	}
+
+	if (index >= argc)
+	{
+		printf("This program simulates ksmd on a time series of snapshots\n");
+		printf("USAGE: <options> snapshot1 snapshot2 ... snapshotN\n");
+		printf("Options:\n");
+		printf("-p n  \tPages scanned per wakeup, default %d\n", KSM_DEFAULT_PAGES_TO_SCAN);
+		printf("-s ms \tSleep between wakeups, default %d ms\n", KSM_DEFAULT_SLEEP_MS);
+		printf("-i ms \tTime between snapshots, default the snapshot timestamps\n");
+		printf("      \tor %d ms if they do not increase\n", KSM_DEFAULT_INTERVAL_MS);
+		printf("-e ms \tKeeps scanning for ms after the last snapshot\n");
+		printf("-a    \tMerges all anonymous regions, not only regions with VM_MERGEABLE\n");
+		return 0;
+	}
+
+	sim = CreateKSMSimulator(&params);
+	printf("snapshot;pid;time ms;pages;pages shared;pages sharing;pages unshared;pages volatile;full scans;pages scanned;cow breaks;cpu ms;saved MB;\n");
+	for (i=index;i<argc;i++)
+	{
+		snap = LoadSnapshot(argv[i]);
+		if (snap==NULL)
+		{
+			printf("Could not load Snapshot %s\n", argv[i]);
+			continue;
+		}
+
+		if (i==index)
+			time_ms = start_ms = interval_ms > 0 ? 0 : snap->timestamp_begin;
+		else if (interval_ms > 0)
+			time_ms += interval_ms;
+		else if (snap->timestamp_begin > time_ms)
+			time_ms = snap->timestamp_begin;
+		else
+			time_ms += KSM_DEFAULT_INTERVAL_MS;
+
+		if (AddSnapshotToKSMSimulator(sim, snap, time_ms)==0)
+		{
+			GetKSMStats(sim, &stats);
+			PrintKSMStats(argv[i], snap->pid, &stats, start_ms);
+		}
+		ReleaseSnapshot(snap);
+	}
+
+	if (extra_ms > 0)
+	{
+		RunKSMSimulator(sim, time_ms + extra_ms);
+		GetKSMStats(sim, &stats);
+		PrintKSMStats("end", 0, &stats, start_ms);
+	}
+
+	ReleaseKSMSimulator(sim);
+	return 0;
+}
@@ -1,6 +1,75 @@
 #include "../include/vmsnapshot.h"
+#include "../include/vmsindex.h"
+#include "../include/vmsquery.h"
+#include "../include/vmsexport.h"
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+// prints the pages of [start, end) by using the snapshot index
+int PrintAddressRange(VMSNAPSHOT snap, unsigned long start, unsigned long end)
+{
+	struct SnapshotIndex *index;
+	struct PageIterator iter;
+	struct PageTableEntryInfo *page;
+	unsigned long address;
+	int count=0;
+
+	index = CreateSnapshotIndex(snap);
+	if (index==NULL)
+		return -1;
+
+	InitPageIterator(index, start, end, &iter);
+	while ((page = NextPage(&iter, &address, NULL))!=NULL)
+	{
+		printf("%lx;", address);
+		PrintPages(snap, page - snap->pages, 1);
+		count++;
+	}
+
+	ReleaseSnapshotIndex(index);
+	return count;
+}
+
+// compiles and runs a page query
+int PrintQuery(VMSNAPSHOT snap, const char *querystr)
+{
+	struct PageQuery *query;
+	struct QueryResult *result;
+
+	query = CompilePageQuery(querystr);
+	if (query==NULL)
+		return -1;
+
+	result = RunPageQuery(query, snap);
+	PrintQueryResult(snap, result);
+
+	ReleaseQueryResult(result);
+	ReleasePageQuery(query);
+	return 0;
+}
+
+// writes all pages like 'p' into a file by using a thread pool
+int ExportAllPages(VMSNAPSHOT snap, const char *path, int thread_count)
+{
+	int file, ret;
+
+	file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+	{
+		printf("Could not open %s\n", path);
+		return -1;
+	}
+
+	ret = ExportPages(snap, 0, snap->available_pages, file, thread_count);
+	if (ret!=0)
+		printf("Could not export pages to %s\n", path);
+
+	close(file);
+	return ret;
+}
 
 int main(int argc, const char* argv[])
 {
@@ -20,6 +89,14 @@ int main(int argc, const char* argv[])
 				PrintVMA(snap, 0, snap->vm_region_count);
 			else if(argv[2][0] == 'p')
 				PrintPages(snap, 0, snap->available_pages);
+			else if(argv[2][0] == 'a' && argc > 3)
+				PrintAddressRange(snap, strtoul(argv[3], NULL, 16), strtoul(argv[3], NULL, 16) + 1);
+			else if(argv[2][0] == 'r' && argc > 4)
+				PrintAddressRange(snap, strtoul(argv[3], NULL, 16), strtoul(argv[4], NULL, 16));
+			else if(argv[2][0] == 'q' && argc > 3)
+				PrintQuery(snap, argv[3]);
+			else if(argv[2][0] == 'e' && argc > 3)
+				ExportAllPages(snap, argv[3], argc > 4 ? atoi(argv[4]) : 0);
 		}
 		else
 			PrintSnapshot(snap);
@@ -37,6 +114,10 @@ int main(int argc, const char* argv[])
 		printf("Flags:\n");
 		printf("v\tVirtual Memory Information only\n");
 		printf("p\tAll available pages\n");
+		printf("a addr\tPage at the hexadecimal address\n");
+		printf("r start end\tPages of the hexadecimal address range [start, end)\n");
+		printf("q query\tFilters and aggregates pages, e.g. \"writable && anon && refcount>1 group by vma\"\n");
+		printf("e file [threads]\tWrites all pages like p into a file, formatted by a thread pool\n");
 	}
 	return 0;
 }
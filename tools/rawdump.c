@@ -1,4 +1,5 @@
 #include "../include/vmsnapshot.h"
+#include "../include/vmscgroup.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -12,8 +13,12 @@ int main(int argc, const char* argv[])
 	int i=0,j;
 	int count;
 	int index,loop;
+	int len;
 	struct InputParams result;
 	VMSNAPSHOT *snaps;
+	struct CgroupSnapshot *cs;
+	char path[256];
+	const char *flagsstr;
 
 
 	index = ProcessInputParams(argc, argv, &result);
@@ -21,6 +26,7 @@ int main(int argc, const char* argv[])
 	if (index+1 > argc)
 	{
 		printf("USGAE: <options> pid1:flags pid2:flags ... pidN:flags\n");
+		printf("       @cgroup:flags snapshots all processes of a frozen cgroup\n");
 		PrintOptionsHelp();
 		return 0;
 	}
@@ -51,6 +57,30 @@ int main(int argc, const char* argv[])
 					free(snaps);
 				}
 			}
+			else if (argv[i][0] == '@')
+			{
+				// the flags follow the last colon of the cgroup path
+				flagsstr = strrchr(argv[i], ':');
+				len = flagsstr!=NULL ? flagsstr - &argv[i][1] : strlen(&argv[i][1]);
+				snprintf(path, sizeof(path), "%.*s", len, &argv[i][1]);
+				cs = TakeCgroupSnapshot(path, flagsstr!=NULL ? strtoul(flagsstr+1, NULL, 16) : 0, result.max_pause);
+				if (cs==NULL)
+				{
+					printf("Snapshot could not be taken.\n");
+					return -1;
+				}
+				printf("%s: %d of %d processes, frozen after %lu ms, paused %lu ms%s%s\n", path, cs->count, cs->members,
+					cs->freeze_ms, cs->pause_ms, cs->complete ? "" : " (incomplete)", cs->was_frozen ? " (left frozen)" : "");
+				for (j=0;j<cs->count;j++)
+				{
+					SaveSnapshot(cs->snaps[j]);
+					if (result.csv)
+						PrintSnapshotInfo(cs->snaps[j]);
+					else
+						PrintSnapshotInfoEx(cs->snaps[j]);
+				}
+				ReleaseCgroupSnapshot(cs);
+			}
 			else
 			{
 				snap = TakeSnapshotEx(argv[i], strlen(argv[i]));
@@ -0,0 +1,111 @@
+// samples the working set of a task and prints its hot, warm and cold pages
+
+#include "../include/vmsnapshot.h"
+#include "../include/vmsworkset.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+int main(int argc, const char* argv[])
+{
+	struct WorkingSet *ws;
+	struct WorkingSetInfo *infos, *total;
+	unsigned long interval_ms = WORKSET_DEFAULT_INTERVAL_MS;
+	int samples = WORKSET_DEFAULT_SAMPLES;
+	int hot_percent = WORKSET_DEFAULT_HOT_PERCENT;
+	int page_idle = 0, page_counts = 0;
+	int index = 1;
+	int pid, flags = 0, hot_samples, i;
+	const char *flagsstr;
+
+	while (index < argc && argv[index][0]=='-')
+	{
+		if (strcmp(argv[index], "-i")==0 || strcmp(argv[index], "-p")==0)
+		{
+			page_idle |= argv[index][1]=='i';
+			page_counts |= argv[index][1]=='p';
+			index++;
+			continue;
+		}
+		if (index+1 >= argc)
+			break;
+		if (strcmp(argv[index], "-n")==0)
+			samples = atoi(argv[index+1]);
+		else if (strcmp(argv[index], "-t")==0)
+			interval_ms = strtoul(argv[index+1], NULL, 10);
+		else if (strcmp(argv[index], "-h")==0)
+			hot_percent = atoi(argv[index+1]);
+		else
+			break;
+		index += 2;
+	}
+
+	if (index >= argc || samples <= 0)
+	{
+		printf("This program estimates the working set of a task by sampling its accessed pages\n");
+		printf("USAGE: <options> pid[:flags]\n");
+		printf("Options:\n");
+		printf("-n n  \tSamples, default %d\n", WORKSET_DEFAULT_SAMPLES);
+		printf("-t ms \tInterval of every sample, default %d ms\n", WORKSET_DEFAULT_INTERVAL_MS);
+		printf("-h pct\tA page is hot if it was used in pct percent of the samples, default %d\n", WORKSET_DEFAULT_HOT_PERCENT);
+		printf("-i    \tUses %s instead of clearing the Accessed bits\n", PAGE_IDLE_BITMAP);
+		printf("-p    \tPrints the access count of every page\n");
+		printf("flags \tSnapshot flags of the samples in hex, default %x\n", WORKSET_DEFAULT_FLAGS);
+		return 0;
+	}
+
+	pid = atoi(argv[index]);
+	flagsstr = strchr(argv[index], ':');
+	if (flagsstr!=NULL)
+		flags = strtoul(flagsstr+1, NULL, 16);
+
+	ws = CreateWorkingSet(pid, flags, page_idle);
+	if (ws==NULL)
+		return -1;
+
+	hot_samples = (samples * hot_percent + 99) / 100;
+	printf("sample;pages;hot;warm;cold;hot MB;hot+warm MB;\n");
+	for (i=0;i<samples;i++)
+	{
+		if (SampleWorkingSet(ws, interval_ms)!=0)
+		{
+			printf("Sample %d could not be taken.\n", i);
+			break;
+		}
+		// the task totals after every sample with the final hot threshold
+		infos = ComputeWorkingSetInfo(ws, hot_samples);
+		if (infos!=NULL)
+		{
+			total = &infos[ws->snap->vm_region_count];
+			printf("%d;%lu;%lu;%lu;%lu;%.2f;%.2f;\n", i, total->pages, total->hot, total->warm, total->cold,
+				total->hot * 4096.0 / (1024 * 1024), (total->hot + total->warm) * 4096.0 / (1024 * 1024));
+			free(infos);
+		}
+	}
+
+	if (ws->samples==0)
+	{
+		ReleaseWorkingSet(ws);
+		return -1;
+	}
+
+	printf("\n");
+	PrintWorkingSetInfoHeader();
+	printf("\n");
+	infos = ComputeWorkingSetInfo(ws, hot_samples);
+	if (infos!=NULL)
+	{
+		PrintWorkingSet(ws, infos);
+		free(infos);
+	}
+
+	if (page_counts)
+	{
+		printf("\n");
+		PrintAccessCounts(ws);
+	}
+
+	ReleaseWorkingSet(ws);
+	return 0;
+}